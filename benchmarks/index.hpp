@@ -50,7 +50,7 @@ struct hnsw_index : index_t {
         result.reserve(r.size());
 
         for (auto &x: r) {
-            result.emplace_back(std::move(x.key), x.distance);
+            result.emplace_back(std::string(x.key), x.distance);
         }
 
         return result;
@@ -73,33 +73,21 @@ struct hnsw_index : index_t {
     size_t memory_footprint() const override {
         size_t footprint = 0;
 
-        for (const auto &x: wrapped.index.levels) {
-            footprint += sizeof(x);
-            footprint += sizeof(*x.second.begin()) * x.second.bucket_count();
-        }
+        footprint += sizeof(wrapped.index.level_counts.front()) * wrapped.index.level_counts.capacity();
+        footprint += wrapped.index.top_keys.allocated_bytes();
 
         footprint += sizeof(*wrapped.index.nodes.begin()) * wrapped.index.nodes.bucket_count();
 
         for (const auto &x: wrapped.index.nodes) {
             footprint += sizeof(*x.second.vector.begin()) * x.second.vector.capacity();
-            footprint += sizeof(*x.second.layers.begin()) * x.second.layers.capacity();
+            footprint += x.second.layers.allocated_bytes();
 
             for (const auto &layer: x.second.layers) {
                 footprint += sizeof(*layer.incoming.begin()) * layer.incoming.capacity();
-                footprint += sizeof(*layer.outgoing.begin()) * layer.outgoing.capacity();
             }
         }
 
-        footprint += sizeof(*wrapped.key_to_internal.begin()) * wrapped.key_to_internal.bucket_count();
-        footprint += sizeof(*wrapped.internal_to_key.begin()) * wrapped.internal_to_key.bucket_count();
-
-        for (const auto &x: wrapped.key_to_internal) {
-            footprint += x.first.capacity();
-        }
-
-        for (const auto &x: wrapped.internal_to_key) {
-            footprint += x.second.capacity();
-        }
+        footprint += wrapped.keys.allocated_bytes();
 
         return footprint;
     }
@@ -107,33 +95,22 @@ struct hnsw_index : index_t {
     size_t used_memory() const override {
         size_t footprint = 0;
 
-        for (const auto &x: wrapped.index.levels) {
-            footprint += sizeof(x);
-            footprint += sizeof(*x.second.begin()) * x.second.size();
-        }
+        footprint += sizeof(wrapped.index.level_counts.front()) * wrapped.index.level_counts.size();
+        footprint += wrapped.index.top_keys.used_bytes();
 
         footprint += sizeof(*wrapped.index.nodes.begin()) * wrapped.index.nodes.size();
 
         for (const auto &x: wrapped.index.nodes) {
             footprint += sizeof(*x.second.vector.begin()) * x.second.vector.size();
-            footprint += sizeof(*x.second.layers.begin()) * x.second.layers.size();
+            footprint += x.second.layers.allocated_bytes();
 
             for (const auto &layer: x.second.layers) {
                 footprint += sizeof(*layer.incoming.begin()) * layer.incoming.size();
-                footprint += sizeof(*layer.outgoing.begin()) * layer.outgoing.size();
+                footprint -= sizeof(*layer.outgoing.begin()) * (layer.outgoing.capacity() - layer.outgoing.size());
             }
         }
 
-        footprint += sizeof(*wrapped.key_to_internal.begin()) * wrapped.key_to_internal.size();
-        footprint += sizeof(*wrapped.internal_to_key.begin()) * wrapped.internal_to_key.size();
-
-        for (const auto &x: wrapped.key_to_internal) {
-            footprint += x.first.size();
-        }
-
-        for (const auto &x: wrapped.internal_to_key) {
-            footprint += x.second.size();
-        }
+        footprint += wrapped.keys.used_bytes();
 
         return footprint;
     }
@@ -142,12 +119,8 @@ struct hnsw_index : index_t {
         std::string result;
 
         {
-            size_t levels_footprint = 0;
-
-            for (const auto &x: wrapped.index.levels) {
-                levels_footprint += sizeof(x);
-                levels_footprint += sizeof(*x.second.begin()) * x.second.bucket_count();
-            }
+            size_t levels_footprint = sizeof(wrapped.index.level_counts.front()) * wrapped.index.level_counts.capacity() +
+                                      wrapped.index.top_keys.allocated_bytes();
 
             result += "levels: " + std::to_string(levels_footprint) + "; ";
         }
@@ -165,13 +138,17 @@ struct hnsw_index : index_t {
         }
 
         {
-            size_t layers_vectors_footprint = 0;
+            size_t headers_footprint = 0;
 
             for (const auto &x: wrapped.index.nodes) {
-                layers_vectors_footprint += sizeof(*x.second.layers.begin()) * x.second.layers.capacity();
+                headers_footprint += x.second.layers.allocated_bytes();
+
+                for (const auto &layer: x.second.layers) {
+                    headers_footprint -= sizeof(*layer.outgoing.begin()) * layer.outgoing.capacity();
+                }
             }
 
-            result += "layers vectors: " + std::to_string(layers_vectors_footprint) + "; ";
+            result += "link block headers: " + std::to_string(headers_footprint) + "; ";
         }
 
         {
@@ -198,22 +175,7 @@ struct hnsw_index : index_t {
             result += "outgoing links: " + std::to_string(outgoing_links_footprint) + "; ";
         }
 
-        result += "key_to_internal: " + std::to_string(sizeof(*wrapped.key_to_internal.begin()) * wrapped.key_to_internal.bucket_count()) + "; ";
-        result += "internal_to_key: " + std::to_string(sizeof(*wrapped.internal_to_key.begin()) * wrapped.internal_to_key.bucket_count()) + "; ";
-
-        {
-            size_t keys_footprint = 0;
-
-            for (const auto &x: wrapped.key_to_internal) {
-                keys_footprint += x.first.capacity();
-            }
-
-            for (const auto &x: wrapped.internal_to_key) {
-                keys_footprint += x.second.capacity();
-            }
-
-            result += "keys: " + std::to_string(keys_footprint) + "; ";
-        }
+        result += "keys: " + std::to_string(wrapped.keys.allocated_bytes()) + "; ";
 
         return result;
     }
@@ -222,12 +184,8 @@ struct hnsw_index : index_t {
         std::string result;
 
         {
-            size_t levels_footprint = 0;
-
-            for (const auto &x: wrapped.index.levels) {
-                levels_footprint += sizeof(x);
-                levels_footprint += sizeof(*x.second.begin()) * x.second.size();
-            }
+            size_t levels_footprint = sizeof(wrapped.index.level_counts.front()) * wrapped.index.level_counts.size() +
+                                      wrapped.index.top_keys.used_bytes();
 
             result += "levels: " + std::to_string(levels_footprint) + "; ";
         }
@@ -245,13 +203,17 @@ struct hnsw_index : index_t {
         }
 
         {
-            size_t layers_vectors_footprint = 0;
+            size_t headers_footprint = 0;
 
             for (const auto &x: wrapped.index.nodes) {
-                layers_vectors_footprint += sizeof(*x.second.layers.begin()) * x.second.layers.size();
+                headers_footprint += x.second.layers.allocated_bytes();
+
+                for (const auto &layer: x.second.layers) {
+                    headers_footprint -= sizeof(*layer.outgoing.begin()) * layer.outgoing.capacity();
+                }
             }
 
-            result += "layers vectors: " + std::to_string(layers_vectors_footprint) + "; ";
+            result += "link block headers: " + std::to_string(headers_footprint) + "; ";
         }
 
         {
@@ -278,22 +240,7 @@ struct hnsw_index : index_t {
             result += "outgoing links: " + std::to_string(outgoing_links_footprint) + "; ";
         }
 
-        result += "key_to_internal: " + std::to_string(sizeof(*wrapped.key_to_internal.begin()) * wrapped.key_to_internal.size()) + "; ";
-        result += "internal_to_key: " + std::to_string(sizeof(*wrapped.internal_to_key.begin()) * wrapped.internal_to_key.size()) + "; ";
-
-        {
-            size_t keys_footprint = 0;
-
-            for (const auto &x: wrapped.key_to_internal) {
-                keys_footprint += x.first.size();
-            }
-
-            for (const auto &x: wrapped.internal_to_key) {
-                keys_footprint += x.second.size();
-            }
-
-            result += "keys: " + std::to_string(keys_footprint) + "; ";
-        }
+        result += "keys: " + std::to_string(wrapped.keys.used_bytes()) + "; ";
 
         return result;
     }
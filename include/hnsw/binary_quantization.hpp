@@ -0,0 +1,109 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "prefetch.hpp"
+#include "serialization.hpp"
+#include "vector_view.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+
+namespace hnsw {
+
+
+/** Binary quantizer: one bit per dimension, set when the value is above the threshold of the dimension.
+ *
+ *  Use hnsw_index<Key, std::vector<std::uint64_t>, hamming_distance_t>, insert and search encode()-d vectors.
+ *  Codes take 32 times less memory than floats and are compared with popcount, but distances are coarse,
+ *  so search for several times more results than needed and rerank() them with the original vectors.
+ *  Works best for high-dimensional embeddings.
+ */
+class binary_quantizer_t {
+public:
+    // Without training, the thresholds are zeros and the code is the signs of the values.
+    binary_quantizer_t() = default;
+
+    // Use means of dimensions over the sample as thresholds, which balances bits of embeddings not centered at zero.
+    template<class Vectors>
+    void train(const Vectors &sample) {
+        if (sample.empty()) {
+            throw std::runtime_error("binary_quantizer_t::train: empty sample");
+        }
+
+        auto dimension = vector_view<float>(*sample.begin()).size();
+        std::vector<double> sums(dimension, 0.0);
+
+        for (const auto &item: sample) {
+            vector_view<float> vector(item);
+
+            if (vector.size() != dimension) {
+                throw std::runtime_error("binary_quantizer_t::train: vectors sizes do not match");
+            }
+
+            for (std::size_t i = 0; i < dimension; ++i) {
+                sums[i] += vector[i];
+            }
+        }
+
+        m_thresholds.resize(dimension);
+
+        for (std::size_t i = 0; i < dimension; ++i) {
+            m_thresholds[i] = float(sums[i] / sample.size());
+        }
+    }
+
+    std::vector<std::uint64_t> encode(vector_view<float> vector) const {
+        if (!m_thresholds.empty() && vector.size() != m_thresholds.size()) {
+            throw std::runtime_error("binary_quantizer_t: wrong size of the vector");
+        }
+
+        std::vector<std::uint64_t> result((vector.size() + 63) / 64, 0);
+
+        for (std::size_t i = 0; i < vector.size(); ++i) {
+            float threshold = m_thresholds.empty() ? 0.0f : m_thresholds[i];
+
+            if (vector[i] > threshold) {
+                result[i / 64] |= std::uint64_t(1) << (i % 64);
+            }
+        }
+
+        return result;
+    }
+
+    void save(std::ostream &stream) const {
+        detail::stream_writer_t writer(stream);
+        detail::write_header(writer, "HNSWBIN", 1);
+        detail::write_value(writer, m_thresholds);
+    }
+
+    void load(std::istream &stream) {
+        detail::stream_reader_t reader(stream);
+        detail::read_header(reader, "HNSWBIN", 1);
+        detail::read_value(reader, m_thresholds);
+    }
+
+private:
+    std::vector<float> m_thresholds;
+};
+
+
+}
@@ -0,0 +1,230 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "detail/mapped_file.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+namespace hnsw {
+
+
+namespace detail {
+
+
+inline void sync_path(const std::string &path, int flags) {
+    int fd = ::open(path.c_str(), flags | O_CLOEXEC);
+
+    if (fd < 0) {
+        throw system_error("sync_path: failed to open " + path);
+    }
+
+    int result = ::fsync(fd);
+    ::close(fd);
+
+    if (result != 0) {
+        throw system_error("sync_path: failed to sync " + path);
+    }
+}
+
+
+// Write the snapshot next to the target and rename it, so a crash never leaves a partially written file at path.
+template<class Index>
+void save_atomically(const Index &index, const std::string &path) {
+    auto temporary_path = path + ".tmp";
+
+    {
+        std::ofstream output(temporary_path, std::ios::binary | std::ios::trunc);
+
+        if (!output) {
+            throw std::runtime_error("save_atomically: failed to open " + temporary_path);
+        }
+
+        index.save(output);
+        output.close();
+
+        if (!output) {
+            throw std::runtime_error("save_atomically: failed to write " + temporary_path);
+        }
+    }
+
+    sync_path(temporary_path, O_RDONLY);
+
+    if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+        throw system_error("save_atomically: failed to rename " + temporary_path);
+    }
+
+    auto slash = path.rfind('/');
+    sync_path(slash == std::string::npos ? "." : path.substr(0, slash + 1), O_RDONLY | O_DIRECTORY);
+}
+
+
+}
+
+
+/** A snapshot being written in the background by a child process.
+ *
+ *  Created by start_checkpoint(). The destructor waits for the child if wait() or poll() didn't observe its end.
+ */
+class checkpoint_t {
+public:
+    checkpoint_t() = default;
+
+    explicit checkpoint_t(pid_t pid):
+        m_pid(pid)
+    { }
+
+    checkpoint_t(checkpoint_t &&other) noexcept:
+        m_pid(other.m_pid)
+    {
+        other.m_pid = -1;
+    }
+
+    checkpoint_t &operator=(checkpoint_t &&other) noexcept {
+        if (this != &other) {
+            finish();
+            m_pid = other.m_pid;
+            other.m_pid = -1;
+        }
+
+        return *this;
+    }
+
+    ~checkpoint_t() {
+        finish();
+    }
+
+    bool running() const {
+        return m_pid > 0;
+    }
+
+    // Block until the snapshot is written. Throws if it couldn't be written.
+    void wait() {
+        if (!running()) {
+            return;
+        }
+
+        int status = 0;
+
+        while (::waitpid(m_pid, &status, 0) < 0) {
+            if (errno != EINTR) {
+                m_pid = -1;
+                throw detail::system_error("checkpoint_t::wait: failed to wait for the child process");
+            }
+        }
+
+        m_pid = -1;
+        check_status(status);
+    }
+
+    // Return true if the snapshot is written, false if it is still in progress. Throws if it couldn't be written.
+    bool poll() {
+        if (!running()) {
+            return true;
+        }
+
+        int status = 0;
+        auto result = ::waitpid(m_pid, &status, WNOHANG);
+
+        if (result == 0) {
+            return false;
+        }
+
+        m_pid = -1;
+
+        if (result < 0) {
+            throw detail::system_error("checkpoint_t::poll: failed to wait for the child process");
+        }
+
+        check_status(status);
+        return true;
+    }
+
+private:
+    static void check_status(int status) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            throw std::runtime_error("checkpoint_t: failed to write the snapshot");
+        }
+    }
+
+    void finish() noexcept {
+        try {
+            wait();
+        } catch (...) {
+        }
+    }
+
+private:
+    pid_t m_pid = -1;
+};
+
+
+/** Save the index to path in a forked child process and return immediately.
+ *
+ *  The child sees the index as it was at the moment of the call, while the parent keeps modifying it.
+ *  The kernel copies only the pages which the parent changes while the child is running, so writers pay with a page fault
+ *  per touched page instead of waiting for the whole index to be serialized.
+ *  The call itself takes time proportional to the number of page table entries of the process,
+ *  which is milliseconds for tens of gigabytes.
+ *
+ *  The index must not be modified during the call, so hold the lock which serializes writers.
+ *  In a multithreaded process the child gets only the calling thread, and it serializes the index with iostreams
+ *  and allocates memory. A lock held by another thread at the moment of the call stays locked in the child forever,
+ *  so start checkpoints only while no other thread is inside the index, its allocator (e.g. a thread-safe slab_pool_t)
+ *  or iostreams, or the child may deadlock.
+ *
+ *  The snapshot is written to path + ".tmp", synced and then renamed to path. Until wait() or poll() reports success
+ *  the previous snapshot at path stays intact. To pair it with operation_log, start a new log together with the checkpoint
+ *  and remove the previous one after the checkpoint is complete.
+ */
+template<class Index>
+checkpoint_t start_checkpoint(const Index &index, const std::string &path) {
+    std::fflush(nullptr);
+
+    pid_t pid = ::fork();
+
+    if (pid < 0) {
+        throw detail::system_error("start_checkpoint: failed to fork");
+    }
+
+    if (pid == 0) {
+        int code = 0;
+
+        try {
+            detail::save_atomically(index, path);
+        } catch (...) {
+            code = 1;
+        }
+
+        // Skip atexit handlers and destructors of static objects, which belong to the parent.
+        ::_exit(code);
+    }
+
+    return checkpoint_t(pid);
+}
+
+
+}
@@ -0,0 +1,149 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "hopscotch-map-1.4.0/src/hopscotch_map.h"
+
+#include "../detail/undef_hopscotch_macros.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+
+namespace hnsw {
+
+
+/** Unique keys in a vector, whose positions are kept in a hash map, so that keys are found and erased in constant time.
+ *
+ *  Erasing a key moves the last key into its place, so the order of keys is preserved only by inserts.
+ */
+template<class Key, class Allocator = std::allocator<Key>>
+class indexed_vector {
+public:
+    using size_type = std::size_t;
+    using value_type = Key;
+    using allocator_type = Allocator;
+    using container_type = std::vector<value_type, allocator_type>;
+    using const_iterator = typename container_type::const_iterator;
+
+private:
+    using positions_t = tsl::hopscotch_map<value_type,
+                                           size_type,
+                                           std::hash<value_type>,
+                                           std::equal_to<value_type>,
+                                           typename std::allocator_traits<Allocator>::template rebind_alloc<std::pair<value_type, size_type>>>;
+
+public:
+    explicit indexed_vector(const allocator_type &allocator = allocator_type()):
+        m_values(allocator),
+        m_positions(0, std::hash<value_type>(), std::equal_to<value_type>(), allocator)
+    { }
+
+    allocator_type get_allocator() const {
+        return m_values.get_allocator();
+    }
+
+    const_iterator begin() const {
+        return m_values.begin();
+    }
+
+    const_iterator end() const {
+        return m_values.end();
+    }
+
+    size_type size() const {
+        return m_values.size();
+    }
+
+    bool empty() const {
+        return m_values.empty();
+    }
+
+    const value_type &front() const {
+        return m_values.front();
+    }
+
+    const value_type &back() const {
+        return m_values.back();
+    }
+
+    const value_type &operator[](size_type i) const {
+        return m_values[i];
+    }
+
+    size_type count(const value_type &value) const {
+        return m_positions.count(value);
+    }
+
+    // Appends the value if it's not present yet and returns whether it was appended.
+    bool insert(const value_type &value) {
+        if (!m_positions.emplace(value, m_values.size()).second) {
+            return false;
+        }
+
+        try {
+            m_values.push_back(value);
+        } catch (...) {
+            m_positions.erase(value);
+            throw;
+        }
+
+        return true;
+    }
+
+    // Returns the number of erased values.
+    size_type erase(const value_type &value) {
+        auto it = m_positions.find(value);
+
+        if (it == m_positions.end()) {
+            return 0;
+        }
+
+        auto position = it->second;
+        m_positions.erase(it);
+
+        if (position + 1 != m_values.size()) {
+            m_values[position] = std::move(m_values.back());
+            m_positions.find(m_values[position]).value() = position;
+        }
+
+        m_values.pop_back();
+        return 1;
+    }
+
+    void clear() {
+        m_values.clear();
+        m_positions.clear();
+    }
+
+    size_type allocated_bytes() const {
+        return sizeof(value_type) * m_values.capacity() + sizeof(std::pair<value_type, size_type>) * m_positions.bucket_count();
+    }
+
+    size_type used_bytes() const {
+        return (sizeof(value_type) + sizeof(std::pair<value_type, size_type>)) * m_values.size();
+    }
+
+private:
+    container_type m_values;
+    positions_t m_positions;
+};
+
+
+}
@@ -0,0 +1,566 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "hopscotch-map-1.4.0/src/hopscotch_set.h"
+#include "../string_view.hpp"
+
+#include "../detail/undef_hopscotch_macros.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace hnsw {
+
+
+namespace detail {
+
+
+// FNV-1a with a final mix, since the tables take the lowest bits of hashes.
+inline std::size_t hash_bytes(const void *data, std::size_t size) {
+    auto bytes = static_cast<const unsigned char *>(data);
+    std::uint64_t hash = 14695981039346656037ull;
+
+    for (std::size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+
+    return std::size_t(hash);
+}
+
+
+// Keys in an array indexed by internal keys. Slots of released keys hold Key().
+template<class Key, class Allocator>
+class key_array {
+public:
+    using key_type = Key;
+    using view_type = Key;
+    using size_type = std::size_t;
+
+    explicit key_array(const Allocator &allocator):
+        m_keys(allocator)
+    { }
+
+    size_type size() const {
+        return m_keys.size();
+    }
+
+    view_type operator[](size_type i) const {
+        return m_keys[i];
+    }
+
+    std::size_t hash(size_type i) const {
+        return hash_key(m_keys[i]);
+    }
+
+    static std::size_t hash_key(const key_type &key) {
+        return std::hash<key_type>()(key);
+    }
+
+    bool equal(size_type i, const key_type &key) const {
+        return m_keys[i] == key;
+    }
+
+    void push_back(const key_type &key) {
+        m_keys.push_back(key);
+    }
+
+    void assign(size_type i, const key_type &key) {
+        m_keys[i] = key;
+    }
+
+    void release(size_type i) {
+        m_keys[i] = key_type();
+    }
+
+    void resize(size_type size) {
+        m_keys.resize(size);
+    }
+
+    void reserve(size_type size) {
+        m_keys.reserve(size);
+    }
+
+    void shrink_to_fit() {
+        m_keys.shrink_to_fit();
+    }
+
+    size_type allocated_bytes() const {
+        return sizeof(key_type) * m_keys.capacity();
+    }
+
+    size_type used_bytes() const {
+        return sizeof(key_type) * m_keys.size();
+    }
+
+private:
+    std::vector<key_type, typename std::allocator_traits<Allocator>::template rebind_alloc<key_type>> m_keys;
+};
+
+
+// Strings are stored back to back in one array of characters and are returned as views of it.
+// Characters of released strings stay in the array until shrink_to_fit().
+template<class Char, class Traits, class StringAllocator, class Allocator>
+class key_array<std::basic_string<Char, Traits, StringAllocator>, Allocator> {
+public:
+    using key_type = std::basic_string<Char, Traits, StringAllocator>;
+    using view_type = basic_string_view<Char, Traits>;
+    using size_type = std::size_t;
+
+    explicit key_array(const Allocator &allocator):
+        m_chars(allocator),
+        m_spans(allocator)
+    { }
+
+    size_type size() const {
+        return m_spans.size();
+    }
+
+    view_type operator[](size_type i) const {
+        return view_type(m_chars.data() + m_spans[i].offset, m_spans[i].size);
+    }
+
+    std::size_t hash(size_type i) const {
+        return hash_bytes(m_chars.data() + m_spans[i].offset, sizeof(Char) * m_spans[i].size);
+    }
+
+    static std::size_t hash_key(const key_type &key) {
+        return hash_bytes(key.data(), sizeof(Char) * key.size());
+    }
+
+    bool equal(size_type i, const key_type &key) const {
+        return (*this)[i] == view_type(key);
+    }
+
+    void push_back(const key_type &key) {
+        auto span = append(key);
+
+        try {
+            m_spans.push_back(span);
+        } catch (...) {
+            m_chars.resize(span.offset);
+            throw;
+        }
+    }
+
+    void assign(size_type i, const key_type &key) {
+        m_garbage += m_spans[i].size;
+        m_spans[i] = append(key);
+    }
+
+    void release(size_type i) {
+        m_garbage += m_spans[i].size;
+        m_spans[i] = span_t();
+    }
+
+    void resize(size_type size) {
+        m_spans.resize(size);
+    }
+
+    void reserve(size_type size) {
+        m_spans.reserve(size);
+    }
+
+    // Drop characters of released strings. Invalidates views.
+    void shrink_to_fit() {
+        chars_t chars(m_chars.get_allocator());
+        chars.reserve(m_chars.size() - m_garbage);
+
+        for (auto &span: m_spans) {
+            auto offset = chars.size();
+            chars.insert(chars.end(), m_chars.begin() + span.offset, m_chars.begin() + span.offset + span.size);
+            span.offset = offset;
+        }
+
+        m_chars.swap(chars);
+        m_spans.shrink_to_fit();
+        m_garbage = 0;
+    }
+
+    size_type allocated_bytes() const {
+        return sizeof(Char) * m_chars.capacity() + sizeof(span_t) * m_spans.capacity();
+    }
+
+    size_type used_bytes() const {
+        return sizeof(Char) * (m_chars.size() - m_garbage) + sizeof(span_t) * m_spans.size();
+    }
+
+private:
+    struct span_t {
+        std::size_t offset = 0;
+        std::size_t size = 0;
+    };
+
+    using chars_t = std::vector<Char, typename std::allocator_traits<Allocator>::template rebind_alloc<Char>>;
+    using spans_t = std::vector<span_t, typename std::allocator_traits<Allocator>::template rebind_alloc<span_t>>;
+
+    span_t append(const key_type &key) {
+        span_t span;
+        span.offset = m_chars.size();
+        span.size = key.size();
+        m_chars.insert(m_chars.end(), key.begin(), key.end());
+        return span;
+    }
+
+private:
+    chars_t m_chars;
+    spans_t m_spans;
+    // Characters of released strings.
+    std::size_t m_garbage = 0;
+};
+
+
+}
+
+
+/** Bidirectional map between keys and dense internal keys 0, 1, 2, ..., which stores every key once.
+ *
+ *  Keys are stored in an array indexed by internal keys, and internal keys are found by keys in a hash set
+ *  of internal keys, which hashes and compares them through the array. std::basic_string keys are stored
+ *  back to back in one array of characters and are returned as views, see detail::key_array.
+ *
+ *  Internal keys of erased keys are reused by the following inserts.
+ */
+template<class Key, class InternalKey, class Allocator = std::allocator<Key>>
+class key_table {
+    using keys_t = detail::key_array<Key, Allocator>;
+
+public:
+    using key_type = Key;
+    using internal_key_type = InternalKey;
+    using allocator_type = Allocator;
+    using size_type = std::size_t;
+
+    // Key for other keys, a view for strings. Views are invalidated by inserts and by compact().
+    using key_view_type = typename keys_t::view_type;
+
+    using free_keys_t = std::vector<internal_key_type,
+                                    typename std::allocator_traits<Allocator>::template rebind_alloc<internal_key_type>>;
+
+private:
+    // Distinguishes keys from internal keys in lookups, since they may be of the same type.
+    struct lookup_t {
+        const key_type &key;
+    };
+
+    struct hash_t {
+        const keys_t *keys;
+
+        std::size_t operator()(const internal_key_type &internal_key) const {
+            return keys->hash(std::size_t(internal_key));
+        }
+
+        std::size_t operator()(const lookup_t &lookup) const {
+            return keys_t::hash_key(lookup.key);
+        }
+    };
+
+    struct equal_t {
+        using is_transparent = void;
+
+        const keys_t *keys;
+
+        bool operator()(const internal_key_type &l, const internal_key_type &r) const {
+            return l == r;
+        }
+
+        bool operator()(const internal_key_type &l, const lookup_t &r) const {
+            return keys->equal(std::size_t(l), r.key);
+        }
+
+        bool operator()(const lookup_t &l, const internal_key_type &r) const {
+            return keys->equal(std::size_t(r), l.key);
+        }
+    };
+
+    using internal_keys_t = tsl::hopscotch_set<internal_key_type,
+                                               hash_t,
+                                               equal_t,
+                                               typename std::allocator_traits<Allocator>::template rebind_alloc<internal_key_type>>;
+
+    using keys_allocator_t = typename std::allocator_traits<Allocator>::template rebind_alloc<keys_t>;
+
+    struct keys_deleter_t {
+        keys_allocator_t allocator;
+
+        void operator()(keys_t *keys) {
+            keys->~keys_t();
+            std::allocator_traits<keys_allocator_t>::deallocate(allocator, keys, 1);
+        }
+    };
+
+    using keys_ptr_t = std::unique_ptr<keys_t, keys_deleter_t>;
+
+    static keys_ptr_t make_keys(const allocator_type &allocator) {
+        keys_allocator_t keys_allocator(allocator);
+        keys_t *keys = std::allocator_traits<keys_allocator_t>::allocate(keys_allocator, 1);
+
+        try {
+            ::new(static_cast<void *>(keys)) keys_t(allocator);
+        } catch (...) {
+            std::allocator_traits<keys_allocator_t>::deallocate(keys_allocator, keys, 1);
+            throw;
+        }
+
+        return keys_ptr_t(keys, keys_deleter_t {keys_allocator});
+    }
+
+public:
+    using const_iterator = typename internal_keys_t::const_iterator;
+
+    // The array of keys is allocated separately, so that the hash set can point to it and the table stays movable.
+    explicit key_table(const allocator_type &allocator = allocator_type()):
+        m_keys(make_keys(allocator)),
+        m_internal_keys(0, hash_t {m_keys.get()}, equal_t {m_keys.get()}, allocator),
+        m_free_keys(allocator)
+    { }
+
+    key_table(const key_table &other):
+        key_table(std::allocator_traits<allocator_type>::select_on_container_copy_construction(other.get_allocator()))
+    {
+        *m_keys = *other.m_keys;
+        m_internal_keys.reserve(other.size());
+        m_internal_keys.insert(other.begin(), other.end());
+        m_free_keys.assign(other.m_free_keys.begin(), other.m_free_keys.end());
+    }
+
+    // Moved-from tables are empty and usable.
+    key_table(key_table &&other):
+        key_table(other.get_allocator())
+    {
+        m_keys.swap(other.m_keys);
+        m_internal_keys.swap(other.m_internal_keys);
+        m_free_keys.swap(other.m_free_keys);
+    }
+
+    key_table &operator=(const key_table &other) {
+        if (this != &other) {
+            key_table copy(other);
+            *this = std::move(copy);
+        }
+
+        return *this;
+    }
+
+    key_table &operator=(key_table &&other) {
+        if (this != &other) {
+            auto allocator = other.get_allocator();
+            m_keys = std::move(other.m_keys);
+            m_internal_keys = std::move(other.m_internal_keys);
+            m_free_keys = std::move(other.m_free_keys);
+
+            other.m_keys = make_keys(allocator);
+            other.m_internal_keys = internal_keys_t(0, hash_t {other.m_keys.get()}, equal_t {other.m_keys.get()}, allocator);
+            other.m_free_keys.clear();
+        }
+
+        return *this;
+    }
+
+    allocator_type get_allocator() const {
+        return allocator_type(m_free_keys.get_allocator());
+    }
+
+    // Internal keys of the keys in the table.
+    const_iterator begin() const {
+        return m_internal_keys.begin();
+    }
+
+    const_iterator end() const {
+        return m_internal_keys.end();
+    }
+
+    // Number of keys.
+    size_type size() const {
+        return m_internal_keys.size();
+    }
+
+    bool empty() const {
+        return m_internal_keys.empty();
+    }
+
+    // Number of internal keys handed out, i.e. all internal keys are below it. Some of them may be free.
+    size_type internal_size() const {
+        return m_keys->size();
+    }
+
+    const free_keys_t &free_keys() const {
+        return m_free_keys;
+    }
+
+    // Internal key of the key or nullptr, valid until the table is modified.
+    const internal_key_type *find(const key_type &key) const {
+        auto it = m_internal_keys.find(lookup_t {key});
+        return (it == m_internal_keys.end()) ? nullptr : &*it;
+    }
+
+    // The internal key must be in the table.
+    key_view_type key(const internal_key_type &internal_key) const {
+        return (*m_keys)[std::size_t(internal_key)];
+    }
+
+    // Returns the internal key of the key and whether it was inserted.
+    std::pair<internal_key_type, bool> insert(const key_type &key) {
+        if (auto existing = find(key)) {
+            return {*existing, false};
+        }
+
+        bool reuse = !m_free_keys.empty();
+
+        if (!reuse && m_keys->size() > std::size_t(std::numeric_limits<internal_key_type>::max())) {
+            throw std::runtime_error("key_table::insert: internal keys are exhausted");
+        }
+
+        // erase() mustn't fail after the key is gone from the hash set, so there is a free slot for every internal key.
+        if (!reuse && m_free_keys.capacity() <= m_keys->size()) {
+            m_free_keys.reserve(std::max(m_keys->size() + 1, 2 * m_free_keys.capacity()));
+        }
+
+        auto internal_key = reuse ? m_free_keys.back() : internal_key_type(m_keys->size());
+
+        if (reuse) {
+            m_keys->assign(std::size_t(internal_key), key);
+        } else {
+            m_keys->push_back(key);
+        }
+
+        try {
+            m_internal_keys.insert(internal_key);
+        } catch (...) {
+            m_keys->release(std::size_t(internal_key));
+
+            if (!reuse) {
+                m_keys->resize(m_keys->size() - 1);
+            }
+
+            throw;
+        }
+
+        if (reuse) {
+            m_free_keys.pop_back();
+        }
+
+        return {internal_key, true};
+    }
+
+    void erase(internal_key_type internal_key) {
+        if (m_internal_keys.erase(internal_key) > 0) {
+            m_keys->release(std::size_t(internal_key));
+            m_free_keys.push_back(internal_key);
+        }
+    }
+
+    /** Replace the content with keys from (key, internal key) pairs. Internal keys are below internal_size,
+     *  and the ones which aren't used by the pairs must be listed in free keys in the order of reuse.
+     */
+    template<class PairIt, class FreeIt>
+    void assign(size_type internal_size, PairIt first, PairIt last, FreeIt free_first, FreeIt free_last) {
+        key_table result(get_allocator());
+        result.m_keys->resize(internal_size);
+        result.m_internal_keys.reserve(internal_size);
+
+        std::vector<bool> used(internal_size, false);
+
+        auto use = [&used](const internal_key_type &internal_key) {
+            if (std::size_t(internal_key) >= used.size() || used[std::size_t(internal_key)]) {
+                throw std::runtime_error("key_table::assign: wrong internal key");
+            }
+
+            used[std::size_t(internal_key)] = true;
+        };
+
+        for (; first != last; ++first) {
+            use(first->second);
+            result.m_keys->assign(std::size_t(first->second), first->first);
+
+            if (!result.m_internal_keys.insert(first->second).second || result.find(first->first) != &*result.m_internal_keys.find(first->second)) {
+                throw std::runtime_error("key_table::assign: duplicate key");
+            }
+        }
+
+        for (; free_first != free_last; ++free_first) {
+            use(*free_first);
+            result.m_free_keys.push_back(*free_first);
+        }
+
+        if (result.size() + result.m_free_keys.size() != internal_size) {
+            throw std::runtime_error("key_table::assign: some internal keys are neither used nor free");
+        }
+
+        *this = std::move(result);
+    }
+
+    void reserve(size_type keys_number) {
+        m_keys->reserve(keys_number);
+        m_internal_keys.reserve(keys_number);
+        m_free_keys.reserve(keys_number);
+    }
+
+    // Shrink the hash set to fit and drop characters of erased strings. Invalidates views.
+    void compact() {
+        m_internal_keys.rehash(0);
+        m_keys->shrink_to_fit();
+    }
+
+    size_type allocated_bytes() const {
+        return m_keys->allocated_bytes() +
+               sizeof(internal_key_type) * (m_internal_keys.bucket_count() + m_free_keys.capacity());
+    }
+
+    size_type used_bytes() const {
+        return m_keys->used_bytes() + sizeof(internal_key_type) * (m_internal_keys.size() + m_free_keys.size());
+    }
+
+    bool operator==(const key_table &other) const {
+        if (size() != other.size() || internal_size() != other.internal_size() || m_free_keys != other.m_free_keys) {
+            return false;
+        }
+
+        for (const auto &internal_key: m_internal_keys) {
+            if (other.m_internal_keys.count(internal_key) == 0 || other.key(internal_key) != key(internal_key)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool operator!=(const key_table &other) const {
+        return !(*this == other);
+    }
+
+private:
+    keys_ptr_t m_keys;
+    internal_keys_t m_internal_keys;
+    free_keys_t m_free_keys;
+};
+
+
+}
@@ -0,0 +1,698 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "small_set.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+
+namespace hnsw {
+
+
+/** Links of a node on all its layers, stored in a single allocation:
+ *
+ *      number of layers | size and capacity of each layer | outgoing links of layer 0 | of layer 1 | ... | incoming sets
+ *
+ *  Outgoing links of a layer are an array sorted by key, with the capacity chosen on construction.
+ *  They are accessed through views with the interface of a sorted map, and an array which outgrows its capacity
+ *  reallocates the whole block. Mutable views don't keep pointers into the block, so they survive that,
+ *  while constant views are plain ranges for fast traversal during search.
+ *
+ *  Incoming links aren't bounded, so only headers of their small_sets are inline.
+ */
+template<class Key, class Scalar, class Allocator = std::allocator<std::pair<Key, Scalar>>>
+class node_layers {
+public:
+    using size_type = std::size_t;
+    using allocator_type = Allocator;
+    using link_t = std::pair<Key, Scalar>;
+    using incoming_links_t = small_set<Key, typename std::allocator_traits<Allocator>::template rebind_alloc<Key>>;
+
+private:
+    using unit_t = std::max_align_t;
+    using unit_allocator_t = typename std::allocator_traits<Allocator>::template rebind_alloc<unit_t>;
+
+    static_assert(alignof(link_t) <= alignof(unit_t), "node_layers: links are overaligned");
+    static_assert(alignof(incoming_links_t) <= alignof(unit_t), "node_layers: incoming links are overaligned");
+
+    struct layer_header_t {
+        std::uint32_t size;
+        std::uint32_t capacity;
+    };
+
+    struct compare_t {
+        bool operator()(const link_t &l, const Key &r) const {
+            return l.first < r;
+        }
+
+        bool operator()(const Key &l, const link_t &r) const {
+            return l < r.first;
+        }
+    };
+
+public:
+    // Constant outgoing links of one layer. Like iterators, it's invalidated by modifications of the links.
+    class const_links_view {
+    public:
+        using size_type = std::size_t;
+        using key_type = Key;
+        using mapped_type = Scalar;
+        using value_type = link_t;
+        using iterator = const link_t *;
+        using const_iterator = const link_t *;
+        using reverse_iterator = std::reverse_iterator<const_iterator>;
+        using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+        const_links_view(const link_t *begin, size_type size, size_type capacity):
+            m_begin(begin),
+            m_end(begin + size),
+            m_capacity(capacity)
+        { }
+
+        const_iterator begin() const {
+            return m_begin;
+        }
+
+        const_iterator end() const {
+            return m_end;
+        }
+
+        const_iterator cbegin() const {
+            return m_begin;
+        }
+
+        const_iterator cend() const {
+            return m_end;
+        }
+
+        const_reverse_iterator rbegin() const {
+            return const_reverse_iterator(m_end);
+        }
+
+        const_reverse_iterator rend() const {
+            return const_reverse_iterator(m_begin);
+        }
+
+        const_reverse_iterator crbegin() const {
+            return rbegin();
+        }
+
+        const_reverse_iterator crend() const {
+            return rend();
+        }
+
+        bool empty() const {
+            return m_begin == m_end;
+        }
+
+        size_type size() const {
+            return size_type(m_end - m_begin);
+        }
+
+        size_type capacity() const {
+            return m_capacity;
+        }
+
+        size_type count(const key_type &k) const {
+            return has(k) ? 1 : 0;
+        }
+
+        bool has(const key_type &k) const {
+            return std::binary_search(m_begin, m_end, k, compare_t());
+        }
+
+    private:
+        const link_t *m_begin;
+        const link_t *m_end;
+        size_type m_capacity;
+    };
+
+    // Outgoing links of one layer with the interface of a sorted map. It stays valid when the block is reallocated.
+    class links_view {
+    public:
+        using size_type = std::size_t;
+        using key_type = Key;
+        using mapped_type = Scalar;
+        using value_type = link_t;
+        using iterator = link_t *;
+        using const_iterator = const link_t *;
+        using reverse_iterator = std::reverse_iterator<iterator>;
+        using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+        links_view(node_layers &owner, size_type layer):
+            m_owner(&owner),
+            m_layer(layer)
+        { }
+
+        operator const_links_view() const {
+            return const_links_view(begin(), size(), capacity());
+        }
+
+        iterator begin() const {
+            return m_owner->links(m_layer);
+        }
+
+        iterator end() const {
+            return begin() + size();
+        }
+
+        const_iterator cbegin() const {
+            return begin();
+        }
+
+        const_iterator cend() const {
+            return end();
+        }
+
+        reverse_iterator rbegin() const {
+            return reverse_iterator(end());
+        }
+
+        reverse_iterator rend() const {
+            return reverse_iterator(begin());
+        }
+
+        const_reverse_iterator crbegin() const {
+            return const_reverse_iterator(cend());
+        }
+
+        const_reverse_iterator crend() const {
+            return const_reverse_iterator(cbegin());
+        }
+
+        bool empty() const {
+            return size() == 0;
+        }
+
+        size_type size() const {
+            return m_owner->header(m_layer).size;
+        }
+
+        size_type capacity() const {
+            return m_owner->header(m_layer).capacity;
+        }
+
+        size_type count(const key_type &k) const {
+            return has(k) ? 1 : 0;
+        }
+
+        bool has(const key_type &k) const {
+            return std::binary_search(begin(), end(), k, compare_t());
+        }
+
+        template<class It>
+        void assign_ordered_unique(It first, It last) {
+            clear();
+            reserve(size_type(std::distance(first, last)));
+
+            for (; first != last; ++first) {
+                m_owner->append_link(m_layer, *first);
+            }
+        }
+
+        std::pair<iterator, bool> insert(value_type &&new_value) {
+            auto it = std::lower_bound(begin(), end(), new_value.first, compare_t());
+
+            if (it != end() && !(new_value.first < it->first)) {
+                return {it, false};
+            }
+
+            auto position = size_type(it - begin());
+
+            if (size() == capacity()) {
+                reserve(capacity() + capacity() / 2 + 1);
+            }
+
+            m_owner->insert_link(m_layer, position, std::move(new_value));
+            return {begin() + position, true};
+        }
+
+        std::pair<iterator, bool> insert(const value_type &new_value) {
+            return insert(value_type(new_value));
+        }
+
+        template<class... Args>
+        std::pair<iterator, bool> emplace(Args &&... args) {
+            return insert(value_type(std::forward<Args>(args)...));
+        }
+
+        size_type erase(const key_type &k) {
+            auto it = std::lower_bound(begin(), end(), k, compare_t());
+
+            if (it == end() || k < it->first) {
+                return 0;
+            }
+
+            m_owner->erase_link(m_layer, size_type(it - begin()));
+            return 1;
+        }
+
+        void clear() {
+            m_owner->clear_links(m_layer);
+        }
+
+        void reserve(size_type capacity) {
+            m_owner->reserve(m_layer, capacity);
+        }
+
+    private:
+        node_layers *m_owner;
+        size_type m_layer;
+    };
+
+    using outgoing_links_t = links_view;
+    using const_outgoing_links_t = const_links_view;
+
+    struct layer_t {
+        outgoing_links_t outgoing;
+        incoming_links_t &incoming;
+    };
+
+    struct const_layer_t {
+        const_outgoing_links_t outgoing;
+        const incoming_links_t &incoming;
+    };
+
+    template<class Owner, class Layer>
+    class layer_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Layer;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = Layer;
+
+        layer_iterator(Owner &owner, size_type layer):
+            m_owner(&owner),
+            m_layer(layer)
+        { }
+
+        Layer operator*() const {
+            return (*m_owner)[m_layer];
+        }
+
+        layer_iterator &operator++() {
+            ++m_layer;
+            return *this;
+        }
+
+        layer_iterator operator++(int) {
+            auto result = *this;
+            ++m_layer;
+            return result;
+        }
+
+        bool operator==(const layer_iterator &other) const {
+            return m_layer == other.m_layer;
+        }
+
+        bool operator!=(const layer_iterator &other) const {
+            return m_layer != other.m_layer;
+        }
+
+    private:
+        Owner *m_owner;
+        size_type m_layer;
+    };
+
+    using iterator = layer_iterator<node_layers, layer_t>;
+    using const_iterator = layer_iterator<const node_layers, const_layer_t>;
+
+public:
+    node_layers() = default;
+
+    explicit node_layers(const allocator_type &allocator):
+        m_block(unit_allocator_t(allocator))
+    { }
+
+    // Layer 0 gets base_capacity links, the upper layers get upper_capacity.
+    node_layers(size_type layers,
+                size_type base_capacity,
+                size_type upper_capacity,
+                const allocator_type &allocator = allocator_type()):
+        m_block(unit_allocator_t(allocator))
+    {
+        create(layers, [&](size_type layer) { return (layer == 0) ? base_capacity : upper_capacity; });
+    }
+
+    node_layers(const node_layers &other):
+        node_layers(std::allocator_traits<allocator_type>::select_on_container_copy_construction(other.get_allocator()))
+    {
+        create(other.size(), [&](size_type layer) { return other.header(layer).capacity; });
+
+        for (size_type layer = 0; layer < size(); ++layer) {
+            for (const auto &link: other[layer].outgoing) {
+                append_link(layer, link);
+            }
+
+            *incoming(layer) = *other.incoming(layer);
+        }
+    }
+
+    node_layers(node_layers &&other) noexcept:
+        m_block(std::move(other.m_block))
+    {
+        other.m_block.data = nullptr;
+    }
+
+    node_layers &operator=(const node_layers &other) {
+        if (this != &other) {
+            node_layers copy(other);
+            swap(copy);
+        }
+
+        return *this;
+    }
+
+    node_layers &operator=(node_layers &&other) noexcept {
+        if (this != &other) {
+            destroy();
+            static_cast<unit_allocator_t &>(m_block) = std::move(static_cast<unit_allocator_t &>(other.m_block));
+            m_block.data = other.m_block.data;
+            other.m_block.data = nullptr;
+        }
+
+        return *this;
+    }
+
+    ~node_layers() {
+        destroy();
+    }
+
+    void swap(node_layers &other) noexcept {
+        using std::swap;
+        swap(static_cast<unit_allocator_t &>(m_block), static_cast<unit_allocator_t &>(other.m_block));
+        swap(m_block.data, other.m_block.data);
+    }
+
+    allocator_type get_allocator() const {
+        return allocator_type(static_cast<const unit_allocator_t &>(m_block));
+    }
+
+    size_type size() const {
+        return m_block.data ? *reinterpret_cast<const std::uint32_t *>(m_block.data) : 0;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // Size of the block.
+    size_type allocated_bytes() const {
+        return units(size(), total_capacity()) * sizeof(unit_t);
+    }
+
+    layer_t operator[](size_type layer) {
+        return {outgoing_links_t(*this, layer), *incoming(layer)};
+    }
+
+    const_layer_t operator[](size_type layer) const {
+        const auto &layer_header = header(layer);
+        return {const_outgoing_links_t(links(layer), layer_header.size, layer_header.capacity), *incoming(layer)};
+    }
+
+    layer_t at(size_type layer) {
+        check_layer(layer);
+        return (*this)[layer];
+    }
+
+    const_layer_t at(size_type layer) const {
+        check_layer(layer);
+        return (*this)[layer];
+    }
+
+    layer_t front() {
+        return (*this)[0];
+    }
+
+    const_layer_t front() const {
+        return (*this)[0];
+    }
+
+    iterator begin() {
+        return iterator(*this, 0);
+    }
+
+    iterator end() {
+        return iterator(*this, size());
+    }
+
+    const_iterator begin() const {
+        return const_iterator(*this, 0);
+    }
+
+    const_iterator end() const {
+        return const_iterator(*this, size());
+    }
+
+    // Make room for at least `capacity` outgoing links on the layer, moving the block if needed.
+    void reserve(size_type layer, size_type capacity) {
+        if (capacity <= header(layer).capacity) {
+            return;
+        }
+
+        relayout([&](size_type i) { return (i == layer) ? capacity : header(i).capacity; });
+    }
+
+    // Give back capacity grown beyond base_capacity and upper_capacity, and free unused capacity of the incoming sets.
+    void shrink_to_fit(size_type base_capacity, size_type upper_capacity) {
+        auto capacity_of = [&](size_type layer) {
+            return std::max<size_type>(header(layer).size, (layer == 0) ? base_capacity : upper_capacity);
+        };
+
+        bool shrink_links = false;
+
+        for (size_type layer = 0; layer < size(); ++layer) {
+            incoming(layer)->shrink_to_fit();
+            shrink_links = shrink_links || capacity_of(layer) < header(layer).capacity;
+        }
+
+        if (shrink_links) {
+            relayout(capacity_of);
+        }
+    }
+
+private:
+    friend class links_view;
+
+    // The allocator is an empty base in most cases, so it takes no space.
+    struct block_t: unit_allocator_t {
+        block_t() = default;
+
+        explicit block_t(const unit_allocator_t &allocator):
+            unit_allocator_t(allocator)
+        { }
+
+        char *data = nullptr;
+    };
+
+    // The block starts with the number of layers and the offset of the incoming sets.
+    static constexpr size_type headers_offset = 2 * sizeof(std::uint32_t);
+
+    static size_type align(size_type offset, size_type alignment) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    static size_type links_offset(size_type layers) {
+        return align(headers_offset + layers * sizeof(layer_header_t), alignof(link_t));
+    }
+
+    static size_type incoming_offset(size_type layers, size_type total_capacity) {
+        return align(links_offset(layers) + total_capacity * sizeof(link_t), alignof(incoming_links_t));
+    }
+
+    static size_type units(size_type layers, size_type total_capacity) {
+        if (layers == 0) {
+            return 0;
+        }
+
+        auto bytes = incoming_offset(layers, total_capacity) + layers * sizeof(incoming_links_t);
+        return (bytes + sizeof(unit_t) - 1) / sizeof(unit_t);
+    }
+
+    layer_header_t &header(size_type layer) const {
+        return reinterpret_cast<layer_header_t *>(m_block.data + headers_offset)[layer];
+    }
+
+    size_type total_capacity() const {
+        size_type result = 0;
+
+        for (size_type layer = 0; layer < size(); ++layer) {
+            result += header(layer).capacity;
+        }
+
+        return result;
+    }
+
+    link_t *links(size_type layer) const {
+        auto offset = links_offset(size());
+
+        for (size_type i = 0; i < layer; ++i) {
+            offset += header(i).capacity * sizeof(link_t);
+        }
+
+        return reinterpret_cast<link_t *>(m_block.data + offset);
+    }
+
+    incoming_links_t *incoming(size_type layer) const {
+        auto offset = reinterpret_cast<const std::uint32_t *>(m_block.data)[1];
+        return reinterpret_cast<incoming_links_t *>(m_block.data + offset) + layer;
+    }
+
+    void check_layer(size_type layer) const {
+        if (layer >= size()) {
+            throw std::out_of_range("node_layers::at: no such layer");
+        }
+    }
+
+    template<class CapacityOf>
+    void create(size_type layers, CapacityOf &&capacity_of) {
+        destroy();
+
+        if (layers == 0) {
+            return;
+        }
+
+        size_type total = 0;
+
+        for (size_type layer = 0; layer < layers; ++layer) {
+            if (capacity_of(layer) > std::numeric_limits<std::uint32_t>::max()) {
+                throw std::length_error("node_layers: too many links");
+            }
+
+            total += capacity_of(layer);
+        }
+
+        if (units(layers, total) * sizeof(unit_t) > std::numeric_limits<std::uint32_t>::max()) {
+            throw std::length_error("node_layers: too many links");
+        }
+
+        unit_allocator_t &allocator = m_block;
+        auto data = std::allocator_traits<unit_allocator_t>::allocate(allocator, units(layers, total));
+        m_block.data = reinterpret_cast<char *>(std::addressof(*data));
+
+        reinterpret_cast<std::uint32_t *>(m_block.data)[0] = std::uint32_t(layers);
+        reinterpret_cast<std::uint32_t *>(m_block.data)[1] = std::uint32_t(incoming_offset(layers, total));
+
+        for (size_type layer = 0; layer < layers; ++layer) {
+            header(layer) = {0, std::uint32_t(capacity_of(layer))};
+        }
+
+        using key_allocator_t = typename incoming_links_t::allocator_type;
+
+        for (size_type layer = 0; layer < layers; ++layer) {
+            ::new (static_cast<void *>(incoming(layer))) incoming_links_t(key_allocator_t(get_allocator()));
+        }
+    }
+
+    // Move the links into a new block with the given capacities.
+    template<class CapacityOf>
+    void relayout(CapacityOf &&capacity_of) {
+        node_layers moved(get_allocator());
+        moved.create(size(), capacity_of);
+
+        for (size_type layer = 0; layer < size(); ++layer) {
+            auto links_begin = links(layer);
+
+            for (auto it = links_begin; it != links_begin + header(layer).size; ++it) {
+                ::new (static_cast<void *>(moved.links(layer) + moved.header(layer).size)) link_t(std::move(*it));
+                ++moved.header(layer).size;
+            }
+
+            *moved.incoming(layer) = std::move(*incoming(layer));
+        }
+
+        swap(moved);
+    }
+
+    void destroy() noexcept {
+        if (!m_block.data) {
+            return;
+        }
+
+        auto layers = size();
+        auto total = total_capacity();
+
+        for (size_type layer = 0; layer < layers; ++layer) {
+            clear_links(layer);
+            incoming(layer)->~incoming_links_t();
+        }
+
+        unit_allocator_t &allocator = m_block;
+        std::allocator_traits<unit_allocator_t>::deallocate(allocator, reinterpret_cast<unit_t *>(m_block.data), units(layers, total));
+        m_block.data = nullptr;
+    }
+
+    // The caller makes sure that there is room for the link.
+    void append_link(size_type layer, const link_t &link) {
+        auto &layer_header = header(layer);
+        ::new (static_cast<void *>(links(layer) + layer_header.size)) link_t(link);
+        ++layer_header.size;
+    }
+
+    void insert_link(size_type layer, size_type position, link_t &&link) {
+        auto &layer_header = header(layer);
+        auto first = links(layer);
+        auto last = first + layer_header.size;
+
+        if (position == layer_header.size) {
+            ::new (static_cast<void *>(last)) link_t(std::move(link));
+            ++layer_header.size;
+        } else {
+            ::new (static_cast<void *>(last)) link_t(std::move(*(last - 1)));
+            ++layer_header.size;
+            std::move_backward(first + position, last - 1, last);
+            first[position] = std::move(link);
+        }
+    }
+
+    void erase_link(size_type layer, size_type position) {
+        auto &layer_header = header(layer);
+        auto first = links(layer);
+        auto last = first + layer_header.size;
+
+        std::move(first + position + 1, last, first + position);
+        (last - 1)->~link_t();
+        --layer_header.size;
+    }
+
+    void clear_links(size_type layer) noexcept {
+        auto &layer_header = header(layer);
+        auto first = links(layer);
+
+        for (auto it = first; it != first + layer_header.size; ++it) {
+            it->~link_t();
+        }
+
+        layer_header.size = 0;
+    }
+
+private:
+    block_t m_block;
+};
+
+
+}
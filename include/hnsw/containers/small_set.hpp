@@ -17,6 +17,7 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <memory>
 #include <utility>
 #include <vector>
 
@@ -24,18 +25,29 @@
 namespace hnsw {
 
 
-template<class T>
+template<class T, class Allocator = std::allocator<T>>
 class small_set {
 public:
     using size_type = std::size_t;
     using value_type = T;
-    using container_type = std::vector<value_type>;
+    using allocator_type = Allocator;
+    using container_type = std::vector<value_type, allocator_type>;
     using iterator = typename container_type::iterator;
     using const_iterator = typename container_type::const_iterator;
     using reverse_iterator = typename container_type::reverse_iterator;
     using const_reverse_iterator = typename container_type::const_reverse_iterator;
 
 public:
+    small_set() = default;
+
+    explicit small_set(const allocator_type &allocator):
+        m_values(allocator)
+    { }
+
+    allocator_type get_allocator() const {
+        return m_values.get_allocator();
+    }
+
     const_iterator cbegin() const {
         return m_values.cbegin();
     }
@@ -157,6 +169,10 @@ public:
         m_values.reserve(capacity);
     }
 
+    void shrink_to_fit() {
+        m_values.shrink_to_fit();
+    }
+
 private:
     container_type m_values;
 };
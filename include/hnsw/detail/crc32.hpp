@@ -0,0 +1,55 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace hnsw { namespace detail {
+
+
+// CRC-32 (IEEE 802.3), as in zlib.
+inline std::uint32_t crc32(const void *data, std::size_t size, std::uint32_t crc = 0) {
+    static const auto table = []() {
+        std::array<std::uint32_t, 256> result;
+
+        for (std::uint32_t i = 0; i < 256; ++i) {
+            std::uint32_t c = i;
+
+            for (int bit = 0; bit < 8; ++bit) {
+                c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            }
+
+            result[i] = c;
+        }
+
+        return result;
+    }();
+
+    const auto *bytes = static_cast<const unsigned char *>(data);
+    crc = ~crc;
+
+    for (std::size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+
+}}
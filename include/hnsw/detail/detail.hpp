@@ -16,9 +16,14 @@
 #pragma once
 
 #include <algorithm>
+#include <cstdlib>
 #include <functional>
 #include <queue>
 
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
 
 namespace hnsw { namespace detail {
 
@@ -39,6 +44,14 @@ struct search_result_further_t {
 };
 
 
+// Return free heap memory to the OS. malloc keeps freed memory otherwise, so the process doesn't shrink.
+inline void release_free_memory() {
+#if defined(__GLIBC__)
+    ::malloc_trim(0);
+#endif
+}
+
+
 template<class Base>
 class priority_queue : public Base {
 public:
@@ -0,0 +1,77 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace hnsw { namespace detail {
+
+
+/* Layout of a frozen index. All offsets are in bytes from the beginning of the image,
+ * all sections are aligned to frozen_alignment.
+ *
+ * Nodes have dense ids from 0 to nodes - 1 and are ordered by the number of layers descending,
+ * so nodes present on the layer l are exactly [0, layer.nodes), and the entry point is 0.
+ *
+ *   header
+ *   tuned ef: tuned_ef_number pairs of uint64_t (nearest neighbors, ef)
+ *   keys: key_t[nodes]
+ *   layers: frozen_layer_t[layers]
+ *   for each layer: links offsets uint64_t[layer.nodes + 1], links uint32_t[offsets[layer.nodes]]
+ *   vectors: nodes rows of dimension elements, vector_stride bytes apart
+ */
+
+constexpr std::size_t frozen_alignment = 64;
+constexpr std::uint32_t frozen_version = 1;
+
+
+struct frozen_header_t {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint32_t key_size;
+    std::uint32_t element_size;
+    std::uint64_t nodes;
+    std::uint64_t layers;
+    std::uint64_t dimension;
+    std::uint64_t max_links;
+    std::uint64_t search_termination;
+    std::uint64_t max_unproductive_hops;
+    std::uint64_t tuned_ef_number;
+    std::uint64_t tuned_ef_offset;
+    std::uint64_t keys_offset;
+    std::uint64_t layers_offset;
+    std::uint64_t vectors_offset;
+    std::uint64_t vector_stride;
+    std::uint64_t image_size;
+};
+
+
+struct frozen_layer_t {
+    std::uint64_t nodes;
+    std::uint64_t offsets_offset;
+    std::uint64_t links_offset;
+};
+
+
+inline std::uint64_t frozen_align(std::uint64_t offset) {
+    return (offset + frozen_alignment - 1) / frozen_alignment * frozen_alignment;
+}
+
+
+}}
@@ -0,0 +1,241 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "detail.hpp"
+
+#include "../containers/hopscotch-map-1.4.0/src/hopscotch_set.h"
+
+#include "undef_hopscotch_macros.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <queue>
+#include <utility>
+#include <vector>
+
+
+namespace hnsw { namespace detail {
+
+
+/* Search algorithms shared by all index representations.
+ * They work with a graph accessor, which must provide:
+ *   key_t, scalar_t - types of node keys and distances;
+ *   size_t size() const - number of nodes;
+ *   size_t max_links(size_t layer) const - maximum number of outgoing links of a node on the layer;
+ *   links(const key_t &node, size_t layer) const - range of outgoing links of the node,
+ *                                                  which supports begin(), end(), rbegin() and rend();
+ *   key_t link_key(const link &link) const - key of the node the link points to;
+ *   scalar_t distance(const Target &target, const key_t &node) const - distance from the target to the node;
+ *   void prefetch(const key_t &node) const - hint that the node's vector is going to be accessed soon.
+ */
+
+
+template<class Key, class Scalar>
+using closest_queue_t = std::priority_queue<
+    std::pair<Key, Scalar>,
+    std::vector<std::pair<Key, Scalar>>,
+    search_result_further_t
+>;
+
+
+template<class Key, class Scalar>
+using furthest_queue_t = std::priority_queue<
+    std::pair<Key, Scalar>,
+    std::vector<std::pair<Key, Scalar>>,
+    search_result_closer_t
+>;
+
+
+struct early_termination_t {
+    // How many best results are watched for improvement.
+    std::size_t watched_results;
+    // Stop after this many consecutive expansions didn't change the watched results (0 - never stop early).
+    std::size_t max_unproductive_hops;
+};
+
+
+template<class Graph, class Target, class Stats>
+void search_level(const Graph &graph,
+                  const Target &target,
+                  std::size_t results_number,
+                  std::size_t layer,
+                  const std::vector<typename Graph::key_t> &start_from,
+                  furthest_queue_t<typename Graph::key_t, typename Graph::scalar_t> &results,
+                  Stats &stats,
+                  early_termination_t termination = {0, 0})
+{
+    using key_t = typename Graph::key_t;
+    using scalar_t = typename Graph::scalar_t;
+
+    tsl::hopscotch_set<key_t> visited_nodes;
+    visited_nodes.reserve(5 * graph.max_links(layer) * results_number);
+    visited_nodes.insert(start_from.begin(), start_from.end());
+
+    priority_queue<closest_queue_t<key_t, scalar_t>> search_front;
+
+    // The best watched_results seen so far. Only maintained when early termination is enabled.
+    furthest_queue_t<key_t, scalar_t> watched;
+    std::size_t unproductive_hops = 0;
+
+    for (const auto &key: start_from) {
+        auto d = graph.distance(target, key);
+        stats.on_distance();
+        results.push({key, d});
+        search_front.push({key, d});
+
+        if (termination.max_unproductive_hops > 0) {
+            watched.push({key, d});
+        }
+    }
+
+    while (results.size() > results_number) {
+        results.pop();
+    }
+
+    while (watched.size() > termination.watched_results) {
+        watched.pop();
+    }
+
+    for (std::size_t hop = 0; !search_front.empty() && search_front.top().second <= results.top().second && hop < graph.size(); ++hop) {
+        if (termination.max_unproductive_hops > 0 && unproductive_hops >= termination.max_unproductive_hops) {
+            break;
+        }
+
+        const auto &links = graph.links(search_front.top().first, layer);
+        search_front.pop();
+        ++unproductive_hops;
+        stats.on_hop(layer);
+
+        for (auto it = links.rbegin(); it != links.rend(); ++it) {
+            if (visited_nodes.count(graph.link_key(*it)) == 0) {
+                graph.prefetch(graph.link_key(*it));
+            }
+        }
+
+        for (const auto &link: links) {
+            auto link_key = graph.link_key(link);
+
+            if (visited_nodes.insert(link_key).second) {
+                auto d = graph.distance(target, link_key);
+                stats.on_distance();
+
+                if (results.size() < results_number) {
+                    results.push({link_key, d});
+                    search_front.push({link_key, d});
+                } else if (d < results.top().second) {
+                    results.pop();
+                    results.push({link_key, d});
+                    search_front.push({link_key, d});
+                } else {
+                    continue;
+                }
+
+                if (termination.max_unproductive_hops > 0) {
+                    if (watched.size() < termination.watched_results) {
+                        watched.push({link_key, d});
+                        unproductive_hops = 0;
+                    } else if (d < watched.top().second) {
+                        watched.pop();
+                        watched.push({link_key, d});
+                        unproductive_hops = 0;
+                    }
+                }
+            }
+        }
+
+        stats.on_search_front(search_front.size());
+
+        // Try to make search_front smaller, so to speed up operations on it.
+        while (!search_front.empty() && search_front.c.back().second > results.top().second) {
+            search_front.c.pop_back();
+        }
+    }
+
+    stats.on_visited(visited_nodes.size());
+}
+
+
+template<class Graph, class Target, class Stats>
+typename Graph::key_t greedy_search(const Graph &graph,
+                                    const Target &target,
+                                    std::size_t layer,
+                                    const typename Graph::key_t &start_from,
+                                    Stats &stats)
+{
+    using key_t = typename Graph::key_t;
+    using scalar_t = typename Graph::scalar_t;
+
+    key_t result = start_from;
+    scalar_t result_distance = graph.distance(target, start_from);
+    stats.on_distance();
+
+    // Just a reasonable upper limit on the number of hops to avoid infinite loops.
+    for (std::size_t hops = 0; hops < graph.size(); ++hops) {
+        const auto &links = graph.links(result, layer);
+        bool made_hop = false;
+        stats.on_hop(layer);
+
+        for (auto it = links.begin(); it != links.end(); ++it) {
+            if (it + 1 != links.end()) {
+                graph.prefetch(graph.link_key(*(it + 1)));
+            }
+
+            scalar_t neighbor_distance = graph.distance(target, graph.link_key(*it));
+            stats.on_distance();
+
+            if (neighbor_distance < result_distance) {
+                result = graph.link_key(*it);
+                result_distance = neighbor_distance;
+                made_hop = true;
+            }
+        }
+
+        if (!made_hop) {
+            break;
+        }
+    }
+
+    return result;
+}
+
+
+// Sorts the results and returns the first nearest_neighbors of them.
+template<class SearchResult, class Results>
+std::vector<SearchResult> take_nearest(Results &results, std::size_t nearest_neighbors) {
+    std::size_t results_to_return = std::min(results.size(), nearest_neighbors);
+
+    std::partial_sort(
+        results.c.begin(),
+        results.c.begin() + results_to_return,
+        results.c.end(),
+        [](const auto &l, const auto &r) {
+            return l.second < r.second;
+        }
+    );
+
+    std::vector<SearchResult> results_vector;
+    results_vector.reserve(results_to_return);
+
+    for (std::size_t i = 0; i < results_to_return; ++i) {
+        results_vector.push_back({results.c[i].first, results.c[i].second});
+    }
+
+    return results_vector;
+}
+
+
+}}
@@ -0,0 +1,193 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "../half_float.hpp"
+
+#include <cstddef>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+
+namespace hnsw { namespace detail {
+
+
+// Kernels for vectors of float16_t and bfloat16_t, against float queries or each other.
+// Values are converted to float and accumulated in float.
+
+template<class One, class Another>
+float l2sqr_dist_half_scalar(const One *one, const Another *another, std::size_t size) {
+    float sum = 0;
+
+    for (std::size_t i = 0; i < size; ++i) {
+        float diff = float(one[i]) - float(another[i]);
+        sum += diff * diff;
+    }
+
+    return sum;
+}
+
+
+template<class One, class Another>
+float dot_product_half_scalar(const One *one, const Another *another, std::size_t size) {
+    float sum = 0;
+
+    for (std::size_t i = 0; i < size; ++i) {
+        sum += float(one[i]) * float(another[i]);
+    }
+
+    return sum;
+}
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__AVX2__) && defined(__F16C__)
+
+// Load 8 values as floats.
+inline __m256 half_load8(const float *values) {
+    return _mm256_loadu_ps(values);
+}
+
+
+inline __m256 half_load8(const float16_t *values) {
+    return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(values)));
+}
+
+
+// bfloat16 is the upper half of a float.
+inline __m256 half_load8(const bfloat16_t *values) {
+    __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(values)));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16));
+}
+
+
+inline float half_sum8(__m256 sum) {
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+    half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+    return _mm_cvtss_f32(half);
+}
+
+
+template<class One, class Another>
+float l2sqr_dist_half(const One *one, const Another *another, std::size_t size) {
+    __m256 sum = _mm256_setzero_ps();
+    std::size_t i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        __m256 diff = _mm256_sub_ps(half_load8(one + i), half_load8(another + i));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(diff, diff));
+    }
+
+    return half_sum8(sum) + l2sqr_dist_half_scalar(one + i, another + i, size - i);
+}
+
+
+template<class One, class Another>
+float dot_product_half(const One *one, const Another *another, std::size_t size) {
+    __m256 sum = _mm256_setzero_ps();
+    std::size_t i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(half_load8(one + i), half_load8(another + i)));
+    }
+
+    return half_sum8(sum) + dot_product_half_scalar(one + i, another + i, size - i);
+}
+
+#else
+
+template<class One, class Another>
+float l2sqr_dist_half(const One *one, const Another *another, std::size_t size) {
+    return l2sqr_dist_half_scalar(one, another, size);
+}
+
+
+template<class One, class Another>
+float dot_product_half(const One *one, const Another *another, std::size_t size) {
+    return dot_product_half_scalar(one, another, size);
+}
+
+#endif
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__AVX512BF16__) && defined(__AVX512F__)
+
+// Multiplies pairs of bfloat16 and accumulates them in float in one instruction.
+inline float dot_product_bfloat_avx512(const bfloat16_t *one, const bfloat16_t *another, std::size_t size) {
+    __m512 sum = _mm512_setzero_ps();
+    std::size_t i = 0;
+
+    for (; i + 32 <= size; i += 32) {
+        __m512i one_values = _mm512_loadu_si512(one + i);
+        __m512i another_values = _mm512_loadu_si512(another + i);
+        sum = _mm512_dpbf16_ps(sum, reinterpret_cast<__m512bh &>(one_values), reinterpret_cast<__m512bh &>(another_values));
+    }
+
+    return _mm512_reduce_add_ps(sum) + dot_product_half(one + i, another + i, size - i);
+}
+
+#else
+
+inline float dot_product_bfloat_avx512(const bfloat16_t *one, const bfloat16_t *another, std::size_t size) {
+    return dot_product_half(one, another, size);
+}
+
+#endif
+
+
+inline float l2sqr_dist(const float *one, const float16_t *another, std::size_t size) {
+    return l2sqr_dist_half(one, another, size);
+}
+
+
+inline float l2sqr_dist(const float16_t *one, const float16_t *another, std::size_t size) {
+    return l2sqr_dist_half(one, another, size);
+}
+
+
+inline float l2sqr_dist(const float *one, const bfloat16_t *another, std::size_t size) {
+    return l2sqr_dist_half(one, another, size);
+}
+
+
+inline float l2sqr_dist(const bfloat16_t *one, const bfloat16_t *another, std::size_t size) {
+    return l2sqr_dist_half(one, another, size);
+}
+
+
+inline float dot_product(const float *one, const float16_t *another, std::size_t size) {
+    return dot_product_half(one, another, size);
+}
+
+
+inline float dot_product(const float16_t *one, const float16_t *another, std::size_t size) {
+    return dot_product_half(one, another, size);
+}
+
+
+inline float dot_product(const float *one, const bfloat16_t *another, std::size_t size) {
+    return dot_product_half(one, another, size);
+}
+
+
+inline float dot_product(const bfloat16_t *one, const bfloat16_t *another, std::size_t size) {
+    return dot_product_bfloat_avx512(one, another, size);
+}
+
+
+}}
@@ -0,0 +1,76 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+
+namespace hnsw { namespace detail {
+
+
+// Compiles to POPCNT when it's enabled (-mpopcnt or -march supporting it).
+inline std::uint64_t popcount(std::uint64_t value) {
+#if defined(__GNUC__)
+    return std::uint64_t(__builtin_popcountll(value));
+#else
+    value = value - ((value >> 1) & 0x5555555555555555ull);
+    value = (value & 0x3333333333333333ull) + ((value >> 2) & 0x3333333333333333ull);
+    value = (value + (value >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return (value * 0x0101010101010101ull) >> 56;
+#endif
+}
+
+
+inline std::uint32_t hamming_distance_scalar(const std::uint64_t *one, const std::uint64_t *another, std::size_t size) {
+    std::uint64_t sum = 0;
+
+    for (std::size_t i = 0; i < size; ++i) {
+        sum += popcount(one[i] ^ another[i]);
+    }
+
+    return std::uint32_t(sum);
+}
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__)
+
+inline std::uint32_t hamming_distance(const std::uint64_t *one, const std::uint64_t *another, std::size_t size) {
+    __m512i sum = _mm512_setzero_si512();
+    std::size_t i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        __m512i difference = _mm512_xor_si512(_mm512_loadu_si512(one + i), _mm512_loadu_si512(another + i));
+        sum = _mm512_add_epi64(sum, _mm512_popcnt_epi64(difference));
+    }
+
+    return std::uint32_t(_mm512_reduce_add_epi64(sum)) + hamming_distance_scalar(one + i, another + i, size - i);
+}
+
+#else
+
+inline std::uint32_t hamming_distance(const std::uint64_t *one, const std::uint64_t *another, std::size_t size) {
+    return hamming_distance_scalar(one, another, size);
+}
+
+#endif
+
+
+}}
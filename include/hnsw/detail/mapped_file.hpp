@@ -0,0 +1,144 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace hnsw { namespace detail {
+
+
+inline std::runtime_error system_error(const std::string &what) {
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+
+// Read-only memory mapping of a whole file. Pages are loaded by the kernel on first access.
+class mapped_file_t {
+public:
+    mapped_file_t() = default;
+
+    explicit mapped_file_t(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0) {
+            throw system_error("mapped_file_t: failed to open " + path);
+        }
+
+        map(fd, path);
+    }
+
+    // Map a POSIX shared memory object created with shm_open(). Name starts with a slash.
+    static mapped_file_t shared(const std::string &name) {
+        int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+
+        if (fd < 0) {
+            throw system_error("mapped_file_t: failed to open shared memory " + name);
+        }
+
+        mapped_file_t result;
+        result.map(fd, name);
+        return result;
+    }
+
+    ~mapped_file_t() {
+        reset();
+    }
+
+    mapped_file_t(const mapped_file_t &) = delete;
+    mapped_file_t &operator=(const mapped_file_t &) = delete;
+
+    mapped_file_t(mapped_file_t &&other) noexcept:
+        m_data(other.m_data),
+        m_size(other.m_size)
+    {
+        other.m_data = nullptr;
+        other.m_size = 0;
+    }
+
+    mapped_file_t &operator=(mapped_file_t &&other) noexcept {
+        if (this != &other) {
+            reset();
+            std::swap(m_data, other.m_data);
+            std::swap(m_size, other.m_size);
+        }
+
+        return *this;
+    }
+
+    const char *data() const {
+        return m_data;
+    }
+
+    std::size_t size() const {
+        return m_size;
+    }
+
+private:
+    // Takes ownership of the descriptor.
+    void map(int fd, const std::string &path) {
+        struct stat file_stat;
+
+        if (::fstat(fd, &file_stat) != 0) {
+            auto error = system_error("mapped_file_t: failed to stat " + path);
+            ::close(fd);
+            throw error;
+        }
+
+        m_size = std::size_t(file_stat.st_size);
+
+        if (m_size > 0) {
+            void *data = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+
+            if (data == MAP_FAILED) {
+                auto error = system_error("mapped_file_t: failed to map " + path);
+                ::close(fd);
+                m_size = 0;
+                throw error;
+            }
+
+            m_data = static_cast<const char *>(data);
+        }
+
+        // The mapping stays valid after the descriptor is closed.
+        ::close(fd);
+    }
+
+    void reset() {
+        if (m_data) {
+            ::munmap(const_cast<char *>(m_data), m_size);
+            m_data = nullptr;
+            m_size = 0;
+        }
+    }
+
+private:
+    const char *m_data = nullptr;
+    std::size_t m_size = 0;
+};
+
+
+}}
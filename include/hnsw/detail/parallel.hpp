@@ -0,0 +1,93 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+
+namespace hnsw { namespace detail {
+
+
+// Number of threads to use when the user passes 0.
+inline std::size_t default_threads() {
+    return std::max<std::size_t>(1, std::thread::hardware_concurrency());
+}
+
+
+// Call function(i) for each i in [0, size) from up to `threads` threads.
+// The first exception thrown by the function is rethrown after all threads are done.
+template<class Function>
+void parallel_for(std::size_t size, std::size_t threads, Function &&function) {
+    threads = std::min(threads, size);
+
+    if (threads <= 1) {
+        for (std::size_t i = 0; i < size; ++i) {
+            function(i);
+        }
+
+        return;
+    }
+
+    std::atomic<std::size_t> next(0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto worker = [&]() {
+        try {
+            for (auto i = next++; i < size; i = next++) {
+                function(i);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+
+            if (!error) {
+                error = std::current_exception();
+            }
+
+            next = size;
+        }
+    };
+
+    std::vector<std::thread> workers;
+
+    // If the system is out of threads, the work is done by the ones already started.
+    try {
+        for (std::size_t i = 1; i < threads; ++i) {
+            workers.emplace_back(worker);
+        }
+    } catch (const std::system_error &) {
+    }
+
+    worker();
+
+    for (auto &thread: workers) {
+        thread.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+
+}}
@@ -0,0 +1,170 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+
+namespace hnsw { namespace detail {
+
+
+// Weighted squared L2 distance between a query in code space and a code vector: sum of weights[i] * (query[i] - codes[i])^2.
+inline float sq8_l2_asymmetric_scalar(const float *query, const float *weights, const std::uint8_t *codes, std::size_t size) {
+    float sum = 0;
+
+    for (std::size_t i = 0; i < size; ++i) {
+        float diff = query[i] - float(codes[i]);
+        sum += weights[i] * diff * diff;
+    }
+
+    return sum;
+}
+
+
+// The same between two code vectors.
+inline float sq8_l2_symmetric_scalar(const float *weights, const std::uint8_t *one, const std::uint8_t *another, std::size_t size) {
+    float sum = 0;
+
+    for (std::size_t i = 0; i < size; ++i) {
+        float diff = float(int(one[i]) - int(another[i]));
+        sum += weights[i] * diff * diff;
+    }
+
+    return sum;
+}
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__AVX2__)
+
+// Converts 8 codes to floats.
+inline __m256 sq8_load_avx2(const std::uint8_t *codes) {
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(codes))));
+}
+
+
+inline float sq8_sum_avx2(__m256 sum, float tail) {
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+    half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+    return _mm_cvtss_f32(half) + tail;
+}
+
+
+inline float sq8_l2_asymmetric(const float *query, const float *weights, const std::uint8_t *codes, std::size_t size) {
+    __m256 sum = _mm256_setzero_ps();
+    std::size_t i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(query + i), sq8_load_avx2(codes + i));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(weights + i), _mm256_mul_ps(diff, diff)));
+    }
+
+    return sq8_sum_avx2(sum, sq8_l2_asymmetric_scalar(query + i, weights + i, codes + i, size - i));
+}
+
+
+inline float sq8_l2_symmetric(const float *weights, const std::uint8_t *one, const std::uint8_t *another, std::size_t size) {
+    __m256 sum = _mm256_setzero_ps();
+    std::size_t i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        __m256 diff = _mm256_sub_ps(sq8_load_avx2(one + i), sq8_load_avx2(another + i));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(weights + i), _mm256_mul_ps(diff, diff)));
+    }
+
+    return sq8_sum_avx2(sum, sq8_l2_symmetric_scalar(weights + i, one + i, another + i, size - i));
+}
+
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+
+// Converts 16 codes to 4 vectors of floats.
+inline void sq8_load_sse2(const std::uint8_t *codes, __m128 (&result)[4]) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(codes));
+    __m128i low = _mm_unpacklo_epi8(bytes, zero);
+    __m128i high = _mm_unpackhi_epi8(bytes, zero);
+
+    result[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero));
+    result[1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero));
+    result[2] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero));
+    result[3] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero));
+}
+
+
+inline float sq8_sum_sse2(__m128 sum, float tail) {
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum) + tail;
+}
+
+
+inline float sq8_l2_asymmetric(const float *query, const float *weights, const std::uint8_t *codes, std::size_t size) {
+    __m128 sum = _mm_setzero_ps();
+    __m128 values[4];
+    std::size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        sq8_load_sse2(codes + i, values);
+
+        for (std::size_t j = 0; j < 4; ++j) {
+            __m128 diff = _mm_sub_ps(_mm_loadu_ps(query + i + 4 * j), values[j]);
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(weights + i + 4 * j), _mm_mul_ps(diff, diff)));
+        }
+    }
+
+    return sq8_sum_sse2(sum, sq8_l2_asymmetric_scalar(query + i, weights + i, codes + i, size - i));
+}
+
+
+inline float sq8_l2_symmetric(const float *weights, const std::uint8_t *one, const std::uint8_t *another, std::size_t size) {
+    __m128 sum = _mm_setzero_ps();
+    __m128 one_values[4];
+    __m128 another_values[4];
+    std::size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        sq8_load_sse2(one + i, one_values);
+        sq8_load_sse2(another + i, another_values);
+
+        for (std::size_t j = 0; j < 4; ++j) {
+            __m128 diff = _mm_sub_ps(one_values[j], another_values[j]);
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(weights + i + 4 * j), _mm_mul_ps(diff, diff)));
+        }
+    }
+
+    return sq8_sum_sse2(sum, sq8_l2_symmetric_scalar(weights + i, one + i, another + i, size - i));
+}
+
+#else
+
+inline float sq8_l2_asymmetric(const float *query, const float *weights, const std::uint8_t *codes, std::size_t size) {
+    return sq8_l2_asymmetric_scalar(query, weights, codes, size);
+}
+
+
+inline float sq8_l2_symmetric(const float *weights, const std::uint8_t *one, const std::uint8_t *another, std::size_t size) {
+    return sq8_l2_symmetric_scalar(weights, one, another, size);
+}
+
+#endif
+
+
+}}
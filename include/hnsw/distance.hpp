@@ -17,19 +17,23 @@
 
 #include "detail/cosine.hpp"
 #include "detail/dot_product.hpp"
+#include "detail/half_dist.hpp"
+#include "detail/hamming.hpp"
 #include "detail/l2_dist.hpp"
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <stdexcept>
 
 
 namespace hnsw {
 
 
+// Vectors may have different types with a kernel for them, e.g. a float query and a vector of float16_t.
 struct l2_square_distance_t {
-    template<class Vector>
-    auto operator()(const Vector &one, const Vector &another) const {
+    template<class One, class Another>
+    auto operator()(const One &one, const Another &another) const {
         if (one.size() != another.size()) {
             throw std::runtime_error("l2_square_distance_t: vectors sizes do not match");
         }
@@ -57,13 +61,13 @@ struct cosine_distance_t {
 
 // Normalize your vectors before putting them in the index or searching, when using this distance.
 struct dot_product_distance_t {
-    template<class Vector>
-    auto operator()(const Vector &one, const Vector &another) const {
+    template<class One, class Another>
+    auto operator()(const One &one, const Another &another) const {
         if (one.size() != another.size()) {
             throw std::runtime_error("dot_product_distance_t: vectors sizes do not match");
         }
 
-        using result_type = decltype(*one.data());
+        using result_type = decltype(detail::dot_product(one.data(), another.data(), one.size()));
 
         result_type product = detail::dot_product(one.data(), another.data(), one.size());
 
@@ -72,4 +76,17 @@ struct dot_product_distance_t {
 };
 
 
+// Number of different bits between vectors of std::uint64_t, e.g. codes of binary_quantizer_t.
+struct hamming_distance_t {
+    template<class Vector>
+    std::uint32_t operator()(const Vector &one, const Vector &another) const {
+        if (one.size() != another.size()) {
+            throw std::runtime_error("hamming_distance_t: vectors sizes do not match");
+        }
+
+        return detail::hamming_distance(one.data(), another.data(), one.size());
+    }
+};
+
+
 }
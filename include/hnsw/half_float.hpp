@@ -0,0 +1,173 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "prefetch.hpp"
+#include "vector_view.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+namespace hnsw {
+
+
+namespace detail {
+
+
+inline std::uint32_t float_bits(float value) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+
+inline float bits_float(std::uint32_t bits) {
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+
+// IEEE binary16 with rounding to nearest even.
+inline std::uint16_t float_to_half_bits(float value) {
+    std::uint32_t bits = float_bits(value);
+    std::uint32_t sign = (bits >> 16) & 0x8000;
+    std::uint32_t magnitude = bits & 0x7fffffff;
+
+    // Infinity and NaN, which stays NaN.
+    if (magnitude >= 0x7f800000) {
+        return std::uint16_t(sign | 0x7c00 | ((magnitude > 0x7f800000) ? 0x200 : 0));
+    }
+
+    // Values from 65520 up round to infinity.
+    if (magnitude >= 0x477ff000) {
+        return std::uint16_t(sign | 0x7c00);
+    }
+
+    // Subnormal halves are multiples of 2^-24.
+    if (magnitude < 0x38800000) {
+        return std::uint16_t(sign | std::uint32_t(std::nearbyint(bits_float(magnitude) * 16777216.0f)));
+    }
+
+    magnitude += 0xfff + ((magnitude >> 13) & 1);
+    magnitude -= 112u << 23;
+    return std::uint16_t(sign | (magnitude >> 13));
+}
+
+
+inline float half_bits_to_float(std::uint16_t half) {
+    std::uint32_t sign = std::uint32_t(half & 0x8000) << 16;
+    std::uint32_t exponent = (half >> 10) & 0x1f;
+    std::uint32_t mantissa = half & 0x3ff;
+
+    if (exponent == 0) {
+        float value = float(mantissa) / 16777216.0f;
+        return sign ? -value : value;
+    }
+
+    if (exponent == 31) {
+        return bits_float(sign | 0x7f800000 | (mantissa << 13));
+    }
+
+    return bits_float(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+
+// Upper half of binary32 with rounding to nearest even.
+inline std::uint16_t float_to_bfloat_bits(float value) {
+    std::uint32_t bits = float_bits(value);
+
+    if ((bits & 0x7fffffff) > 0x7f800000) {
+        return std::uint16_t((bits >> 16) | 0x40);
+    }
+
+    bits += 0x7fff + ((bits >> 16) & 1);
+    return std::uint16_t(bits >> 16);
+}
+
+
+inline float bfloat_bits_to_float(std::uint16_t bfloat) {
+    return bits_float(std::uint32_t(bfloat) << 16);
+}
+
+
+}
+
+
+/** Storage-only half precision floats for vectors in the index.
+ *
+ *  float16_t has more precision, bfloat16_t has the range of float.
+ *  Distances convert them to float, and queries are std::vector<float>: search(std::vector<float>, ...) works on
+ *  hnsw_index<Key, std::vector<float16_t>, l2_square_distance_t>. Vectors take half the memory of floats.
+ */
+struct float16_t {
+    std::uint16_t bits;
+
+    float16_t() = default;
+
+    explicit float16_t(float value):
+        bits(detail::float_to_half_bits(value))
+    { }
+
+    explicit operator float() const {
+        return detail::half_bits_to_float(bits);
+    }
+};
+
+
+struct bfloat16_t {
+    std::uint16_t bits;
+
+    bfloat16_t() = default;
+
+    explicit bfloat16_t(float value):
+        bits(detail::float_to_bfloat_bits(value))
+    { }
+
+    explicit operator float() const {
+        return detail::bfloat_bits_to_float(bits);
+    }
+};
+
+
+// Convert a float vector for insertion into an index of half precision vectors.
+template<class Half>
+std::vector<Half> to_half_vector(vector_view<float> vector) {
+    return std::vector<Half>(vector.begin(), vector.end());
+}
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+template<>
+struct prefetch<std::vector<float16_t>, void> {
+    static void pref(const std::vector<float16_t> &v) {
+        _mm_prefetch(reinterpret_cast<const char *>(v.data()), _MM_HINT_T0);
+    }
+};
+
+template<>
+struct prefetch<std::vector<bfloat16_t>, void> {
+    static void pref(const std::vector<bfloat16_t> &v) {
+        _mm_prefetch(reinterpret_cast<const char *>(v.data()), _MM_HINT_T0);
+    }
+};
+#endif
+
+
+}
@@ -0,0 +1,500 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "detail/mapped_file.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+namespace hnsw {
+
+
+// Size of transparent huge pages, and of hugetlb pages unless the system or huge_page_options_t::page_size says otherwise.
+constexpr std::size_t huge_page_size = std::size_t(2) << 20;
+
+
+enum class huge_page_mode_t {
+    // Regular pages.
+    none,
+    // Transparent huge pages. The kernel backs the memory with huge pages when it finds free contiguous memory,
+    // so some of them may stay regular. AnonHugePages in /proc/self/smaps shows how many are huge.
+    transparent,
+    // Pages from the pool reserved with vm.nr_hugepages. They are reserved when memory is allocated.
+    hugetlb
+};
+
+
+inline const char *to_string(huge_page_mode_t mode) {
+    switch (mode) {
+        case huge_page_mode_t::transparent:
+            return "transparent";
+        case huge_page_mode_t::hugetlb:
+            return "hugetlb";
+        default:
+            return "none";
+    }
+}
+
+
+struct huge_page_options_t {
+    // Try the reserved pool first.
+    bool hugetlb = true;
+    // Fall back to transparent huge pages.
+    bool transparent = true;
+    // Fault all pages in right away, so that first accesses under load don't.
+    bool prefault = false;
+    // Lock the pages in memory, so they are never swapped out. Needs a large enough RLIMIT_MEMLOCK or CAP_IPC_LOCK.
+    bool lock = false;
+    // Size of hugetlb pages, one of /sys/kernel/mm/hugepages. Zero means the default size, Hugepagesize in /proc/meminfo.
+    std::size_t page_size = 0;
+};
+
+
+inline bool operator==(const huge_page_options_t &l, const huge_page_options_t &r) {
+    return l.hugetlb == r.hugetlb &&
+           l.transparent == r.transparent &&
+           l.prefault == r.prefault &&
+           l.lock == r.lock &&
+           l.page_size == r.page_size;
+}
+
+
+inline bool operator!=(const huge_page_options_t &l, const huge_page_options_t &r) {
+    return !(l == r);
+}
+
+
+namespace detail {
+
+
+enum class transparent_huge_pages_t {
+    never,
+    madvise,
+    always
+};
+
+
+// Size of hugetlb pages which mmap(MAP_HUGETLB) gives without a size flag.
+inline std::size_t default_hugetlb_page_size() {
+    static const std::size_t size = []() {
+        std::ifstream input("/proc/meminfo");
+        std::string line;
+
+        while (std::getline(input, line)) {
+            if (line.compare(0, 13, "Hugepagesize:") == 0) {
+                auto kilobytes = std::strtoull(line.c_str() + 13, nullptr, 10);
+
+                if (kilobytes > 0 && (kilobytes & (kilobytes - 1)) == 0) {
+                    return std::size_t(kilobytes) * 1024;
+                }
+            }
+        }
+
+        return huge_page_size;
+    }();
+
+    return size;
+}
+
+
+inline std::size_t round_up_to(std::size_t size, std::size_t page_size) {
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+
+// The system-wide setting, which decides whether madvise(MADV_HUGEPAGE) has any effect.
+inline transparent_huge_pages_t transparent_huge_pages() {
+    static const transparent_huge_pages_t setting = []() {
+        std::ifstream input("/sys/kernel/mm/transparent_hugepage/enabled");
+        std::string value;
+        std::getline(input, value);
+
+        if (value.find("[always]") != std::string::npos) {
+            return transparent_huge_pages_t::always;
+        } else if (value.find("[madvise]") != std::string::npos) {
+            return transparent_huge_pages_t::madvise;
+        } else {
+            return transparent_huge_pages_t::never;
+        }
+    }();
+
+    return setting;
+}
+
+
+}
+
+
+/** Anonymous memory backed by huge pages where possible, which cuts TLB misses on large randomly accessed arrays.
+ *
+ *  The size is rounded up to a multiple of the hugetlb page size with hugetlb pages and of huge_page_size otherwise,
+ *  and the memory is zero-filled.
+ *  With hugetlb pages a process forked by start_checkpoint() needs free pages in the pool for those the parent modifies.
+ */
+class huge_page_region_t {
+public:
+    huge_page_region_t() = default;
+
+    explicit huge_page_region_t(std::size_t size, const huge_page_options_t &options = huge_page_options_t()) {
+        if (size == 0) {
+            return;
+        }
+
+        if (options.page_size != 0 && (options.page_size & (options.page_size - 1)) != 0) {
+            throw std::runtime_error("huge_page_region_t: the size of huge pages must be a power of two");
+        }
+
+        auto page_size = (options.page_size == 0) ? detail::default_hugetlb_page_size() : options.page_size;
+
+        if (size > std::numeric_limits<std::size_t>::max() - 2 * page_size) {
+            throw std::runtime_error("huge_page_region_t: the size is too large");
+        }
+
+        map(size, page_size, options);
+
+        try {
+            if (options.lock) {
+                lock();
+            } else if (options.prefault) {
+                prefault();
+            }
+        } catch (...) {
+            reset();
+            throw;
+        }
+    }
+
+    ~huge_page_region_t() {
+        reset();
+    }
+
+    huge_page_region_t(const huge_page_region_t &) = delete;
+    huge_page_region_t &operator=(const huge_page_region_t &) = delete;
+
+    huge_page_region_t(huge_page_region_t &&other) noexcept:
+        m_data(other.m_data),
+        m_size(other.m_size),
+        m_mode(other.m_mode)
+    {
+        other.m_data = nullptr;
+        other.m_size = 0;
+        other.m_mode = huge_page_mode_t::none;
+    }
+
+    huge_page_region_t &operator=(huge_page_region_t &&other) noexcept {
+        if (this != &other) {
+            reset();
+            std::swap(m_data, other.m_data);
+            std::swap(m_size, other.m_size);
+            std::swap(m_mode, other.m_mode);
+        }
+
+        return *this;
+    }
+
+    char *data() const {
+        return m_data;
+    }
+
+    std::size_t size() const {
+        return m_size;
+    }
+
+    huge_page_mode_t mode() const {
+        return m_mode;
+    }
+
+    // Touch every page, keeping the contents.
+    void prefault() {
+        auto page = std::size_t(::sysconf(_SC_PAGESIZE));
+        volatile char *data = m_data;
+
+        for (std::size_t offset = 0; offset < m_size; offset += page) {
+            data[offset] = data[offset];
+        }
+    }
+
+    // Fault all pages in and lock them in memory.
+    void lock() {
+        if (m_data && ::mlock(m_data, m_size) != 0) {
+            throw detail::system_error("huge_page_region_t::lock: failed to lock memory");
+        }
+    }
+
+    // Release the memory and the ownership of it.
+    std::pair<char *, std::size_t> release() {
+        std::pair<char *, std::size_t> result(m_data, m_size);
+        m_data = nullptr;
+        m_size = 0;
+        m_mode = huge_page_mode_t::none;
+        return result;
+    }
+
+private:
+    void map(std::size_t size, std::size_t page_size, const huge_page_options_t &options) {
+#if defined(MAP_HUGETLB)
+        if (options.hugetlb) {
+            int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+
+#if defined(MAP_HUGE_SHIFT)
+            // The size is encoded as its log2.
+            if (options.page_size != 0) {
+                int shift = 0;
+
+                while ((std::size_t(1) << shift) < page_size) {
+                    ++shift;
+                }
+
+                flags |= shift << MAP_HUGE_SHIFT;
+            }
+#endif
+
+            auto hugetlb_size = detail::round_up_to(size, page_size);
+            void *data = ::mmap(nullptr, hugetlb_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+            if (data != MAP_FAILED) {
+                m_data = static_cast<char *>(data);
+                m_size = hugetlb_size;
+                m_mode = huge_page_mode_t::hugetlb;
+                return;
+            }
+        }
+#endif
+
+        m_size = detail::round_up_to(size, huge_page_size);
+
+        // Transparent huge pages back only aligned parts of a mapping, so map more and cut the ends off.
+        auto mapped_size = m_size + huge_page_size;
+        void *data = ::mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (data == MAP_FAILED) {
+            m_size = 0;
+            throw detail::system_error("huge_page_region_t: failed to allocate memory");
+        }
+
+        auto begin = reinterpret_cast<std::uintptr_t>(data);
+        auto aligned = (begin + huge_page_size - 1) / huge_page_size * huge_page_size;
+
+        if (aligned > begin) {
+            ::munmap(data, aligned - begin);
+        }
+
+        if (begin + mapped_size > aligned + m_size) {
+            ::munmap(reinterpret_cast<void *>(aligned + m_size), begin + mapped_size - aligned - m_size);
+        }
+
+        m_data = reinterpret_cast<char *>(aligned);
+
+        auto setting = detail::transparent_huge_pages();
+
+        if (setting == detail::transparent_huge_pages_t::always) {
+            m_mode = huge_page_mode_t::transparent;
+        }
+
+#if defined(MADV_HUGEPAGE)
+        if (options.transparent && setting == detail::transparent_huge_pages_t::madvise &&
+            ::madvise(m_data, m_size, MADV_HUGEPAGE) == 0)
+        {
+            m_mode = huge_page_mode_t::transparent;
+        }
+#endif
+    }
+
+    void reset() {
+        if (m_data) {
+            ::munmap(m_data, m_size);
+            m_data = nullptr;
+            m_size = 0;
+            m_mode = huge_page_mode_t::none;
+        }
+    }
+
+private:
+    char *m_data = nullptr;
+    std::size_t m_size = 0;
+    huge_page_mode_t m_mode = huge_page_mode_t::none;
+};
+
+
+// Bytes currently allocated by huge_page_allocator in each mode.
+struct huge_page_usage_t {
+    std::size_t none = 0;
+    std::size_t transparent = 0;
+    std::size_t hugetlb = 0;
+};
+
+
+namespace detail {
+
+
+// Regions allocated by huge_page_allocator. Only allocations of at least a huge page get here, so a lock is cheap.
+class huge_page_registry_t {
+public:
+    static huge_page_registry_t &instance() {
+        static huge_page_registry_t registry;
+        return registry;
+    }
+
+    void *allocate(std::size_t size, const huge_page_options_t &options) {
+        huge_page_region_t region(size, options);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_regions[region.data()] = {region.mode(), region.size()};
+        usage(region.mode()) += region.size();
+
+        return region.release().first;
+    }
+
+    // The size of the region depends on the pages it got, so it's taken from the registry.
+    void deallocate(void *data) {
+        std::size_t size = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_regions.find(data);
+
+            if (it == m_regions.end()) {
+                return;
+            }
+
+            size = it->second.second;
+            usage(it->second.first) -= size;
+            m_regions.erase(it);
+        }
+
+        ::munmap(data, size);
+    }
+
+    huge_page_usage_t usage() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_usage;
+    }
+
+private:
+    std::size_t &usage(huge_page_mode_t mode) {
+        switch (mode) {
+            case huge_page_mode_t::transparent:
+                return m_usage.transparent;
+            case huge_page_mode_t::hugetlb:
+                return m_usage.hugetlb;
+            default:
+                return m_usage.none;
+        }
+    }
+
+private:
+    std::mutex m_mutex;
+    // Mode and size of each region.
+    std::map<void *, std::pair<huge_page_mode_t, std::size_t>> m_regions;
+    huge_page_usage_t m_usage;
+};
+
+
+}
+
+
+inline huge_page_usage_t huge_page_usage() {
+    return detail::huge_page_registry_t::instance().usage();
+}
+
+
+/** Allocator which puts allocations of at least huge_page_size into huge_page_region_t memory with the given options.
+ *
+ *  Smaller allocations come from the regular heap, so containers of small objects don't waste a huge page each.
+ *  Use it for large arrays like the nodes table or a big vector of vectors. huge_page_usage() reports which mode took effect.
+ *  Pass it to the constructor of the index to choose the options, e.g. to prefault or lock the memory:
+ *
+ *      huge_page_options_t options;
+ *      options.lock = true;
+ *      hnsw_index<Key, Vector, Distance, std::minstd_rand, huge_page_allocator<char>> index {huge_page_allocator<char>(options)};
+ */
+template<class T>
+class huge_page_allocator {
+public:
+    using value_type = T;
+
+    huge_page_allocator() = default;
+
+    explicit huge_page_allocator(const huge_page_options_t &options):
+        m_options(options)
+    { }
+
+    template<class U>
+    huge_page_allocator(const huge_page_allocator<U> &other) noexcept:
+        m_options(other.options())
+    { }
+
+    const huge_page_options_t &options() const {
+        return m_options;
+    }
+
+    T *allocate(std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+            throw std::bad_alloc();
+        }
+
+        if (n * sizeof(T) < huge_page_size) {
+            return std::allocator<T>().allocate(n);
+        }
+
+        try {
+            return static_cast<T *>(detail::huge_page_registry_t::instance().allocate(n * sizeof(T), m_options));
+        } catch (const std::runtime_error &) {
+            throw std::bad_alloc();
+        }
+    }
+
+    void deallocate(T *data, std::size_t n) noexcept {
+        if (n * sizeof(T) < huge_page_size) {
+            std::allocator<T>().deallocate(data, n);
+        } else {
+            detail::huge_page_registry_t::instance().deallocate(data);
+        }
+    }
+
+private:
+    huge_page_options_t m_options;
+};
+
+
+template<class T, class U>
+bool operator==(const huge_page_allocator<T> &l, const huge_page_allocator<U> &r) {
+    return l.options() == r.options();
+}
+
+
+template<class T, class U>
+bool operator!=(const huge_page_allocator<T> &l, const huge_page_allocator<U> &r) {
+    return l.options() != r.options();
+}
+
+
+}
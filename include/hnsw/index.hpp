@@ -15,24 +15,37 @@
 
 #pragma once
 
-#include "containers/flat_map.hpp"
 #include "containers/hopscotch-map-1.4.0/src/hopscotch_map.h"
 #include "containers/hopscotch-map-1.4.0/src/hopscotch_set.h"
-#include "containers/small_set.hpp"
+#include "containers/indexed_vector.hpp"
+#include "containers/node_layers.hpp"
 #include "detail/detail.hpp"
+#include "detail/graph_search.hpp"
+#include "detail/parallel.hpp"
+#include "index_stats.hpp"
 #include "prefetch.hpp"
 #include "options.hpp"
+#include "reorder.hpp"
+#include "rerank.hpp"
+#include "search_stats.hpp"
+#include "serialization.hpp"
 
 #include "detail/undef_hopscotch_macros.hpp"
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
 #include <functional>
+#include <istream>
 #include <map>
+#include <memory>
+#include <ostream>
 #include <queue>
 #include <random>
 #include <stdexcept>
+#include <utility>
 #include <vector>
 
 
@@ -56,120 +69,218 @@ namespace hnsw {
  *
  *  Random - Must be default-constructible and satisfy UniformRandomBitGenerator concept.
  *
+ *  Allocator - Allocator of any value type. It's rebound to the types of the nodes table, the level counts, the link blocks
+ *              of the nodes and the incoming links, and all of them get the allocator passed to the constructor.
+ *              Vectors are allocated by Vector itself, e.g. std::vector<float, Allocator>.
+ *              A copy of the index uses copies of the allocator, so with slab_allocator it shares the pool
+ *              with the original, see slab_allocator.
+ *
+ *  To use save() and load(), Key and Vector must be supported by `serializer`,
+ *  and Random must be readable and writable with operator>> and operator<< like the standard engines.
+ *
  */
 template<class Key,
          class Vector,
          class Distance,
-         class Random = std::minstd_rand>
+         class Random = std::minstd_rand,
+         class Allocator = std::allocator<char>>
 struct hnsw_index {
     using key_t = Key;
     using scalar_t = decltype(std::declval<Distance>()(std::declval<Vector>(), std::declval<Vector>()));
     using distance_t = Distance;
     using vector_t = Vector;
     using random_t = Random;
+    using allocator_t = Allocator;
+
+    template<class T>
+    using allocator_for_t = typename std::allocator_traits<Allocator>::template rebind_alloc<T>;
 
     struct search_result_t {
         key_t key;
         scalar_t distance;
     };
 
+    // Links of all layers of a node are a single allocation, see node_layers.
+    // layers[layer] gives views of the outgoing links and a reference to the incoming ones.
     struct node_t {
-        using outgoing_links_t = flat_map<key_t, scalar_t>;
-        using incoming_links_t = small_set<key_t>;
-
-        struct layer_t {
-            outgoing_links_t outgoing;
-            incoming_links_t incoming;
-        };
+        using layers_t = node_layers<key_t, scalar_t, allocator_for_t<std::pair<key_t, scalar_t>>>;
+        using outgoing_links_t = typename layers_t::outgoing_links_t;
+        using const_outgoing_links_t = typename layers_t::const_outgoing_links_t;
+        using incoming_links_t = typename layers_t::incoming_links_t;
 
         vector_t vector;
-        std::vector<layer_t> layers;
+        layers_t layers;
     };
 
+    using nodes_t = tsl::hopscotch_map<key_t, node_t, std::hash<key_t>, std::equal_to<key_t>, allocator_for_t<std::pair<key_t, node_t>>>;
+    using level_counts_t = std::vector<size_t, allocator_for_t<size_t>>;
+    using top_keys_t = indexed_vector<key_t, allocator_for_t<key_t>>;
+
 
     index_options_t options;
     distance_t distance;
     random_t random;
 
-    tsl::hopscotch_map<key_t, node_t> nodes;
+    nodes_t nodes;
+
+    // level_counts[i] is the number of nodes with i + 1 layers. The last one is never zero.
+    level_counts_t level_counts;
+
+    // Keys of the nodes on the top level, the first one is the entry point of searches.
+    // The top level usually holds few nodes, so they are found again from the graph when the last one is removed.
+    // It may hold all nodes after removals though, so keys are found in it by a hash map.
+    top_keys_t top_keys;
+
+    // Number of nearest neighbors -> ef to use for them when it's not specified explicitly. Filled by autotune().
+    std::map<size_t, size_t> tuned_ef;
+
+    // Progress of an incremental compaction, see start_compaction().
+    struct compaction_t {
+        std::vector<key_t> keys;
+        size_t position = 0;
+    };
 
-    // For levels order of keys is important, so it's std::map.
-    std::map<size_t, tsl::hopscotch_set<key_t>> levels;
+    // Cumulative counters of the work done by the index. Updated by const methods too, hence mutable.
+    mutable detail::index_counters_t counters;
 
 private:
-    using closest_queue_t = std::priority_queue<
-        std::pair<key_t, scalar_t>,
-        std::vector<std::pair<key_t, scalar_t>>,
-        detail::search_result_further_t
-    >;
-
-    using furthest_queue_t = std::priority_queue<
-        std::pair<key_t, scalar_t>,
-        std::vector<std::pair<key_t, scalar_t>>,
-        detail::search_result_closer_t
-    >;
+    using furthest_queue_t = detail::furthest_queue_t<key_t, scalar_t>;
+
+    // Accessor for the search algorithms from graph_search.hpp.
+    struct graph_t {
+        using key_t = Key;
+        using scalar_t = typename hnsw_index::scalar_t;
+
+        const hnsw_index &index;
+
+        size_t size() const {
+            return index.nodes.size();
+        }
+
+        size_t max_links(size_t layer) const {
+            return index.max_links(layer);
+        }
+
+        typename node_t::const_outgoing_links_t links(const key_t &node, size_t layer) const {
+            return index.nodes.at(node).layers.at(layer).outgoing;
+        }
+
+        const key_t &link_key(const std::pair<key_t, scalar_t> &link) const {
+            return link.first;
+        }
+
+        template<class Target>
+        scalar_t distance(const Target &target, const key_t &node) const {
+            return index.distance(target, index.nodes.at(node).vector);
+        }
+
+        void prefetch(const key_t &node) const {
+            hnsw::prefetch<vector_t>::pref(index.nodes.at(node).vector);
+        }
+    };
 
 public:
+    hnsw_index() = default;
+
+    explicit hnsw_index(const allocator_t &allocator):
+        nodes(allocator_for_t<std::pair<key_t, node_t>>(allocator)),
+        level_counts(allocator_for_t<size_t>(allocator)),
+        top_keys(allocator_for_t<key_t>(allocator))
+    { }
+
+    allocator_t get_allocator() const {
+        return allocator_t(nodes.get_allocator());
+    }
+
+    /** Make room for nodes_number nodes, so that inserts don't rehash the nodes table
+     *  until the index grows beyond that. A rehash is a pause linear in the size of the index.
+     *
+     *  remove() never shrinks the tables, compact() does that and drops the reserved room.
+     */
+    void reserve(size_t nodes_number) {
+        size_t nodes_buckets = nodes.bucket_count();
+        nodes.reserve(nodes_number);
+
+        if (nodes.bucket_count() != nodes_buckets) {
+            counters.rehashes.add(1);
+        }
+    }
+
     void insert(const key_t &key, const vector_t &vector) {
         insert(key, vector_t(vector));
     }
 
     void insert(const key_t &key, vector_t &&vector) {
+        detail::operation_timer_t timer(counters.insert_time);
+
         if (nodes.count(key) > 0) {
             throw std::runtime_error("hnsw_index::insert: key already exists");
         }
 
+        counters.inserts.add(1);
+
         size_t node_level = random_level() + 1;
+        size_t nodes_buckets = nodes.bucket_count();
 
         auto node_it = nodes.emplace(key, node_t {
             std::move(vector),
-            std::vector<typename node_t::layer_t>(node_level)
+            make_layers(node_level, options, get_allocator())
         }).first;
 
-        for (size_t layer = 0; layer < node_level; ++layer) {
-            node_it.value().layers[layer].outgoing.reserve(max_links(layer));
+        if (nodes.bucket_count() != nodes_buckets) {
+            counters.rehashes.add(1);
         }
 
         if (nodes.size() == 1) {
-            levels[node_level].insert(key);
+            add_to_level(level_counts, top_keys, node_level, key);
             return;
         }
 
-        key_t start = *levels.rbegin()->second.begin();
+        key_t start = top_keys.front();
+        no_search_stats_t no_stats;
+        detail::counting_stats_t<no_search_stats_t> stats {no_stats, 0};
 
         for (size_t layer = nodes.at(start).layers.size(); layer > 0; --layer) {
-            start = greedy_search(node_it->second.vector, layer - 1, start);
+            start = detail::greedy_search(graph_t {*this}, node_it->second.vector, layer - 1, start, stats);
 
             if (layer <= node_level) {
                 detail::priority_queue<furthest_queue_t> results;
-                search_level(node_it->second.vector,
-                             options.ef_construction,
-                             layer - 1,
-                             {start},
-                             results);
+                detail::search_level(graph_t {*this},
+                                     node_it->second.vector,
+                                     options.ef_construction,
+                                     layer - 1,
+                                     {start},
+                                     results,
+                                     stats);
 
                 std::sort(results.c.begin(), results.c.end(), [](const auto &l, const auto &r) { return l.second < r.second; });
-                set_links(key, layer - 1, results.c);
+                set_links(key, layer - 1, results.c, stats);
 
                 // NOTE: Here we attempt to link all candidates to the new item.
                 // The original HNSW attempts to link only with the actual neighbors.
                 for (const auto &peer: results.c) {
-                    try_add_link(peer.first, layer - 1, key, peer.second);
+                    try_add_link(peer.first, layer - 1, key, peer.second, stats);
                 }
             }
         }
 
-        levels[node_level].insert(key);
+        add_to_level(level_counts, top_keys, node_level, key);
+        counters.distance_computations.add(stats.distance_computations);
     }
 
 
     void remove(const key_t &key) {
+        detail::operation_timer_t timer(counters.remove_time);
         auto node_it = nodes.find(key);
 
         if (node_it == nodes.end()) {
             return;
         }
 
+        counters.removes.add(1);
+
+        no_search_stats_t no_stats;
+        detail::counting_stats_t<no_search_stats_t> stats {no_stats, 0};
         const auto &layers = node_it->second.layers;
 
         for (size_t layer = 0; layer < layers.size(); ++layer) {
@@ -185,13 +296,13 @@ public:
         if (options.remove_method != index_options_t::remove_method_t::no_link) {
             for (size_t layer = 0; layer < layers.size(); ++layer) {
                 for (const auto &inverted_link: layers[layer].incoming) {
-                    auto &peer_links = nodes.at(inverted_link).layers.at(layer).outgoing;
+                    auto peer_links = nodes.at(inverted_link).layers.at(layer).outgoing;
                     const key_t *new_link_ptr = nullptr;
 
                     if (options.insert_method == index_options_t::insert_method_t::link_nearest) {
-                        new_link_ptr = select_nearest_link(inverted_link, peer_links, layers.at(layer).outgoing);
+                        new_link_ptr = select_nearest_link(inverted_link, peer_links, layers.at(layer).outgoing, stats);
                     } else if (options.insert_method == index_options_t::insert_method_t::link_diverse) {
-                        new_link_ptr = select_most_diverse_link(inverted_link, peer_links, layers.at(layer).outgoing);
+                        new_link_ptr = select_most_diverse_link(inverted_link, peer_links, layers.at(layer).outgoing, stats);
                     } else {
                         assert(false);
                     }
@@ -200,100 +311,486 @@ public:
                         auto new_link = *new_link_ptr;
                         auto &new_link_node = nodes.at(new_link);
                         auto d = distance(nodes.at(inverted_link).vector, new_link_node.vector);
+                        stats.on_distance();
                         peer_links.emplace(new_link, d);
                         new_link_node.layers.at(layer).incoming.insert(inverted_link);
-                        try_add_link(new_link, layer, inverted_link, d);
+                        try_add_link(new_link, layer, inverted_link, d, stats);
+                        counters.repair_links.add(1);
                     }
                 }
             }
         }
 
-        auto level_it = levels.find(layers.size());
+        remove_from_level(key, layers);
+
+        // The tables aren't shrunk here, since a rehash is a pause linear in the size of the index. See compact().
+        nodes.erase(node_it);
+
+        counters.distance_computations.add(stats.distance_computations);
+    }
+
+
+    // Query is usually vector_t, but it can be any type accepted by the distance as its first argument,
+    // e.g. a float query over quantized vectors.
+    template<class Query = vector_t>
+    std::vector<search_result_t> search(const Query &target, size_t nearest_neighbors) const {
+        return search(target, nearest_neighbors, default_ef(nearest_neighbors));
+    }
+
 
-        if (level_it == levels.end()) {
-            throw std::runtime_error("hnsw_index::remove: the node is not present in the levels index");
+    template<class Query = vector_t>
+    std::vector<search_result_t> search(const Query &target, size_t nearest_neighbors, size_t ef) const {
+        no_search_stats_t stats;
+        return search(target, nearest_neighbors, ef, stats);
+    }
+
+
+    // Stats - search_stats_t or another type with the same methods, which collects the work done by the search.
+    template<class Query, class Stats>
+    std::vector<search_result_t> search(const Query &target, size_t nearest_neighbors, size_t ef, Stats &user_stats) const {
+        detail::operation_timer_t timer(counters.search_time);
+        counters.searches.add(1);
+
+        if (nodes.empty()) {
+            return {};
         }
 
-        level_it->second.erase(key);
+        detail::counting_stats_t<Stats> stats {user_stats, 0};
+        key_t start = top_keys.front();
 
-        // Shrink the hash table when it becomes too sparse
-        // (to reduce memory usage and ensure linear complexity for iteration).
-        if (4 * level_it->second.load_factor() < level_it->second.max_load_factor()) {
-            level_it->second.rehash(size_t(2 * level_it->second.size() / level_it->second.max_load_factor()));
+        for (size_t layer = nodes.at(start).layers.size(); layer > 0; --layer) {
+            start = detail::greedy_search(graph_t {*this}, target, layer - 1, start, stats);
         }
 
-        if (level_it->second.empty()) {
-            levels.erase(level_it);
+        detail::early_termination_t termination {nearest_neighbors, 0};
+
+        if (options.search_termination == index_options_t::search_termination_t::adaptive) {
+            termination.max_unproductive_hops = options.max_unproductive_hops;
         }
 
-        nodes.erase(node_it);
+        detail::priority_queue<furthest_queue_t> results;
+        detail::search_level(graph_t {*this}, target, std::max(nearest_neighbors, ef), 0, {start}, results, stats, termination);
+
+        auto results_vector = detail::take_nearest<search_result_t>(results, nearest_neighbors);
+
+        counters.distance_computations.add(stats.distance_computations);
+
+        return results_vector;
+    }
+
+
+    /** Two-phase search: traverse the graph with the index distance, which is usually cheap and approximate,
+     *  then rescore the best rerank_k candidates with exact_distance(exact_target, vector_of(key)).
+     *
+     *  vector_of returns the full vector of a key, which may be stored anywhere, e.g. in memory or in a mapped file.
+     *  Any codec plugs in by its vector type and distance: target is its query, exact_target is the original one.
+     *  Results have the type of the exact distance.
+     */
+    template<class Query, class ExactQuery, class VectorOf, class ExactDistance>
+    auto search_reranked(const Query &target,
+                         const ExactQuery &exact_target,
+                         size_t nearest_neighbors,
+                         size_t rerank_k,
+                         VectorOf &&vector_of,
+                         const ExactDistance &exact_distance) const
+    {
+        no_search_stats_t stats;
+        return search_reranked(target,
+                               exact_target,
+                               nearest_neighbors,
+                               rerank_k,
+                               default_ef(std::max(nearest_neighbors, rerank_k)),
+                               std::forward<VectorOf>(vector_of),
+                               exact_distance,
+                               stats);
+    }
+
+
+    template<class Query, class ExactQuery, class VectorOf, class ExactDistance, class Stats>
+    auto search_reranked(const Query &target,
+                         const ExactQuery &exact_target,
+                         size_t nearest_neighbors,
+                         size_t rerank_k,
+                         size_t ef,
+                         VectorOf &&vector_of,
+                         const ExactDistance &exact_distance,
+                         Stats &user_stats) const
+    {
+        auto candidates = search(target, std::max(nearest_neighbors, rerank_k), ef, user_stats);
 
-        if (4 * nodes.load_factor() < nodes.max_load_factor()) {
-            nodes.rehash(size_t(2 * nodes.size() / nodes.max_load_factor()));
+        detail::counting_stats_t<Stats> stats {user_stats, 0};
+        auto results = rerank(candidates, nearest_neighbors, exact_target, std::forward<VectorOf>(vector_of), exact_distance, stats);
+        counters.distance_computations.add(stats.distance_computations);
+
+        return results;
+    }
+
+
+    // Find the smallest ef for which search() reaches target_recall on the sample queries,
+    // comparing its results with the exact nearest neighbors found by brute force.
+    // The found ef is stored in tuned_ef and used by search() without explicit ef
+    // for this and smaller numbers of nearest neighbors.
+    size_t autotune(const std::vector<vector_t> &sample_queries, size_t nearest_neighbors, double target_recall) {
+        if (nodes.empty() || sample_queries.empty() || nearest_neighbors == 0) {
+            throw std::runtime_error("hnsw_index::autotune: the index, the sample or the number of neighbors is empty");
         }
+
+        std::vector<tsl::hopscotch_set<key_t>> reference;
+        reference.reserve(sample_queries.size());
+
+        for (const auto &query: sample_queries) {
+            reference.push_back(exact_search(query, nearest_neighbors));
+        }
+
+        auto recall = [&](size_t ef) {
+            size_t found = 0;
+            size_t total = 0;
+
+            for (size_t i = 0; i < sample_queries.size(); ++i) {
+                for (const auto &result: search(sample_queries[i], nearest_neighbors, ef)) {
+                    found += reference[i].count(result.key);
+                }
+
+                total += reference[i].size();
+            }
+
+            return double(found) / double(total);
+        };
+
+        // ef larger than the index gives nothing over the exhaustive search of the graph.
+        size_t max_ef = std::max(nearest_neighbors, nodes.size());
+        size_t low = nearest_neighbors;
+        size_t high = nearest_neighbors;
+
+        while (high < max_ef && recall(high) < target_recall) {
+            low = high + 1;
+            high = std::min(max_ef, 2 * high);
+        }
+
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+
+            if (recall(middle) < target_recall) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+
+        tuned_ef[nearest_neighbors] = high;
+        return high;
     }
 
 
-    std::vector<search_result_t> search(const vector_t &target, size_t nearest_neighbors) const {
-        return search(target, nearest_neighbors, 100 + nearest_neighbors);
+    index_stats_t stats_snapshot() const {
+        return counters.snapshot();
     }
 
 
-    std::vector<search_result_t> search(const vector_t &target, size_t nearest_neighbors, size_t ef) const {
+    /** Copy vectors and link blocks of nodes in the locality order of the graph, so that searches touch fewer cache lines
+     *  and pages. Keys and links don't change.
+     *
+     *  Neighbors end up close in memory only if the allocators place consecutive allocations next to each other,
+     *  as malloc does with the space it gets after the old copies. Pool allocators with free lists may not.
+     *  Nodes are copied in the new order and the old copies are freed after that, so it needs memory for two copies.
+     *  Locality degrades as the index is modified, so call it after bulk inserts.
+     */
+    void reorder(reorder_method_t method = reorder_method_t::bfs) {
         if (nodes.empty()) {
-            return {};
+            return;
         }
 
-        key_t start = *levels.rbegin()->second.begin();
+        std::vector<key_t> keys;
+        keys.reserve(nodes.size());
+        keys.push_back(top_keys.front());
 
-        for (size_t layer = nodes.at(start).layers.size(); layer > 0; --layer) {
-            start = greedy_search(target, layer - 1, start);
+        for (const auto &node: nodes) {
+            if (node.first != keys.front()) {
+                keys.push_back(node.first);
+            }
         }
 
-        detail::priority_queue<furthest_queue_t> results;
-        search_level(target, std::max(nearest_neighbors, ef), 0, {start}, results);
+        auto order = detail::locality_order(keys, [this](const key_t &key, std::vector<key_t> &links) {
+            for (const auto &link: nodes.at(key).layers.front().outgoing) {
+                links.push_back(link.first);
+            }
+        }, method);
+
+        nodes_t new_nodes(nodes.get_allocator());
+        new_nodes.reserve(nodes.size());
+
+        for (const auto &key: order) {
+            new_nodes.emplace(key, nodes.at(key));
+        }
+
+        nodes = std::move(new_nodes);
+    }
+
+
+    /** Replace every key with new_key(key), keeping the graph. new_key must map different keys on different keys.
+     *  The index is left intact if it throws.
+     */
+    template<class NewKey>
+    void rename_keys(NewKey &&new_key) {
+        nodes_t new_nodes(nodes.get_allocator());
+        new_nodes.reserve(nodes.size());
+
+        std::vector<std::pair<key_t, scalar_t>> links;
+        std::vector<key_t> incoming;
 
-        size_t results_to_return = std::min(results.size(), nearest_neighbors);
+        for (const auto &node: nodes) {
+            const auto &layers = node.second.layers;
+            auto new_layers = make_layers(layers.size(), options, get_allocator());
+
+            for (size_t layer = 0; layer < layers.size(); ++layer) {
+                links.clear();
+                incoming.clear();
+
+                for (const auto &link: layers[layer].outgoing) {
+                    links.emplace_back(new_key(link.first), link.second);
+                }
 
-        std::partial_sort(
-            results.c.begin(),
-            results.c.begin() + results_to_return,
-            results.c.end(),
-            [](const auto &l, const auto &r) {
-                return l.second < r.second;
+                for (const auto &link: layers[layer].incoming) {
+                    incoming.push_back(new_key(link));
+                }
+
+                std::sort(links.begin(), links.end(), [](const auto &l, const auto &r) { return l.first < r.first; });
+                new_layers[layer].outgoing.assign_ordered_unique(links.begin(), links.end());
+                new_layers[layer].incoming.assign_unique(incoming.begin(), incoming.end());
+            }
+
+            if (!new_nodes.emplace(new_key(node.first), node_t {node.second.vector, std::move(new_layers)}).second) {
+                throw std::runtime_error("hnsw_index::rename_keys: new keys are not unique");
             }
-        );
+        }
 
-        std::vector<search_result_t> results_vector;
-        results_vector.reserve(results_to_return);
+        top_keys_t new_top_keys(top_keys.get_allocator());
 
-        for (size_t i = 0; i < results_to_return; ++i) {
-            results_vector.push_back({results.c[i].first, results.c[i].second});
+        for (const auto &key: top_keys) {
+            new_top_keys.insert(new_key(key));
         }
 
-        return results_vector;
+        nodes = std::move(new_nodes);
+        top_keys = std::move(new_top_keys);
+    }
+
+
+    /** Give back memory kept after heavy churn: link containers of all nodes are shrunk to fit,
+     *  hash tables are rehashed to the size they'd have after inserting the current nodes,
+     *  and free heap memory is returned to the OS (with glibc).
+     *
+     *  Links grown beyond the capacity set by options.max_links are shrunk back to it, not below,
+     *  so that the following inserts don't reallocate them again.
+     *
+     *  With slab_allocator the freed memory goes back to the pool, which gives a slab back to the heap
+     *  only when all blocks in it are freed, so scattered removals leave the slabs allocated.
+     */
+    void compact() {
+        auto compaction = start_compaction();
+        compact(compaction, std::chrono::steady_clock::duration::max());
+    }
+
+    /** Start a compaction which is done in slices by compact(compaction, time_budget) between other operations.
+     *  It takes a snapshot of the keys, nodes inserted after that are not compacted.
+     */
+    compaction_t start_compaction() const {
+        compaction_t compaction;
+        compaction.keys.reserve(nodes.size());
+
+        for (const auto &node: nodes) {
+            compaction.keys.push_back(node.first);
+        }
+
+        return compaction;
+    }
+
+    /** Compact nodes for about time_budget and return whether the compaction is finished.
+     *  The last slice also shrinks the hash tables, which takes time linear in the number of nodes.
+     */
+    bool compact(compaction_t &compaction, std::chrono::steady_clock::duration time_budget) {
+        // Checking the clock costs about as much as compacting a node.
+        constexpr size_t clock_period = 64;
+        auto start = std::chrono::steady_clock::now();
+
+        while (compaction.position < compaction.keys.size()) {
+            auto node_it = nodes.find(compaction.keys[compaction.position]);
+
+            if (node_it != nodes.end()) {
+                node_it.value().layers.shrink_to_fit(max_links(0), max_links(1));
+            }
+
+            ++compaction.position;
+
+            if (compaction.position % clock_period == 0 && std::chrono::steady_clock::now() - start >= time_budget) {
+                break;
+            }
+        }
+
+        if (compaction.position < compaction.keys.size()) {
+            return false;
+        }
+
+        finish_compaction(compaction);
+        return true;
+    }
+
+
+    // Write the index to the stream in a binary format. Counters are not saved.
+    void save(std::ostream &stream) const {
+        detail::stream_writer_t writer(stream);
+
+        detail::write_header(writer, "HNSWIDX", 2);
+        detail::write_value(writer, std::uint8_t(sizeof(scalar_t)));
+
+        detail::write_value(writer, std::uint64_t(options.max_links));
+        detail::write_value(writer, std::uint64_t(options.ef_construction));
+        detail::write_value(writer, std::uint8_t(options.insert_method));
+        detail::write_value(writer, std::uint8_t(options.remove_method));
+        detail::write_value(writer, std::uint8_t(options.search_termination));
+        detail::write_value(writer, std::uint64_t(options.max_unproductive_hops));
+
+        detail::write_random(writer, random);
+
+        detail::write_value(writer, std::uint64_t(tuned_ef.size()));
+
+        for (const auto &ef: tuned_ef) {
+            detail::write_value(writer, std::uint64_t(ef.first));
+            detail::write_value(writer, std::uint64_t(ef.second));
+        }
+
+        // Nodes are written in chunks with known sizes, so that load() can decode them in parallel.
+        detail::write_value(writer, std::uint64_t(nodes.size()));
+        detail::write_value(writer, std::uint64_t((nodes.size() + save_chunk_nodes - 1) / save_chunk_nodes));
+
+        std::vector<char> chunk;
+        std::vector<key_t> keys;
+        std::vector<scalar_t> distances;
+        size_t chunk_nodes = 0;
+
+        auto write_chunk = [&]() {
+            detail::write_value(writer, std::uint64_t(chunk_nodes));
+            detail::write_value(writer, chunk);
+            chunk.clear();
+            chunk_nodes = 0;
+        };
+
+        for (const auto &node: nodes) {
+            detail::buffer_writer_t chunk_writer(chunk);
+            write_node(chunk_writer, node.first, node.second, keys, distances);
+
+            if (++chunk_nodes == save_chunk_nodes) {
+                write_chunk();
+            }
+        }
+
+        if (chunk_nodes > 0) {
+            write_chunk();
+        }
+    }
+
+
+    /** Replace content of the index with the one written by save().
+     *  The index is left intact if the stream can't be read.
+     *
+     *  Nodes are decoded by `threads` threads, 0 means one per core. Snapshots of the first version are read by one thread.
+     *  Only keys and vectors are constructed by the worker threads, so they must be safe to construct concurrently,
+     *  as std::vector and std::string with std::allocator are. Allocator is used by the calling thread only.
+     */
+    void load(std::istream &stream, size_t threads = 0) {
+        if (threads == 0) {
+            threads = detail::default_threads();
+        }
+
+        detail::stream_reader_t reader(stream);
+
+        auto version = detail::read_header(reader, "HNSWIDX", 2);
+
+        if (detail::read_value<std::uint8_t>(reader) != sizeof(scalar_t)) {
+            throw std::runtime_error("hnsw_index::load: the index was saved with another distance type");
+        }
+
+        index_options_t new_options;
+        new_options.max_links = detail::read_value<std::uint64_t>(reader);
+        new_options.ef_construction = detail::read_value<std::uint64_t>(reader);
+        new_options.insert_method = read_enum(reader, index_options_t::insert_method_t::link_diverse);
+        new_options.remove_method = read_enum(reader, index_options_t::remove_method_t::compensate_incomming_links);
+        new_options.search_termination = read_enum(reader, index_options_t::search_termination_t::adaptive);
+        new_options.max_unproductive_hops = detail::read_value<std::uint64_t>(reader);
+
+        random_t new_random;
+        detail::read_random(reader, new_random);
+
+        std::map<size_t, size_t> new_tuned_ef;
+        auto tuned_ef_size = detail::read_value<std::uint64_t>(reader);
+
+        for (std::uint64_t i = 0; i < tuned_ef_size; ++i) {
+            auto nearest_neighbors = detail::read_value<std::uint64_t>(reader);
+            new_tuned_ef[nearest_neighbors] = detail::read_value<std::uint64_t>(reader);
+        }
+
+        auto nodes_number = reader.checked_size(detail::read_value<std::uint64_t>(reader), sizeof(node_t));
+
+        auto allocator = get_allocator();
+        nodes_t new_nodes(nodes.get_allocator());
+        new_nodes.reserve(nodes_number);
+
+        level_counts_t new_level_counts(level_counts.get_allocator());
+        top_keys_t new_top_keys(top_keys.get_allocator());
+
+        auto add_node = [&](key_t &key, node_t &node) {
+            add_to_level(new_level_counts, new_top_keys, node.layers.size(), key);
+
+            if (!new_nodes.emplace(std::move(key), std::move(node)).second) {
+                throw std::runtime_error("hnsw_index::load: the stream is corrupted, duplicate key");
+            }
+        };
+
+        if (version == 1) {
+            decoded_nodes_t decoded;
+            load_buffers_t buffers;
+
+            for (size_t i = 0; i < nodes_number; ++i) {
+                read_node(reader, decoded, buffers);
+                add_decoded_nodes(decoded, new_options, allocator, add_node);
+            }
+        } else {
+            load_chunks(reader, new_options, allocator, nodes_number, threads, add_node);
+        }
+
+        if (new_nodes.size() != nodes_number) {
+            throw std::runtime_error("hnsw_index::load: the stream is corrupted, wrong number of nodes");
+        }
+
+        options = new_options;
+        random = std::move(new_random);
+        tuned_ef = std::move(new_tuned_ef);
+        nodes = std::move(new_nodes);
+        level_counts = std::move(new_level_counts);
+        top_keys = std::move(new_top_keys);
     }
 
 
     // Check whether the index satisfies its invariants.
     bool check() const {
         if (nodes.empty()) {
-            return levels.empty();
+            return level_counts.empty() && top_keys.empty();
         }
 
-        for (const auto &node: nodes) {
-            auto level_it = levels.find(node.second.layers.size());
+        level_counts_t actual_level_counts(level_counts.get_allocator());
 
-            if (level_it == levels.end()) {
+        for (const auto &node: nodes) {
+            if (node.second.layers.empty()) {
                 return false;
             }
 
-            if (level_it->second.count(node.first) == 0) {
-                return false;
+            if (actual_level_counts.size() < node.second.layers.size()) {
+                actual_level_counts.resize(node.second.layers.size(), 0);
             }
 
+            ++actual_level_counts[node.second.layers.size() - 1];
+
             for (size_t layer = 0; layer < node.second.layers.size(); ++layer) {
-                const auto &links = node.second.layers[layer].outgoing;
+                auto links = node.second.layers[layer].outgoing;
 
                 // Self-links are not allowed.
                 if (links.count(node.first) > 0) {
@@ -334,17 +831,20 @@ public:
             }
         }
 
-        for (const auto &level: levels) {
-            for (const auto &key: level.second) {
-                auto node_it = nodes.find(key);
+        if (actual_level_counts != level_counts || top_keys.size() != level_counts.back()) {
+            return false;
+        }
 
-                if (node_it == nodes.end()) {
-                    return false;
-                }
+        // top_keys holds unique keys, so it's enough for all of them to be on the top level.
+        for (const auto &key: top_keys) {
+            auto node_it = nodes.find(key);
 
-                if (level.first != node_it->second.layers.size()) {
-                    return false;
-                }
+            if (node_it == nodes.end()) {
+                return false;
+            }
+
+            if (node_it->second.layers.size() != level_counts.size()) {
+                return false;
             }
         }
 
@@ -353,127 +853,378 @@ public:
 
 
 private:
-    size_t max_links(size_t level) const {
-        return (level == 0) ? (2 * options.max_links) : options.max_links;
+    size_t default_ef(size_t nearest_neighbors) const {
+        // ef tuned for more neighbors is good enough for fewer neighbors.
+        auto tuned_it = tuned_ef.lower_bound(nearest_neighbors);
+
+        if (tuned_it != tuned_ef.end()) {
+            return tuned_it->second;
+        }
+
+        return 100 + nearest_neighbors;
     }
 
 
-    size_t random_level() {
-        // I avoid use of uniform_real_distribution to control how many times random() is called.
-        // This makes inserts reproducible across standard libraries.
+    tsl::hopscotch_set<key_t> exact_search(const vector_t &target, size_t nearest_neighbors) const {
+        furthest_queue_t results;
 
-        // NOTE: This works correctly for standard random engines because their value_type is required to be unsigned.
-        auto sample = random() - random_t::min();
-        auto max_rand = random_t::max() - random_t::min();
+        for (const auto &node: nodes) {
+            auto d = distance(target, node.second.vector);
 
-        // If max_rand is too large, decrease it so that it can be represented by double.
-        if (max_rand > 1048576) {
-            sample /= max_rand / 1048576;
-            max_rand /= max_rand / 1048576;
+            if (results.size() < nearest_neighbors) {
+                results.push({node.first, d});
+            } else if (d < results.top().second) {
+                results.pop();
+                results.push({node.first, d});
+            }
         }
 
-        double x = std::min(1.0, std::max(0.0, double(sample) / double(max_rand)));
-        return static_cast<size_t>(-std::log(x) / std::log(double(options.max_links + 1)));
+        tsl::hopscotch_set<key_t> result;
+
+        for (; !results.empty(); results.pop()) {
+            result.insert(results.top().first);
+        }
+
+        return result;
     }
 
 
-    void search_level(const vector_t &target,
-                      size_t results_number,
-                      size_t layer,
-                      const std::vector<key_t> &start_from,
-                      furthest_queue_t &results) const
+    // Read an enum written as one byte, last is its last value.
+    template<class Reader, class Enum>
+    static Enum read_enum(Reader &reader, Enum last) {
+        auto value = detail::read_value<std::uint8_t>(reader);
+
+        if (value > std::uint8_t(last)) {
+            throw std::runtime_error("hnsw_index::load: the stream is corrupted, unknown option value");
+        }
+
+        return Enum(value);
+    }
+
+
+    // Nodes per chunk of a snapshot. Chunks are the unit of parallel decoding.
+    static constexpr size_t save_chunk_nodes = 4096;
+
+
+    // Scratch space reused across nodes while loading.
+    struct load_buffers_t {
+        std::vector<key_t> keys;
+        std::vector<scalar_t> distances;
+    };
+
+
+    // Nodes read from a snapshot by a worker thread. They are kept in buffers with the default allocator,
+    // since Allocator isn't required to be thread-safe, and are turned into node_t by the loading thread.
+    struct decoded_nodes_t {
+        std::vector<key_t> keys;
+        std::vector<vector_t> vectors;
+        // Number of layers of each node.
+        std::vector<std::uint32_t> layers;
+        // Links of all layers of all nodes back to back, layer_ends has the ends of each layer in both of them.
+        std::vector<std::pair<key_t, scalar_t>> outgoing;
+        std::vector<key_t> incoming;
+        std::vector<std::pair<size_t, size_t>> layer_ends;
+
+        void clear() {
+            keys.clear();
+            vectors.clear();
+            layers.clear();
+            outgoing.clear();
+            incoming.clear();
+            layer_ends.clear();
+        }
+    };
+
+
+    template<class Writer>
+    static void write_node(Writer &writer,
+                           const key_t &key,
+                           const node_t &node,
+                           std::vector<key_t> &keys,
+                           std::vector<scalar_t> &distances)
     {
-        tsl::hopscotch_set<key_t> visited_nodes;
-        visited_nodes.reserve(5 * max_links(layer) * results_number);
-        visited_nodes.insert(start_from.begin(), start_from.end());
+        detail::write_value(writer, key);
+        detail::write_value(writer, node.vector);
+        detail::write_value(writer, std::uint32_t(node.layers.size()));
 
-        detail::priority_queue<closest_queue_t> search_front;
+        for (const auto layer: node.layers) {
+            keys.clear();
+            distances.clear();
 
-        for (const auto &key: start_from) {
-            auto d = distance(target, nodes.at(key).vector);
-            results.push({key, d});
-            search_front.push({key, d});
+            for (const auto &link: layer.outgoing) {
+                keys.push_back(link.first);
+                distances.push_back(link.second);
+            }
+
+            detail::write_value(writer, keys);
+            detail::write_value(writer, distances);
+
+            keys.assign(layer.incoming.begin(), layer.incoming.end());
+            detail::write_value(writer, keys);
         }
+    }
+
+
+    // Append the next node of the stream to the decoded ones. Doesn't use Allocator.
+    template<class Reader>
+    static void read_node(Reader &reader, decoded_nodes_t &decoded, load_buffers_t &buffers) {
+        decoded.keys.emplace_back();
+        detail::read_value(reader, decoded.keys.back());
+
+        decoded.vectors.emplace_back();
+        detail::read_value(reader, decoded.vectors.back());
 
-        while (results.size() > results_number) {
-            results.pop();
+        auto layers_number = detail::read_value<std::uint32_t>(reader);
+
+        if (layers_number == 0 || layers_number > 64) {
+            throw std::runtime_error("hnsw_index::load: the stream is corrupted, wrong number of layers");
         }
 
-        for (size_t hop = 0; !search_front.empty() && search_front.top().second <= results.top().second && hop < nodes.size(); ++hop) {
-            const auto &node = nodes.at(search_front.top().first);
-            search_front.pop();
+        decoded.layers.push_back(layers_number);
 
-            const auto &links = node.layers.at(layer).outgoing;
+        for (size_t layer = 0; layer < layers_number; ++layer) {
+            detail::read_value(reader, buffers.keys);
+            detail::read_value(reader, buffers.distances);
 
-            for (auto it = links.rbegin(); it != links.rend(); ++it) {
-                if (visited_nodes.count(it->first) == 0) {
-                    prefetch<vector_t>::pref(nodes.at(it->first).vector);
-                }
+            if (buffers.keys.size() != buffers.distances.size()) {
+                throw std::runtime_error("hnsw_index::load: the stream is corrupted, wrong number of distances");
             }
 
-            for (const auto &link: links) {
-                if (visited_nodes.insert(link.first).second) {
-                    auto d = distance(target, nodes.at(link.first).vector);
-
-                    if (results.size() < results_number) {
-                        results.push({link.first, d});
-                        search_front.push({link.first, d});
-                    } else if (d < results.top().second) {
-                        results.pop();
-                        results.push({link.first, d});
-                        search_front.push({link.first, d});
-                    }
-                }
+            for (size_t j = 0; j < buffers.keys.size(); ++j) {
+                decoded.outgoing.emplace_back(buffers.keys[j], buffers.distances[j]);
             }
 
-            // Try to make search_front smaller, so to speed up operations on it.
-            while (!search_front.empty() && search_front.c.back().second > results.top().second) {
-                search_front.c.pop_back();
+            detail::read_value(reader, buffers.keys);
+            decoded.incoming.insert(decoded.incoming.end(), buffers.keys.begin(), buffers.keys.end());
+
+            decoded.layer_ends.emplace_back(decoded.outgoing.size(), decoded.incoming.size());
+        }
+    }
+
+
+    // Build nodes from the decoded ones with Allocator, pass them to add_node() in order and clear the decoded nodes.
+    template<class AddNode>
+    static void add_decoded_nodes(decoded_nodes_t &decoded,
+                                  const index_options_t &new_options,
+                                  const allocator_t &allocator,
+                                  AddNode &&add_node)
+    {
+        size_t layer_index = 0;
+        size_t outgoing_begin = 0;
+        size_t incoming_begin = 0;
+
+        for (size_t i = 0; i < decoded.keys.size(); ++i) {
+            node_t node {std::move(decoded.vectors[i]), make_layers(decoded.layers[i], new_options, allocator)};
+
+            for (size_t layer = 0; layer < decoded.layers[i]; ++layer, ++layer_index) {
+                auto ends = decoded.layer_ends[layer_index];
+
+                node.layers[layer].outgoing.assign_ordered_unique(decoded.outgoing.begin() + outgoing_begin,
+                                                                  decoded.outgoing.begin() + ends.first);
+                node.layers[layer].incoming.assign_unique(decoded.incoming.begin() + incoming_begin,
+                                                          decoded.incoming.begin() + ends.second);
+
+                outgoing_begin = ends.first;
+                incoming_begin = ends.second;
             }
+
+            add_node(decoded.keys[i], node);
         }
+
+        decoded.clear();
     }
 
 
-    key_t greedy_search(const vector_t &target, size_t layer, const key_t &start_from) const {
-        key_t result = start_from;
-        scalar_t result_distance = distance(target, nodes.at(start_from).vector);
+    // Read chunks of nodes in batches and decode each batch in parallel. Nodes are built from the decoded ones
+    // and passed to add_node() in order by the calling thread. Batches bound the memory taken by raw and decoded chunks.
+    template<class Reader, class AddNode>
+    static void load_chunks(Reader &reader,
+                            const index_options_t &new_options,
+                            const allocator_t &allocator,
+                            size_t nodes_number,
+                            size_t threads,
+                            AddNode &&add_node)
+    {
+        auto chunks_number = reader.checked_size(detail::read_value<std::uint64_t>(reader), 2 * sizeof(std::uint64_t));
+        size_t loaded_nodes = 0;
+
+        std::vector<std::vector<char>> raw_chunks(std::min(chunks_number, 4 * threads));
+        std::vector<size_t> chunk_sizes(raw_chunks.size());
+        std::vector<decoded_nodes_t> decoded_chunks(raw_chunks.size());
 
-        // Just a reasonable upper limit on the number of hops to avoid infinite loops.
-        for (size_t hops = 0; hops < nodes.size(); ++hops) {
-            const auto &node = nodes.at(result);
-            bool made_hop = false;
+        for (size_t batch_begin = 0; batch_begin < chunks_number; batch_begin += raw_chunks.size()) {
+            auto batch_size = std::min(raw_chunks.size(), chunks_number - batch_begin);
 
-            const auto &links = node.layers.at(layer).outgoing;
+            for (size_t i = 0; i < batch_size; ++i) {
+                auto chunk_nodes = detail::read_value<std::uint64_t>(reader);
 
-            for (auto it = links.begin(); it != links.end(); ++it) {
-                if (it + 1 != links.end()) {
-                    prefetch<vector_t>::pref(nodes.at((it + 1)->first).vector);
+                if (chunk_nodes == 0 || chunk_nodes > nodes_number - loaded_nodes) {
+                    throw std::runtime_error("hnsw_index::load: the stream is corrupted, wrong number of nodes in a chunk");
                 }
 
-                scalar_t neighbor_distance = distance(target, nodes.at(it->first).vector);
+                loaded_nodes += chunk_nodes;
+                chunk_sizes[i] = chunk_nodes;
+                detail::read_value(reader, raw_chunks[i]);
+            }
+
+            detail::parallel_for(batch_size, threads, [&](size_t i) {
+                detail::memory_reader_t chunk_reader(raw_chunks[i].data(), raw_chunks[i].size());
+                load_buffers_t buffers;
 
-                if (neighbor_distance < result_distance) {
-                    result = it->first;
-                    result_distance = neighbor_distance;
-                    made_hop = true;
+                for (size_t j = 0; j < chunk_sizes[i]; ++j) {
+                    read_node(chunk_reader, decoded_chunks[i], buffers);
                 }
+
+                if (chunk_reader.remaining() != 0) {
+                    throw std::runtime_error("hnsw_index::load: the stream is corrupted, extra data in a chunk");
+                }
+            });
+
+            for (size_t i = 0; i < batch_size; ++i) {
+                add_decoded_nodes(decoded_chunks[i], new_options, allocator, add_node);
             }
+        }
+    }
 
-            if (!made_hop) {
-                break;
+
+    // Layers of a new node with room for max_links(layer) outgoing links on each layer.
+    static typename node_t::layers_t make_layers(size_t number, const index_options_t &options, const allocator_t &allocator) {
+        return typename node_t::layers_t(number,
+                                         2 * options.max_links,
+                                         options.max_links,
+                                         typename node_t::layers_t::allocator_type(allocator));
+    }
+
+
+    void finish_compaction(compaction_t &compaction) {
+        shrink_table(nodes);
+        detail::release_free_memory();
+
+        compaction.keys = std::vector<key_t>();
+        compaction.position = 0;
+    }
+
+    template<class Table>
+    void shrink_table(Table &table) {
+        auto buckets = table.bucket_count();
+        table.rehash(0);
+
+        if (table.bucket_count() != buckets) {
+            counters.rehashes.add(1);
+        }
+    }
+
+    static void add_to_level(level_counts_t &level_counts, top_keys_t &top_keys, size_t level, const key_t &key) {
+        if (level > level_counts.size()) {
+            level_counts.resize(level, 0);
+            top_keys.clear();
+        }
+
+        ++level_counts[level - 1];
+
+        if (level == level_counts.size()) {
+            top_keys.insert(key);
+        }
+    }
+
+
+    // Must be called before the node is erased, but after it's unlinked from the graph.
+    void remove_from_level(const key_t &key, const typename node_t::layers_t &layers) {
+        size_t level = layers.size();
+
+        if (level == 0 || level > level_counts.size() || level_counts[level - 1] == 0) {
+            throw std::runtime_error("hnsw_index::remove: the node is not counted in the levels");
+        }
+
+        --level_counts[level - 1];
+
+        if (level < level_counts.size()) {
+            return;
+        }
+
+        if (top_keys.erase(key) == 0) {
+            throw std::runtime_error("hnsw_index::remove: the node is not present in the top level");
+        }
+
+        if (!top_keys.empty()) {
+            return;
+        }
+
+        while (!level_counts.empty() && level_counts.back() == 0) {
+            level_counts.pop_back();
+        }
+
+        if (level_counts.empty()) {
+            return;
+        }
+
+        // Nodes linked to the removed one on the new top layer are on the top level now,
+        // and the rest of the level is usually reachable from them on that layer.
+        size_t top_layer = level_counts.size() - 1;
+
+        for (const auto &link: layers[top_layer].outgoing) {
+            top_keys.insert(link.first);
+        }
+
+        for (const auto &link: layers[top_layer].incoming) {
+            top_keys.insert(link);
+        }
+
+        for (size_t i = 0; i < top_keys.size() && top_keys.size() < level_counts.back(); ++i) {
+            const auto &peer_layers = nodes.at(top_keys[i]).layers;
+
+            for (const auto &link: peer_layers[top_layer].outgoing) {
+                top_keys.insert(link.first);
+            }
+
+            for (const auto &link: peer_layers[top_layer].incoming) {
+                top_keys.insert(link);
             }
         }
 
-        return result;
+        // The layer is disconnected, so look through all nodes.
+        if (top_keys.size() < level_counts.back()) {
+            for (const auto &node: nodes) {
+                if (node.second.layers.size() == level_counts.size() && node.first != key) {
+                    top_keys.insert(node.first);
+                }
+            }
+        }
     }
 
 
+    size_t max_links(size_t level) const {
+        return (level == 0) ? (2 * options.max_links) : options.max_links;
+    }
+
+
+    size_t random_level() {
+        // I avoid use of uniform_real_distribution to control how many times random() is called.
+        // This makes inserts reproducible across standard libraries.
+
+        // NOTE: This works correctly for standard random engines because their value_type is required to be unsigned.
+        auto sample = random() - random_t::min();
+        auto max_rand = random_t::max() - random_t::min();
+
+        // If max_rand is too large, decrease it so that it can be represented by double.
+        if (max_rand > 1048576) {
+            sample /= max_rand / 1048576;
+            max_rand /= max_rand / 1048576;
+        }
+
+        double x = std::min(1.0, std::max(0.0, double(sample) / double(max_rand)));
+        return static_cast<size_t>(-std::log(x) / std::log(double(options.max_links + 1)));
+    }
+
+
+    template<class Stats>
     void try_add_link(const key_t &node,
                       size_t layer,
                       const key_t &new_link,
-                      scalar_t link_distance)
+                      scalar_t link_distance,
+                      Stats &stats)
     {
-        auto &layer_links = nodes.at(node).layers.at(layer).outgoing;
+        auto layer_links = nodes.at(node).layers.at(layer).outgoing;
 
         if (layer_links.size() < max_links(layer)) {
             layer_links.emplace(new_link, link_distance);
@@ -534,11 +1285,15 @@ private:
                 }
 
                 if (link_distance >= sorted_links[i].second) {
+                    stats.on_distance();
+
                     if (link_distance > distance(new_link_vector, nodes.at(sorted_links[i].first).vector)) {
                         insert = false;
                         break;
                     }
                 } else if (replace_index > i) {
+                    stats.on_distance();
+
                     if (sorted_links[i].second > distance(new_link_vector, nodes.at(sorted_links[i].first).vector)) {
                         replace_index = i;
                     }
@@ -556,9 +1311,11 @@ private:
 
 
     // new_links_set - *sorted by distance to the node* sequence of unique elements
+    template<class Stats>
     void set_links(const key_t &node,
                    size_t layer,
-                   const std::vector<std::pair<key_t, scalar_t>> &new_links_set)
+                   const std::vector<std::pair<key_t, scalar_t>> &new_links_set,
+                   Stats &stats)
     {
         size_t need_links = max_links(layer);
         std::vector<std::pair<key_t, scalar_t>> new_links;
@@ -570,10 +1327,10 @@ private:
                 new_links_set.begin() + std::min(new_links_set.size(), need_links)
             );
         } else {
-            select_diverse_links(max_links(layer), new_links_set, new_links);
+            select_diverse_links(max_links(layer), new_links_set, new_links, stats);
         }
 
-        auto &outgoing_links = nodes.at(node).layers.at(layer).outgoing;
+        auto outgoing_links = nodes.at(node).layers.at(layer).outgoing;
 
         for (const auto &link: outgoing_links) {
             nodes.at(link.first).layers.at(layer).incoming.erase(node);
@@ -588,9 +1345,11 @@ private:
     }
 
 
+    template<class Stats>
     void select_diverse_links(size_t links_number,
                               const std::vector<std::pair<key_t, scalar_t>> &candidates,
-                              std::vector<std::pair<key_t, scalar_t>> &result) const
+                              std::vector<std::pair<key_t, scalar_t>> &result,
+                              Stats &stats) const
     {
         std::vector<const vector_t *> links_vectors;
         links_vectors.reserve(links_number);
@@ -607,6 +1366,8 @@ private:
             bool reject = false;
 
             for (const auto &link_vector: links_vectors) {
+                stats.on_distance();
+
                 if (distance(candidate_vector, *link_vector) < candidate.second) {
                     reject = true;
                     break;
@@ -633,9 +1394,11 @@ private:
     }
 
 
+    template<class Stats>
     const key_t *select_nearest_link(const key_t &link_to,
-                                     const typename node_t::outgoing_links_t &existing_links,
-                                     const typename node_t::outgoing_links_t &candidates) const
+                                     const typename node_t::const_outgoing_links_t &existing_links,
+                                     const typename node_t::const_outgoing_links_t &candidates,
+                                     Stats &stats) const
     {
         auto closest_key_it = candidates.end();
         scalar_t min_distance = 0;
@@ -643,6 +1406,7 @@ private:
         for (auto it = candidates.begin(); it != candidates.end(); ++it) {
             if (it->first != link_to && existing_links.count(it->first) == 0) {
                 auto d = distance(nodes.at(it->first).vector, nodes.at(link_to).vector);
+                stats.on_distance();
 
                 if (closest_key_it == candidates.end() || d < min_distance) {
                     closest_key_it = it;
@@ -659,9 +1423,11 @@ private:
     }
 
 
+    template<class Stats>
     const key_t *select_most_diverse_link(const key_t &link_to,
-                                          const typename node_t::outgoing_links_t &existing_links,
-                                          const typename node_t::outgoing_links_t &candidates) const
+                                          const typename node_t::const_outgoing_links_t &existing_links,
+                                          const typename node_t::const_outgoing_links_t &candidates,
+                                          Stats &stats) const
     {
         std::vector<std::pair<const key_t *, scalar_t>> filtered;
         filtered.reserve(candidates.size());
@@ -672,6 +1438,7 @@ private:
                     &it->first,
                     distance(nodes.at(link_to).vector, nodes.at(it->first).vector)
                 });
+                stats.on_distance();
             }
         }
 
@@ -691,6 +1458,7 @@ private:
             for (auto existing_link = existing_links.begin(); existing_link < existing_links.end(); ++existing_link) {
                 auto d = distance(nodes.at(existing_link->first).vector,
                                   nodes.at(*candidate_it->first).vector);
+                stats.on_distance();
 
                 if (d < candidate_it->second) {
                     good = false;
@@ -0,0 +1,151 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+
+namespace hnsw {
+
+
+// Cumulative counters of an index, see hnsw_index::stats_snapshot().
+struct index_stats_t {
+    std::uint64_t inserts = 0;
+    std::uint64_t removes = 0;
+    std::uint64_t searches = 0;
+    std::uint64_t distance_computations = 0;
+    // Links created by remove() to compensate links to the removed node.
+    std::uint64_t repair_links = 0;
+    // Rehashes of the nodes table, both growing and shrinking.
+    std::uint64_t rehashes = 0;
+    std::chrono::nanoseconds insert_time {0};
+    std::chrono::nanoseconds remove_time {0};
+    std::chrono::nanoseconds search_time {0};
+};
+
+
+namespace detail {
+
+
+// Relaxed atomic counter. Unlike std::atomic it's copyable, so that the index stays copyable.
+class relaxed_counter_t {
+public:
+    relaxed_counter_t() noexcept:
+        m_value(0)
+    { }
+
+    relaxed_counter_t(const relaxed_counter_t &other) noexcept:
+        m_value(other.load())
+    { }
+
+    relaxed_counter_t &operator=(const relaxed_counter_t &other) noexcept {
+        m_value.store(other.load(), std::memory_order_relaxed);
+        return *this;
+    }
+
+    void add(std::uint64_t value) noexcept {
+        m_value.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    std::uint64_t load() const noexcept {
+        return m_value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<std::uint64_t> m_value;
+};
+
+
+struct index_counters_t {
+    relaxed_counter_t inserts;
+    relaxed_counter_t removes;
+    relaxed_counter_t searches;
+    relaxed_counter_t distance_computations;
+    relaxed_counter_t repair_links;
+    relaxed_counter_t rehashes;
+    relaxed_counter_t insert_time;
+    relaxed_counter_t remove_time;
+    relaxed_counter_t search_time;
+
+    index_stats_t snapshot() const {
+        index_stats_t result;
+        result.inserts = inserts.load();
+        result.removes = removes.load();
+        result.searches = searches.load();
+        result.distance_computations = distance_computations.load();
+        result.repair_links = repair_links.load();
+        result.rehashes = rehashes.load();
+        result.insert_time = std::chrono::nanoseconds(insert_time.load());
+        result.remove_time = std::chrono::nanoseconds(remove_time.load());
+        result.search_time = std::chrono::nanoseconds(search_time.load());
+        return result;
+    }
+};
+
+
+// Adds time of its life to the counter.
+class operation_timer_t {
+public:
+    explicit operation_timer_t(relaxed_counter_t &counter):
+        m_counter(counter),
+        m_start(std::chrono::steady_clock::now())
+    { }
+
+    ~operation_timer_t() {
+        auto elapsed = std::chrono::steady_clock::now() - m_start;
+        m_counter.add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+
+    operation_timer_t(const operation_timer_t &) = delete;
+    operation_timer_t &operator=(const operation_timer_t &) = delete;
+
+private:
+    relaxed_counter_t &m_counter;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+
+// Counts distance computations and forwards all events to the wrapped statistics.
+template<class Stats>
+struct counting_stats_t {
+    Stats &wrapped;
+    std::uint64_t distance_computations;
+
+    void on_hop(std::size_t layer) {
+        wrapped.on_hop(layer);
+    }
+
+    void on_distance() {
+        ++distance_computations;
+        wrapped.on_distance();
+    }
+
+    void on_visited(std::size_t visited) {
+        wrapped.on_visited(visited);
+    }
+
+    void on_search_front(std::size_t size) {
+        wrapped.on_search_front(size);
+    }
+};
+
+
+}
+
+
+}
@@ -16,14 +16,23 @@
 #pragma once
 
 #include "index.hpp"
+#include "serialization.hpp"
 
-#include "containers/hopscotch-map-1.4.0/src/hopscotch_map.h"
+#include "containers/key_table.hpp"
 
 #include "detail/undef_hopscotch_macros.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <istream>
 #include <limits>
+#include <ostream>
 #include <random>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 
 namespace hnsw {
@@ -37,64 +46,236 @@ public:
     using scalar_t = typename Index::scalar_t;
     using vector_t = typename Index::vector_t;
     using index_t = Index;
+    // Internal keys used to be random, Random is needed to read snapshots of that time.
     using random_t = Random;
+    using allocator_t = typename Index::allocator_t;
+    using compaction_t = typename Index::compaction_t;
+
+    // Internal keys are dense and internal keys of removed keys are reused, see key_table.
+    using keys_t = key_table<key_t, internal_key_t, typename Index::template allocator_for_t<key_t>>;
+
+    // key_t, or a view of the key table for std::basic_string keys.
+    using key_view_t = typename keys_t::key_view_type;
 
     static_assert(std::is_integral<internal_key_t>::value, "Cannot map on non-integral keys.");
 
+    // Views in results are valid until the next insert(), compact() or load().
     struct search_result_t {
-        key_t key;
+        key_view_t key;
         scalar_t distance;
     };
 
-    random_t random;
     index_t index;
-    tsl::hopscotch_map<key_t, internal_key_t> key_to_internal;
-    tsl::hopscotch_map<internal_key_t, key_t> internal_to_key;
+    keys_t keys;
 
 public:
+    key_mapper() = default;
+
+    // The allocator is used by the index and the key table.
+    explicit key_mapper(const allocator_t &allocator):
+        index(allocator),
+        keys(typename keys_t::allocator_type(allocator))
+    { }
+
+    // See hnsw_index::reserve(). The key table is reserved too.
+    void reserve(std::size_t keys_number) {
+        index.reserve(keys_number);
+        keys.reserve(keys_number);
+    }
+
     void insert(const key_t &key, const vector_t &vector) {
         insert(key, vector_t(vector));
     }
 
     void insert(const key_t &key, vector_t &&vector) {
-        auto internal_key = allocate_internal_key();
+        auto inserted = keys.insert(key);
 
-        if (!key_to_internal.emplace(key, internal_key).second) {
+        if (!inserted.second) {
             throw std::runtime_error("key_mapper::insert: key already exists");
         }
 
-        internal_to_key.emplace(internal_key, key);
-        index.insert(internal_key, std::move(vector));
+        try {
+            index.insert(inserted.first, std::move(vector));
+        } catch (...) {
+            keys.erase(inserted.first);
+            throw;
+        }
     }
 
     void remove(const key_t &key) {
-        auto key_it = key_to_internal.find(key);
+        auto internal_key = keys.find(key);
 
-        if (key_it == key_to_internal.end()) {
+        if (!internal_key) {
             return;
         }
 
-        index.remove(key_it->second);
-        internal_to_key.erase(key_it->second);
-        key_to_internal.erase(key_it);
+        // The table isn't shrunk here, see hnsw_index::remove().
+        auto removed = *internal_key;
+        index.remove(removed);
+        keys.erase(removed);
+    }
+
+    template<class Query = vector_t>
+    std::vector<search_result_t> search(const Query &target, std::size_t nearest_neighbors) const {
+        return convert_search_results(index.search(target, nearest_neighbors));
+    }
 
-        // Shrink hash tables when they become too sparse
-        // (to reduce memory usage and ensure linear complexity for iteration).
-        if (4 * internal_to_key.load_factor() < internal_to_key.max_load_factor()) {
-            internal_to_key.rehash(size_t(2 * internal_to_key.size() / internal_to_key.max_load_factor()));
-        }
+    template<class Query = vector_t>
+    std::vector<search_result_t> search(const Query &target, std::size_t nearest_neighbors, std::size_t ef) const {
+        return convert_search_results(index.search(target, nearest_neighbors, ef));
+    }
 
-        if (4 * key_to_internal.load_factor() < key_to_internal.max_load_factor()) {
-            key_to_internal.rehash(size_t(2 * key_to_internal.size() / key_to_internal.max_load_factor()));
+    template<class Query, class Stats>
+    std::vector<search_result_t> search(const Query &target, std::size_t nearest_neighbors, std::size_t ef, Stats &stats) const {
+        return convert_search_results(index.search(target, nearest_neighbors, ef, stats));
+    }
+
+    // Two-phase search, see hnsw_index::search_reranked(). vector_of takes keys of the mapper.
+    template<class Query, class ExactQuery, class VectorOf, class ExactDistance>
+    auto search_reranked(const Query &target,
+                         const ExactQuery &exact_target,
+                         std::size_t nearest_neighbors,
+                         std::size_t rerank_k,
+                         VectorOf &&vector_of,
+                         const ExactDistance &exact_distance) const
+    {
+        auto internal_vector_of = [&](const internal_key_t &key) -> decltype(auto) {
+            return vector_of(keys.key(key));
+        };
+
+        return convert_reranked_results(
+            index.search_reranked(target, exact_target, nearest_neighbors, rerank_k, internal_vector_of, exact_distance)
+        );
+    }
+
+    template<class Query, class ExactQuery, class VectorOf, class ExactDistance, class Stats>
+    auto search_reranked(const Query &target,
+                         const ExactQuery &exact_target,
+                         std::size_t nearest_neighbors,
+                         std::size_t rerank_k,
+                         std::size_t ef,
+                         VectorOf &&vector_of,
+                         const ExactDistance &exact_distance,
+                         Stats &stats) const
+    {
+        auto internal_vector_of = [&](const internal_key_t &key) -> decltype(auto) {
+            return vector_of(keys.key(key));
+        };
+
+        return convert_reranked_results(
+            index.search_reranked(target, exact_target, nearest_neighbors, rerank_k, ef, internal_vector_of, exact_distance, stats)
+        );
+    }
+
+    std::size_t autotune(const std::vector<vector_t> &sample_queries, std::size_t nearest_neighbors, double target_recall) {
+        return index.autotune(sample_queries, nearest_neighbors, target_recall);
+    }
+
+    // See hnsw_index::compact(). The key table is shrunk too, which invalidates views of keys.
+    void compact() {
+        auto compaction = start_compaction();
+        compact(compaction, std::chrono::steady_clock::duration::max());
+    }
+
+    compaction_t start_compaction() const {
+        return index.start_compaction();
+    }
+
+    bool compact(compaction_t &compaction, std::chrono::steady_clock::duration time_budget) {
+        if (!index.compact(compaction, time_budget)) {
+            return false;
         }
+
+        keys.compact();
+        detail::release_free_memory();
+        return true;
     }
 
-    std::vector<search_result_t> search(const vector_t &target, std::size_t nearest_neighbors) const {
-        return convert_search_results(index.search(target, nearest_neighbors));
+    // Write the mapping and the index to the stream in a binary format.
+    void save(std::ostream &stream) const {
+        detail::stream_writer_t writer(stream);
+
+        detail::write_header(writer, "HNSWMAP", 2);
+        index.save(stream);
+
+        detail::write_value(writer, std::uint64_t(keys.internal_size()));
+        detail::write_value(writer, std::uint64_t(keys.size()));
+
+        for (const auto &internal_key: keys) {
+            detail::write_value(writer, keys.key(internal_key));
+            detail::write_value(writer, internal_key);
+        }
+
+        detail::write_value(writer, std::uint64_t(keys.free_keys().size()));
+
+        for (const auto &internal_key: keys.free_keys()) {
+            detail::write_value(writer, internal_key);
+        }
     }
 
-    std::vector<search_result_t> search(const vector_t &target, std::size_t nearest_neighbors, std::size_t ef) const {
-        return convert_search_results(index.search(target, nearest_neighbors, ef));
+    /** Replace content of the mapper with the one written by save().
+     *  The index is decoded by `threads` threads, see hnsw_index::load().
+     *
+     *  Snapshots of the first version have random internal keys, so the index is converted to dense ones.
+     */
+    void load(std::istream &stream, std::size_t threads = 0) {
+        detail::stream_reader_t reader(stream);
+
+        auto version = detail::read_header(reader, "HNSWMAP", 2);
+
+        if (version == 1) {
+            random_t random;
+            detail::read_random(reader, random);
+        }
+
+        index_t new_index(index.get_allocator());
+        new_index.load(stream, threads);
+
+        auto internal_keys_number = (version == 1) ? 0 : detail::read_value<std::uint64_t>(reader);
+        auto keys_number = reader.checked_size(detail::read_value<std::uint64_t>(reader), sizeof(internal_key_t));
+
+        std::vector<std::pair<key_t, internal_key_t>> pairs(keys_number);
+
+        for (auto &pair: pairs) {
+            detail::read_value(reader, pair.first);
+            detail::read_value(reader, pair.second);
+        }
+
+        if (new_index.nodes.size() != keys_number) {
+            throw std::runtime_error("key_mapper::load: the stream is corrupted, wrong number of keys");
+        }
+
+        if (version == 1) {
+            internal_keys_number = keys_number;
+            make_dense(new_index, pairs);
+        }
+
+        auto free_keys_number = (version == 1) ? 0 : detail::read_value<std::uint64_t>(reader);
+
+        if (internal_keys_number != keys_number + free_keys_number ||
+            (internal_keys_number > 0 && internal_keys_number - 1 > std::uint64_t(std::numeric_limits<internal_key_t>::max())))
+        {
+            throw std::runtime_error("key_mapper::load: the stream is corrupted, wrong number of internal keys");
+        }
+
+        std::vector<internal_key_t> free_keys(reader.checked_size(free_keys_number, sizeof(internal_key_t)));
+
+        for (auto &internal_key: free_keys) {
+            detail::read_value(reader, internal_key);
+        }
+
+        keys_t new_keys(keys.get_allocator());
+
+        try {
+            new_keys.assign(std::size_t(internal_keys_number), pairs.begin(), pairs.end(), free_keys.begin(), free_keys.end());
+        } catch (const std::runtime_error &error) {
+            throw std::runtime_error(std::string("key_mapper::load: the stream is corrupted, ") + error.what());
+        }
+
+        new_index.counters = index.counters;
+
+        index = std::move(new_index);
+        keys = std::move(new_keys);
     }
 
     bool check() const {
@@ -102,51 +283,64 @@ public:
             return false;
         }
 
-        for (const auto &key: key_to_internal) {
-            auto it = internal_to_key.find(key.second);
+        if (index.nodes.size() != keys.size() || keys.internal_size() != keys.size() + keys.free_keys().size()) {
+            return false;
+        }
 
-            if (it == internal_to_key.end()) {
-                return false;
-            }
+        std::vector<bool> used(keys.internal_size(), false);
 
-            if (it->second != key.first) {
+        for (const auto &internal_key: keys) {
+            if (std::size_t(internal_key) >= keys.internal_size()) {
                 return false;
             }
-        }
 
-        for (const auto &internal: internal_to_key) {
-            auto it = key_to_internal.find(internal.second);
+            auto found = keys.find(key_t(keys.key(internal_key)));
 
-            if (it == key_to_internal.end()) {
+            if (!found || *found != internal_key || index.nodes.count(internal_key) == 0) {
                 return false;
             }
 
-            if (it->second != internal.first) {
-                return false;
-            }
+            used[internal_key] = true;
+        }
 
-            if (index.nodes.count(internal.first) == 0) {
+        for (const auto &internal_key: keys.free_keys()) {
+            if (std::size_t(internal_key) >= keys.internal_size() || used[internal_key]) {
                 return false;
             }
+
+            used[internal_key] = true;
         }
 
         return true;
     }
 
 private:
-    internal_key_t allocate_internal_key() {
-        std::uniform_int_distribution<internal_key_t> generator(
-            std::numeric_limits<internal_key_t>::min(),
-            std::numeric_limits<internal_key_t>::max()
-        );
+    // Map random internal keys of a snapshot of the first version on 0, 1, 2, ... in their order.
+    static void make_dense(index_t &index, std::vector<std::pair<key_t, internal_key_t>> &pairs) {
+        std::vector<internal_key_t> sparse;
+        sparse.reserve(pairs.size());
 
-        internal_key_t new_key = generator(random);
-
-        while (internal_to_key.count(new_key) != 0) {
-            ++new_key;
+        for (const auto &pair: pairs) {
+            sparse.push_back(pair.second);
         }
 
-        return new_key;
+        std::sort(sparse.begin(), sparse.end());
+
+        auto dense = [&sparse](const internal_key_t &internal_key) {
+            auto it = std::lower_bound(sparse.begin(), sparse.end(), internal_key);
+
+            if (it == sparse.end() || *it != internal_key) {
+                throw std::runtime_error("key_mapper::load: the stream is corrupted, unknown internal key");
+            }
+
+            return internal_key_t(it - sparse.begin());
+        };
+
+        index.rename_keys(dense);
+
+        for (auto &pair: pairs) {
+            pair.second = dense(pair.second);
+        }
     }
 
     std::vector<search_result_t>
@@ -156,7 +350,23 @@ private:
 
         for (const auto &x: internal_result) {
             result.push_back({
-                internal_to_key.at(x.key),
+                keys.key(x.key),
+                x.distance
+            });
+        }
+
+        return result;
+    }
+
+    template<class Scalar>
+    std::vector<reranked_result_t<key_view_t, Scalar>>
+    convert_reranked_results(const std::vector<reranked_result_t<internal_key_t, Scalar>> &internal_result) const {
+        std::vector<reranked_result_t<key_view_t, Scalar>> result;
+        result.reserve(internal_result.size());
+
+        for (const auto &x: internal_result) {
+            result.push_back({
+                keys.key(x.key),
                 x.distance
             });
         }
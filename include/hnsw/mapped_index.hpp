@@ -0,0 +1,765 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "containers/hopscotch-map-1.4.0/src/hopscotch_map.h"
+#include "detail/frozen_format.hpp"
+#include "detail/graph_search.hpp"
+#include "detail/mapped_file.hpp"
+#include "huge_pages.hpp"
+#include "options.hpp"
+#include "prefetch.hpp"
+#include "reorder.hpp"
+#include "search_stats.hpp"
+#include "serialization.hpp"
+#include "vector_view.hpp"
+
+#include "detail/undef_hopscotch_macros.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+namespace hnsw {
+
+
+namespace detail {
+
+
+template<class Vector>
+using vector_element_t = std::remove_cv_t<std::remove_reference_t<decltype(*std::declval<const Vector &>().data())>>;
+
+
+// Dense ids of the frozen index: the entry point first, then other nodes by the number of layers descending,
+// so that nodes of each layer are a prefix of ids. Nodes with the same number of layers are ordered by `method`.
+template<class Index>
+std::vector<typename Index::key_t> frozen_order(const Index &index, reorder_method_t method) {
+    using key_t = typename Index::key_t;
+
+    std::vector<key_t> order;
+    std::vector<std::size_t> level_ends;
+    order.reserve(index.nodes.size());
+
+    if (index.nodes.empty()) {
+        return order;
+    }
+
+    // (layers, key) pairs sort by the number of layers descending and by key within a level.
+    std::vector<std::pair<std::size_t, key_t>> levels;
+    levels.reserve(index.nodes.size());
+
+    for (const auto &node: index.nodes) {
+        levels.emplace_back(node.second.layers.size(), node.first);
+    }
+
+    std::sort(levels.begin(), levels.end(), [](const auto &one, const auto &another) {
+        return one.first > another.first || (one.first == another.first && one.second < another.second);
+    });
+
+    for (std::size_t i = 0; i < levels.size(); ++i) {
+        order.push_back(levels[i].second);
+
+        if (i + 1 == levels.size() || levels[i + 1].first != levels[i].first) {
+            level_ends.push_back(i + 1);
+        }
+    }
+
+    std::iter_swap(order.begin(), std::find(order.begin(), order.begin() + level_ends.front(), index.top_keys.front()));
+    std::sort(order.begin() + 1, order.begin() + level_ends.front());
+
+    if (method == reorder_method_t::none) {
+        return order;
+    }
+
+    auto locality = locality_order(order, [&index](const key_t &key, std::vector<key_t> &links) {
+        for (const auto &link: index.nodes.at(key).layers.front().outgoing) {
+            links.push_back(link.first);
+        }
+    }, method);
+
+    tsl::hopscotch_map<key_t, std::size_t> rank;
+    rank.reserve(locality.size());
+
+    for (std::size_t i = 0; i < locality.size(); ++i) {
+        rank.emplace(locality[i], i);
+    }
+
+    auto by_rank = [&rank](const key_t &one, const key_t &another) {
+        return rank.at(one) < rank.at(another);
+    };
+
+    // The entry point stays first.
+    std::size_t level_begin = 1;
+
+    for (auto level_end: level_ends) {
+        std::sort(order.begin() + level_begin, order.begin() + level_end, by_rank);
+        level_begin = level_end;
+    }
+
+    return order;
+}
+
+
+template<class Writer>
+void write_padding(Writer &writer, std::uint64_t &offset, std::uint64_t new_offset) {
+    static const char zeros[frozen_alignment] = {};
+
+    while (offset < new_offset) {
+        auto size = std::min<std::uint64_t>(new_offset - offset, sizeof(zeros));
+        writer.write(zeros, size);
+        offset += size;
+    }
+}
+
+
+// Writes an image to a descriptor. The magic is written last, so readers reject the image until it's complete.
+class image_writer_t {
+public:
+    explicit image_writer_t(int fd):
+        m_fd(fd)
+    { }
+
+    void write(const void *data, std::size_t size) {
+        const char *bytes = static_cast<const char *>(data);
+
+        if (m_offset < sizeof(m_magic)) {
+            auto held = std::min<std::size_t>(size, sizeof(m_magic) - std::size_t(m_offset));
+            std::memcpy(m_magic + m_offset, bytes, held);
+
+            static const char zeros[sizeof(m_magic)] = {};
+            write_at(zeros, held, m_offset);
+            bytes += held;
+            size -= held;
+        }
+
+        write_at(bytes, size, m_offset);
+    }
+
+    void finish() {
+        std::uint64_t offset = 0;
+        write_at(m_magic, sizeof(m_magic), offset);
+    }
+
+private:
+    void write_at(const char *data, std::size_t size, std::uint64_t &offset) {
+        while (size > 0) {
+            auto written = ::pwrite(m_fd, data, size, off_t(offset));
+
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (written < 0) {
+                throw system_error("image_writer_t: failed to write");
+            }
+
+            data += written;
+            size -= std::size_t(written);
+            offset += std::uint64_t(written);
+        }
+    }
+
+private:
+    int m_fd;
+    std::uint64_t m_offset = 0;
+    char m_magic[8] = {};
+};
+
+
+template<class Index, class Writer>
+void write_frozen(const Index &index, Writer &writer, reorder_method_t method) {
+    using key_t = typename Index::key_t;
+    using element_t = detail::vector_element_t<typename Index::vector_t>;
+
+    static_assert(std::is_trivially_copyable<key_t>::value, "freeze: keys must be trivially copyable");
+    static_assert(std::is_trivially_copyable<element_t>::value, "freeze: vector elements must be trivially copyable");
+
+    if (index.nodes.size() >= std::numeric_limits<std::uint32_t>::max()) {
+        throw std::runtime_error("freeze: too many nodes for the frozen format");
+    }
+
+    auto order = detail::frozen_order(index, method);
+
+    tsl::hopscotch_map<key_t, std::uint32_t> ids;
+    ids.reserve(order.size());
+
+    for (size_t i = 0; i < order.size(); ++i) {
+        ids.emplace(order[i], std::uint32_t(i));
+    }
+
+    std::uint64_t layers_number = order.empty() ? 0 : index.nodes.at(order.front()).layers.size();
+    std::uint64_t dimension = order.empty() ? 0 : index.nodes.at(order.front()).vector.size();
+
+    detail::frozen_header_t header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "HNSWFRZ", sizeof(header.magic));
+    header.version = detail::frozen_version;
+    header.byte_order = 0x01020304;
+    header.key_size = sizeof(key_t);
+    header.element_size = sizeof(element_t);
+    header.nodes = order.size();
+    header.layers = layers_number;
+    header.dimension = dimension;
+    header.max_links = index.options.max_links;
+    header.search_termination = std::uint64_t(index.options.search_termination);
+    header.max_unproductive_hops = index.options.max_unproductive_hops;
+    header.tuned_ef_number = index.tuned_ef.size();
+    header.vector_stride = dimension * sizeof(element_t);
+
+    std::uint64_t offset = detail::frozen_align(sizeof(header));
+
+    header.tuned_ef_offset = offset;
+    offset = detail::frozen_align(offset + 2 * sizeof(std::uint64_t) * index.tuned_ef.size());
+
+    header.keys_offset = offset;
+    offset = detail::frozen_align(offset + sizeof(key_t) * order.size());
+
+    header.layers_offset = offset;
+    offset = detail::frozen_align(offset + sizeof(detail::frozen_layer_t) * layers_number);
+
+    std::vector<detail::frozen_layer_t> layers(layers_number);
+
+    for (size_t layer = 0; layer < layers_number; ++layer) {
+        std::uint64_t links_number = 0;
+        std::uint64_t layer_nodes = 0;
+
+        for (; layer_nodes < order.size(); ++layer_nodes) {
+            const auto &node = index.nodes.at(order[layer_nodes]);
+
+            if (node.layers.size() <= layer) {
+                break;
+            }
+
+            if (node.vector.size() != dimension) {
+                throw std::runtime_error("freeze: vectors have different sizes");
+            }
+
+            links_number += node.layers[layer].outgoing.size();
+        }
+
+        layers[layer].nodes = layer_nodes;
+        layers[layer].offsets_offset = offset;
+        offset = detail::frozen_align(offset + sizeof(std::uint64_t) * (layer_nodes + 1));
+        layers[layer].links_offset = offset;
+        offset = detail::frozen_align(offset + sizeof(std::uint32_t) * links_number);
+    }
+
+    header.vectors_offset = offset;
+    header.image_size = offset + header.vector_stride * order.size();
+
+    offset = 0;
+
+    writer.write(&header, sizeof(header));
+    offset += sizeof(header);
+
+    detail::write_padding(writer, offset, header.tuned_ef_offset);
+
+    for (const auto &ef: index.tuned_ef) {
+        std::uint64_t pair[2] = {ef.first, ef.second};
+        writer.write(pair, sizeof(pair));
+        offset += sizeof(pair);
+    }
+
+    detail::write_padding(writer, offset, header.keys_offset);
+
+    for (const auto &key: order) {
+        writer.write(&key, sizeof(key));
+        offset += sizeof(key);
+    }
+
+    detail::write_padding(writer, offset, header.layers_offset);
+
+    if (!layers.empty()) {
+        writer.write(layers.data(), sizeof(detail::frozen_layer_t) * layers.size());
+        offset += sizeof(detail::frozen_layer_t) * layers.size();
+    }
+
+    std::vector<std::uint32_t> links;
+
+    for (size_t layer = 0; layer < layers_number; ++layer) {
+        detail::write_padding(writer, offset, layers[layer].offsets_offset);
+
+        std::uint64_t links_offset = 0;
+
+        for (size_t id = 0; id < layers[layer].nodes; ++id) {
+            writer.write(&links_offset, sizeof(links_offset));
+            links_offset += index.nodes.at(order[id]).layers[layer].outgoing.size();
+        }
+
+        writer.write(&links_offset, sizeof(links_offset));
+        offset += sizeof(std::uint64_t) * (layers[layer].nodes + 1);
+
+        detail::write_padding(writer, offset, layers[layer].links_offset);
+
+        for (size_t id = 0; id < layers[layer].nodes; ++id) {
+            links.clear();
+
+            for (const auto &link: index.nodes.at(order[id]).layers[layer].outgoing) {
+                links.push_back(ids.at(link.first));
+            }
+
+            // Neighbors in the order of their location in memory.
+            std::sort(links.begin(), links.end());
+
+            writer.write(links.data(), sizeof(std::uint32_t) * links.size());
+            offset += sizeof(std::uint32_t) * links.size();
+        }
+    }
+
+    detail::write_padding(writer, offset, header.vectors_offset);
+
+    for (const auto &key: order) {
+        writer.write(index.nodes.at(key).vector.data(), header.vector_stride);
+        offset += header.vector_stride;
+    }
+}
+
+
+}
+
+
+/** Write the index in the frozen format, which can be served by mapped_hnsw_index without deserialization.
+ *
+ *  Keys and vector elements must be trivially copyable, all vectors must have the same size,
+ *  and the index must have less than 2^32 nodes. Nodes are placed in the image in the order given by `method`.
+ */
+template<class Index>
+void freeze(const Index &index, std::ostream &stream, reorder_method_t method = reorder_method_t::bfs) {
+    detail::stream_writer_t writer(stream);
+    detail::write_frozen(index, writer, method);
+}
+
+
+/** Freeze the index into a POSIX shared memory object, so that many processes can serve one physical copy of it
+ *  with mapped_hnsw_index::shared(). Name starts with a slash, like "/my-index".
+ *
+ *  An existing object with the same name is replaced. Processes which have already mapped it keep using the old image,
+ *  its memory is freed when the last of them unmaps it. Opening the object fails until the new image is written completely.
+ *  The object lives until unlink_shared() or a reboot.
+ */
+template<class Index>
+void publish_shared(const Index &index, const std::string &name, reorder_method_t method = reorder_method_t::bfs) {
+    ::shm_unlink(name.c_str());
+
+    int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+
+    if (fd < 0) {
+        throw detail::system_error("publish_shared: failed to create shared memory " + name);
+    }
+
+    try {
+        detail::image_writer_t writer(fd);
+        detail::write_frozen(index, writer, method);
+        writer.finish();
+    } catch (...) {
+        ::close(fd);
+        ::shm_unlink(name.c_str());
+        throw;
+    }
+
+    ::close(fd);
+}
+
+
+// Remove the shared memory object created by publish_shared().
+inline void unlink_shared(const std::string &name) {
+    if (::shm_unlink(name.c_str()) != 0) {
+        throw detail::system_error("unlink_shared: failed to remove shared memory " + name);
+    }
+}
+
+
+/** Read-only HNSW index over an image written by `freeze`.
+ *
+ *  The image is used in place: opening a file only maps it into memory and validates the header,
+ *  so it takes constant time, and pages are loaded by the kernel when searches touch them.
+ *  Opening checks that all sections lie within the image, but not the links inside them:
+ *  call check() before searching an image which may be corrupted or comes from an untrusted source,
+ *  otherwise a bad offset or link makes searches read out of bounds.
+ *  Searches work exactly as in hnsw_index. Vectors are passed as vector_view,
+ *  which is implicitly constructible from std::vector.
+ *
+ *  Key and Element must match the key type and the vector element type of the frozen index.
+ *  Distance is the same functor as the one used by the frozen index.
+ */
+template<class Key, class Element, class Distance>
+class mapped_hnsw_index {
+public:
+    using key_t = Key;
+    using element_t = Element;
+    using vector_t = vector_view<Element>;
+    using distance_t = Distance;
+    using scalar_t = decltype(std::declval<Distance>()(std::declval<vector_t>(), std::declval<vector_t>()));
+
+    struct search_result_t {
+        key_t key;
+        scalar_t distance;
+    };
+
+    distance_t distance;
+
+public:
+    // Map the file into memory.
+    explicit mapped_hnsw_index(const std::string &path):
+        m_file(path)
+    {
+        attach(m_file.data(), m_file.size());
+    }
+
+    // Map the shared memory object written by publish_shared(). The pages are shared by all processes which map it.
+    static mapped_hnsw_index shared(const std::string &name) {
+        return mapped_hnsw_index(detail::mapped_file_t::shared(name));
+    }
+
+    /** Read the file into memory backed by huge pages.
+     *
+     *  Unlike mapping, this takes time to read the whole image, but then searches take neither page faults
+     *  nor TLB misses on every other node. huge_page_mode() reports which kind of pages the index got.
+     */
+    static mapped_hnsw_index load(const std::string &path, const huge_page_options_t &options = huge_page_options_t()) {
+        std::ifstream input(path, std::ios::binary);
+
+        if (!input) {
+            throw std::runtime_error("mapped_hnsw_index::load: failed to open " + path);
+        }
+
+        input.seekg(0, std::ios::end);
+        auto size = std::size_t(input.tellg());
+        input.seekg(0, std::ios::beg);
+
+        huge_page_region_t memory(size, options);
+
+        if (!input.read(memory.data(), std::streamsize(size))) {
+            throw std::runtime_error("mapped_hnsw_index::load: failed to read " + path);
+        }
+
+        return mapped_hnsw_index(std::move(memory), size);
+    }
+
+    // Use the image in memory owned by the caller. It must outlive the index and be aligned to 8 bytes.
+    mapped_hnsw_index(const void *image, std::size_t size) {
+        attach(static_cast<const char *>(image), size);
+    }
+
+    mapped_hnsw_index(const mapped_hnsw_index &) = delete;
+    mapped_hnsw_index &operator=(const mapped_hnsw_index &) = delete;
+
+    mapped_hnsw_index(mapped_hnsw_index &&) = default;
+    mapped_hnsw_index &operator=(mapped_hnsw_index &&) = default;
+
+    std::size_t size() const {
+        return m_header->nodes;
+    }
+
+    huge_page_mode_t huge_page_mode() const {
+        return m_memory.mode();
+    }
+
+    std::size_t dimension() const {
+        return m_header->dimension;
+    }
+
+    const key_t &key(std::uint32_t id) const {
+        return m_keys[id];
+    }
+
+    vector_t vector(std::uint32_t id) const {
+        return vector_t(reinterpret_cast<const element_t *>(m_vectors + id * m_header->vector_stride), m_header->dimension);
+    }
+
+    std::vector<search_result_t> search(const vector_t &target, std::size_t nearest_neighbors) const {
+        return search(target, nearest_neighbors, default_ef(nearest_neighbors));
+    }
+
+    std::vector<search_result_t> search(const vector_t &target, std::size_t nearest_neighbors, std::size_t ef) const {
+        no_search_stats_t stats;
+        return search(target, nearest_neighbors, ef, stats);
+    }
+
+    template<class Stats>
+    std::vector<search_result_t> search(const vector_t &target, std::size_t nearest_neighbors, std::size_t ef, Stats &stats) const {
+        if (size() == 0) {
+            return {};
+        }
+
+        if (target.size() != dimension()) {
+            throw std::runtime_error("mapped_hnsw_index::search: wrong size of the target vector");
+        }
+
+        std::uint32_t start = 0;
+
+        for (std::size_t layer = m_layers.size(); layer > 0; --layer) {
+            start = detail::greedy_search(graph_t {*this}, target, layer - 1, start, stats);
+        }
+
+        detail::early_termination_t termination {nearest_neighbors, 0};
+
+        if (m_header->search_termination == std::uint64_t(index_options_t::search_termination_t::adaptive)) {
+            termination.max_unproductive_hops = m_header->max_unproductive_hops;
+        }
+
+        detail::priority_queue<detail::furthest_queue_t<std::uint32_t, scalar_t>> results;
+        detail::search_level(graph_t {*this}, target, std::max(nearest_neighbors, ef), 0, {start}, results, stats, termination);
+
+        auto nearest = detail::take_nearest<std::pair<std::uint32_t, scalar_t>>(results, nearest_neighbors);
+
+        std::vector<search_result_t> results_vector;
+        results_vector.reserve(nearest.size());
+
+        for (const auto &result: nearest) {
+            results_vector.push_back({m_keys[result.first], result.second});
+        }
+
+        return results_vector;
+    }
+
+    // Check the whole image for consistency. Unlike the checks done on opening, it reads all links,
+    // so that searches stay within the image.
+    bool check() const {
+        for (std::size_t layer = 0; layer < m_layers.size(); ++layer) {
+            const auto &layer_view = m_layers[layer];
+
+            for (std::size_t id = 0; id < layer_view.nodes; ++id) {
+                if (layer_view.offsets[id] > layer_view.offsets[id + 1] ||
+                    layer_view.offsets[id + 1] > layer_view.offsets[layer_view.nodes])
+                {
+                    return false;
+                }
+
+                for (const auto &link: links(std::uint32_t(id), layer)) {
+                    // Self-links are not allowed, and links must point to nodes present on the layer.
+                    if (link == id || link >= layer_view.nodes) {
+                        return false;
+                    }
+                }
+            }
+        }
+
+        return true;
+    }
+
+private:
+    explicit mapped_hnsw_index(detail::mapped_file_t file):
+        m_file(std::move(file))
+    {
+        attach(m_file.data(), m_file.size());
+    }
+
+    mapped_hnsw_index(huge_page_region_t memory, std::size_t size):
+        m_memory(std::move(memory))
+    {
+        attach(m_memory.data(), size);
+    }
+
+    struct layer_view_t {
+        std::size_t nodes;
+        const std::uint64_t *offsets;
+        const std::uint32_t *links;
+    };
+
+    struct links_range_t {
+        using const_iterator = const std::uint32_t *;
+        using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+        const std::uint32_t *m_begin;
+        const std::uint32_t *m_end;
+
+        const_iterator begin() const {
+            return m_begin;
+        }
+
+        const_iterator end() const {
+            return m_end;
+        }
+
+        const_reverse_iterator rbegin() const {
+            return const_reverse_iterator(m_end);
+        }
+
+        const_reverse_iterator rend() const {
+            return const_reverse_iterator(m_begin);
+        }
+    };
+
+    // Accessor for the search algorithms from graph_search.hpp.
+    struct graph_t {
+        using key_t = std::uint32_t;
+        using scalar_t = typename mapped_hnsw_index::scalar_t;
+
+        const mapped_hnsw_index &index;
+
+        std::size_t size() const {
+            return index.size();
+        }
+
+        std::size_t max_links(std::size_t layer) const {
+            return (layer == 0) ? (2 * index.m_header->max_links) : index.m_header->max_links;
+        }
+
+        links_range_t links(key_t node, std::size_t layer) const {
+            return index.links(node, layer);
+        }
+
+        key_t link_key(key_t link) const {
+            return link;
+        }
+
+        scalar_t distance(const vector_t &target, key_t node) const {
+            return index.distance(target, index.vector(node));
+        }
+
+        void prefetch(key_t node) const {
+            hnsw::prefetch<vector_t>::pref(index.vector(node));
+        }
+    };
+
+private:
+    links_range_t links(std::uint32_t node, std::size_t layer) const {
+        const auto &layer_view = m_layers[layer];
+        return {layer_view.links + layer_view.offsets[node], layer_view.links + layer_view.offsets[node + 1]};
+    }
+
+    std::size_t default_ef(std::size_t nearest_neighbors) const {
+        auto tuned_it = m_tuned_ef.lower_bound(nearest_neighbors);
+
+        if (tuned_it != m_tuned_ef.end()) {
+            return tuned_it->second;
+        }
+
+        return 100 + nearest_neighbors;
+    }
+
+    template<class T>
+    const T *section(std::uint64_t offset, std::uint64_t count) const {
+        if (offset % alignof(T) != 0 ||
+            offset > m_size ||
+            count > (m_size - offset) / sizeof(T))
+        {
+            throw std::runtime_error("mapped_hnsw_index: the image is corrupted, a section is out of bounds");
+        }
+
+        return reinterpret_cast<const T *>(m_data + offset);
+    }
+
+    void attach(const char *image, std::size_t size) {
+        m_data = image;
+        m_size = size;
+
+        if (reinterpret_cast<std::uintptr_t>(image) % alignof(std::uint64_t) != 0) {
+            throw std::runtime_error("mapped_hnsw_index: the image is not aligned");
+        }
+
+        m_header = section<detail::frozen_header_t>(0, 1);
+
+        if (std::memcmp(m_header->magic, "HNSWFRZ", sizeof(m_header->magic)) != 0) {
+            throw std::runtime_error("mapped_hnsw_index: unknown format");
+        }
+
+        if (m_header->version != detail::frozen_version) {
+            throw std::runtime_error("mapped_hnsw_index: unsupported format version " + std::to_string(m_header->version));
+        }
+
+        if (m_header->byte_order != 0x01020304) {
+            throw std::runtime_error("mapped_hnsw_index: the image was written with another byte order");
+        }
+
+        if (m_header->key_size != sizeof(key_t) || m_header->element_size != sizeof(element_t)) {
+            throw std::runtime_error("mapped_hnsw_index: the image was written for other key or vector types");
+        }
+
+        if (m_header->image_size > m_size) {
+            throw std::runtime_error("mapped_hnsw_index: the image is truncated");
+        }
+
+        if ((m_header->nodes == 0) != (m_header->layers == 0) ||
+            m_header->vector_stride != multiply(m_header->dimension, sizeof(element_t)))
+        {
+            throw std::runtime_error("mapped_hnsw_index: the image is corrupted, inconsistent header");
+        }
+
+        const auto *tuned_ef = section<std::uint64_t>(m_header->tuned_ef_offset, multiply(m_header->tuned_ef_number, 2));
+
+        for (std::size_t i = 0; i < m_header->tuned_ef_number; ++i) {
+            m_tuned_ef[tuned_ef[2 * i]] = tuned_ef[2 * i + 1];
+        }
+
+        // Bounds the number of nodes by the size of the image, so that layer_nodes + 1 below doesn't overflow.
+        m_keys = section<key_t>(m_header->keys_offset, m_header->nodes);
+
+        const auto *layers = section<detail::frozen_layer_t>(m_header->layers_offset, m_header->layers);
+        m_layers.clear();
+        m_layers.reserve(m_header->layers);
+
+        for (std::size_t layer = 0; layer < m_header->layers; ++layer) {
+            auto layer_nodes = layers[layer].nodes;
+            auto previous_nodes = (layer == 0) ? m_header->nodes : m_layers.back().nodes;
+
+            if (layer_nodes == 0 || layer_nodes > previous_nodes || (layer == 0 && layer_nodes != m_header->nodes)) {
+                throw std::runtime_error("mapped_hnsw_index: the image is corrupted, wrong number of nodes on a layer");
+            }
+
+            const auto *offsets = section<std::uint64_t>(layers[layer].offsets_offset, layer_nodes + 1);
+
+            if (offsets[0] != 0) {
+                throw std::runtime_error("mapped_hnsw_index: the image is corrupted, wrong links offsets");
+            }
+
+            const auto *links = section<std::uint32_t>(layers[layer].links_offset, offsets[layer_nodes]);
+            m_layers.push_back({layer_nodes, offsets, links});
+        }
+
+        m_vectors = reinterpret_cast<const char *>(section<element_t>(m_header->vectors_offset, multiply(m_header->nodes, m_header->dimension)));
+    }
+
+    // Sizes in the header are arbitrary in a corrupted image, so their products must not wrap around.
+    static std::uint64_t multiply(std::uint64_t a, std::uint64_t b) {
+        if (a != 0 && b > std::numeric_limits<std::uint64_t>::max() / a) {
+            throw std::runtime_error("mapped_hnsw_index: the image is corrupted, sizes are too large");
+        }
+
+        return a * b;
+    }
+
+private:
+    detail::mapped_file_t m_file;
+    huge_page_region_t m_memory;
+    const char *m_data = nullptr;
+    std::size_t m_size = 0;
+    const detail::frozen_header_t *m_header = nullptr;
+    const key_t *m_keys = nullptr;
+    const char *m_vectors = nullptr;
+    std::vector<layer_view_t> m_layers;
+    std::map<std::size_t, std::size_t> m_tuned_ef;
+};
+
+
+}
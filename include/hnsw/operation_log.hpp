@@ -0,0 +1,325 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "detail/crc32.hpp"
+#include "detail/mapped_file.hpp"
+#include "serialization.hpp"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace hnsw {
+
+
+struct operation_log_options_t {
+    // Records are buffered in memory and written to the file in groups of this many records
+    // or bytes, whichever comes first, or when commit() is called.
+    std::size_t group_records = 64;
+    std::size_t group_bytes = 1 << 20;
+
+    // Sync the file to the disk after writing each group.
+    // Without it written records survive a crash of the process, but not of the machine.
+    bool sync = true;
+};
+
+
+namespace detail {
+
+
+enum class log_record_t : std::uint8_t {
+    insert = 1,
+    remove = 2
+};
+
+
+constexpr std::size_t log_header_size = 16;
+constexpr std::size_t log_record_header_size = 8;
+
+
+// Calls handler(type, reader) for each intact record and returns the size of the intact part of the log.
+// Reading stops at the first incomplete or corrupted record, which is what a crash during a write leaves.
+template<class Handler>
+std::uint64_t scan_log(const std::string &path, Handler &&handler) {
+    std::ifstream input(path, std::ios::binary);
+
+    if (!input) {
+        throw std::runtime_error("scan_log: failed to open " + path);
+    }
+
+    input.seekg(0, std::ios::end);
+    std::uint64_t file_size = std::uint64_t(input.tellg());
+    input.seekg(0, std::ios::beg);
+
+    stream_reader_t reader(input);
+    read_header(reader, "HNSWLOG", 1);
+
+    std::uint64_t valid_size = log_header_size;
+    std::vector<char> payload;
+
+    while (true) {
+        std::uint32_t header[2];
+
+        if (!input.read(reinterpret_cast<char *>(header), sizeof(header))) {
+            break;
+        }
+
+        // A torn size must not cause a huge allocation.
+        if (header[0] == 0 || header[0] > file_size - valid_size - sizeof(header)) {
+            break;
+        }
+
+        payload.resize(header[0]);
+
+        if (!input.read(payload.data(), std::streamsize(payload.size())) ||
+            crc32(payload.data(), payload.size()) != header[1])
+        {
+            break;
+        }
+
+        memory_reader_t payload_reader(payload.data() + 1, payload.size() - 1);
+        handler(log_record_t(payload.front()), payload_reader);
+
+        valid_size += sizeof(header) + payload.size();
+    }
+
+    return valid_size;
+}
+
+
+}
+
+
+/** Append-only log of inserts and removes, which together with a snapshot made by save()
+ *  allows to restore the index after a crash.
+ *
+ *  Log each successful insert() and remove() of the index, save the index from time to time and reset() the log
+ *  after that. On start load() the latest snapshot and replay() the log onto it.
+ *
+ *  Index is hnsw_index or key_mapper, its keys and vectors must be supported by `serializer`.
+ *  The log is not thread-safe, just like modifications of the index.
+ */
+template<class Index>
+class operation_log {
+public:
+    using key_t = typename Index::key_t;
+    using vector_t = typename Index::vector_t;
+
+    // Open the log for appending, creating it if needed. A torn tail left by a crash is cut off.
+    explicit operation_log(const std::string &path, operation_log_options_t options = operation_log_options_t()):
+        m_options(options)
+    {
+        m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+
+        if (m_fd < 0) {
+            throw detail::system_error("operation_log: failed to open " + path);
+        }
+
+        try {
+            struct stat file_stat;
+
+            if (::fstat(m_fd, &file_stat) != 0) {
+                throw detail::system_error("operation_log: failed to stat " + path);
+            }
+
+            // A crash during creation may leave an incomplete header.
+            if (file_stat.st_size < off_t(detail::log_header_size)) {
+                truncate(0);
+
+                detail::buffer_writer_t writer(m_buffer);
+                detail::write_header(writer, "HNSWLOG", 1);
+                flush();
+            } else {
+                m_size = detail::scan_log(path, [](detail::log_record_t, detail::memory_reader_t &) { });
+                truncate(m_size);
+            }
+        } catch (...) {
+            ::close(m_fd);
+            throw;
+        }
+    }
+
+    // Commits pending records. Call commit() explicitly to get errors.
+    ~operation_log() {
+        try {
+            commit();
+        } catch (...) {
+        }
+
+        ::close(m_fd);
+    }
+
+    operation_log(const operation_log &) = delete;
+    operation_log &operator=(const operation_log &) = delete;
+
+    void insert(const key_t &key, const vector_t &vector) {
+        auto record_begin = begin_record(detail::log_record_t::insert);
+        detail::buffer_writer_t writer(m_buffer);
+        detail::write_value(writer, key);
+        detail::write_value(writer, vector);
+        end_record(record_begin);
+    }
+
+    void remove(const key_t &key) {
+        auto record_begin = begin_record(detail::log_record_t::remove);
+        detail::buffer_writer_t writer(m_buffer);
+        detail::write_value(writer, key);
+        end_record(record_begin);
+    }
+
+    // Write pending records to the file and sync it if configured.
+    void commit() {
+        if (m_pending_records > 0) {
+            flush();
+        }
+    }
+
+    // Drop all records. Call it when the state of the index is saved to a snapshot.
+    void reset() {
+        m_buffer.clear();
+        m_pending_records = 0;
+        truncate(detail::log_header_size);
+    }
+
+    std::size_t pending_records() const {
+        return m_pending_records;
+    }
+
+private:
+    std::size_t begin_record(detail::log_record_t type) {
+        auto record_begin = m_buffer.size();
+        m_buffer.resize(record_begin + detail::log_record_header_size);
+        m_buffer.push_back(char(type));
+        return record_begin;
+    }
+
+    void end_record(std::size_t record_begin) {
+        std::uint32_t header[2];
+        header[0] = std::uint32_t(m_buffer.size() - record_begin - detail::log_record_header_size);
+        header[1] = detail::crc32(m_buffer.data() + record_begin + detail::log_record_header_size, header[0]);
+        std::memcpy(m_buffer.data() + record_begin, header, sizeof(header));
+
+        ++m_pending_records;
+
+        if (m_pending_records >= m_options.group_records || m_buffer.size() >= m_options.group_bytes) {
+            flush();
+        }
+    }
+
+    // If a write fails, the part which is already in the file is dropped from the buffer,
+    // so that the next flush continues right after it.
+    void flush() {
+        std::size_t done = 0;
+
+        while (done < m_buffer.size()) {
+            auto written = ::pwrite(m_fd, m_buffer.data() + done, m_buffer.size() - done, off_t(m_size));
+
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (written < 0) {
+                auto error = detail::system_error("operation_log: failed to write");
+                m_buffer.erase(m_buffer.begin(), m_buffer.begin() + std::ptrdiff_t(done));
+                throw error;
+            }
+
+            done += std::size_t(written);
+            m_size += std::uint64_t(written);
+        }
+
+        m_buffer.clear();
+        m_pending_records = 0;
+
+        if (m_options.sync) {
+            sync();
+        }
+    }
+
+    void truncate(std::uint64_t size) {
+        if (::ftruncate(m_fd, off_t(size)) != 0) {
+            throw detail::system_error("operation_log: failed to truncate");
+        }
+
+        m_size = size;
+        sync();
+    }
+
+    void sync() {
+#if defined(__linux__)
+        int result = ::fdatasync(m_fd);
+#else
+        int result = ::fsync(m_fd);
+#endif
+
+        if (result != 0) {
+            throw detail::system_error("operation_log: failed to sync");
+        }
+    }
+
+private:
+    operation_log_options_t m_options;
+    int m_fd = -1;
+    // Size of the data in the file.
+    std::uint64_t m_size = 0;
+    std::vector<char> m_buffer;
+    std::size_t m_pending_records = 0;
+};
+
+
+/** Apply operations from the log to the index and return how many of them were applied.
+ *
+ *  Replaying is idempotent: an insert replaces a node with the same key, and removal of a missing key does nothing.
+ *  So a log which wasn't reset after the latest snapshot can be replayed onto it safely.
+ */
+template<class Index>
+std::size_t replay(const std::string &path, Index &index) {
+    std::size_t applied = 0;
+
+    detail::scan_log(path, [&](detail::log_record_t type, detail::memory_reader_t &reader) {
+        typename Index::key_t key;
+        detail::read_value(reader, key);
+
+        if (type == detail::log_record_t::insert) {
+            typename Index::vector_t vector;
+            detail::read_value(reader, vector);
+            index.remove(key);
+            index.insert(key, std::move(vector));
+        } else if (type == detail::log_record_t::remove) {
+            index.remove(key);
+        } else {
+            throw std::runtime_error("replay: unknown record type in the log");
+        }
+
+        ++applied;
+    });
+
+    return applied;
+}
+
+
+}
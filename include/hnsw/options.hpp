@@ -38,6 +38,17 @@ struct index_options_t {
     };
 
     remove_method_t remove_method = remove_method_t::compensate_incomming_links;
+
+    enum class search_termination_t {
+        // Stop when the closest unexpanded candidate is further than the worst of ef results.
+        exhaustive,
+        // Also stop after max_unproductive_hops consecutive expansions which didn't improve
+        // the requested nearest neighbors. Saves distance computations on easy queries.
+        adaptive
+    };
+
+    search_termination_t search_termination = search_termination_t::exhaustive;
+    std::size_t max_unproductive_hops = 64;
 };
 
 
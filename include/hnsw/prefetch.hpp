@@ -15,6 +15,9 @@
 
 #pragma once
 
+#include "vector_view.hpp"
+
+#include <cstdint>
 #include <vector>
 
 #if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
@@ -47,6 +50,20 @@ struct prefetch<std::vector<double>, void> {
         _mm_prefetch(v.data(), _MM_HINT_T0);
     }
 };
+
+template<>
+struct prefetch<std::vector<std::uint64_t>, void> {
+    static void pref(const std::vector<std::uint64_t> &v) {
+        _mm_prefetch(reinterpret_cast<const char *>(v.data()), _MM_HINT_T0);
+    }
+};
+
+template<class T>
+struct prefetch<vector_view<T>, void> {
+    static void pref(const vector_view<T> &v) {
+        _mm_prefetch(reinterpret_cast<const char *>(v.data()), _MM_HINT_T0);
+    }
+};
 #endif
 
 
@@ -0,0 +1,396 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "detail/parallel.hpp"
+#include "quantized_codes.hpp"
+#include "serialization.hpp"
+#include "vector_view.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <ostream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+
+namespace hnsw {
+
+
+// Vector encoded by pq_quantizer_t: one centroid number per subspace. pq_codes_t<Subspaces> keeps them inline.
+template<std::size_t Subspaces = 0>
+using pq_codes_t = quantized_codes<Subspaces>;
+
+// Codes with the number of subspaces chosen at runtime, see quantized_codes<> for its overhead.
+using pq_vector_t = pq_codes_t<>;
+
+
+// Query prepared by pq_quantizer_t::query(): squared distances from its subvectors to all centroids of the subspaces.
+struct pq_query_t {
+    std::vector<float> table;
+    std::size_t centroids = 0;
+};
+
+
+/** Squared L2 distance for vectors encoded by pq_quantizer_t, get it from pq_quantizer_t::l2_distance().
+ *
+ *  A query is compared with codes by summing its lookup table entries (asymmetric distance computation),
+ *  and two codes are compared through precomputed distances between centroids.
+ *  Both are approximations of distances between the original vectors.
+ */
+struct pq_l2_distance_t {
+    std::size_t centroids = 0;
+    // Squared distances between all pairs of centroids of each subspace. Shared, because the index copies its distance.
+    std::shared_ptr<const std::vector<float>> centroid_distances;
+
+    template<class Codes>
+    float operator()(const pq_query_t &query, const Codes &codes) const {
+        if (query.table.size() != codes.size() * query.centroids) {
+            throw std::runtime_error("pq_l2_distance_t: vectors sizes do not match");
+        }
+
+        const float *table = query.table.data();
+        const std::uint8_t *data = codes.data();
+        std::size_t size = codes.size();
+
+        // Independent sums hide latency of the lookups.
+        float sums[4] = {0, 0, 0, 0};
+        std::size_t i = 0;
+
+        for (; i + 4 <= size; i += 4) {
+            sums[0] += table[(i + 0) * query.centroids + data[i + 0]];
+            sums[1] += table[(i + 1) * query.centroids + data[i + 1]];
+            sums[2] += table[(i + 2) * query.centroids + data[i + 2]];
+            sums[3] += table[(i + 3) * query.centroids + data[i + 3]];
+        }
+
+        for (; i < size; ++i) {
+            sums[0] += table[i * query.centroids + data[i]];
+        }
+
+        return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+    }
+
+    template<class Codes>
+    float operator()(const Codes &one, const Codes &another) const {
+        if (!centroid_distances ||
+            one.size() != another.size() ||
+            centroid_distances->size() != one.size() * centroids * centroids)
+        {
+            throw std::runtime_error("pq_l2_distance_t: vectors sizes do not match");
+        }
+
+        const float *table = centroid_distances->data();
+        float sum = 0;
+
+        for (std::size_t i = 0; i < one.size(); ++i) {
+            sum += table[(i * centroids + one.data()[i]) * centroids + another.data()[i]];
+        }
+
+        return sum;
+    }
+};
+
+
+/** Product quantizer: splits vectors into equal subvectors and encodes each one by the nearest of up to 256 centroids,
+ *  which are learned by k-means on a sample of vectors.
+ *
+ *  Use hnsw_index<Key, pq_codes_t<M>, pq_l2_distance_t> for M subspaces, set its `distance` to l2_distance(),
+ *  insert encode<pq_codes_t<M>>()-d vectors and search with query()-es. Then a vector takes one byte per subspace.
+ *  pq_vector_t works for any number of subspaces, but each vector also takes a std::vector header and a heap block.
+ *  Distances are rough, so search for several times more results than needed and rerank() them with the original vectors.
+ */
+class pq_quantizer_t {
+public:
+    /** Learn centroids from the sample. The dimension must be divisible by the number of subspaces,
+     *  and the sample must have at least `centroids` vectors. Subspaces are trained by `threads` threads, 0 means one per core.
+     */
+    template<class Vectors>
+    void train(const Vectors &sample,
+               std::size_t subspaces,
+               std::size_t centroids = 256,
+               std::size_t iterations = 25,
+               std::size_t threads = 0)
+    {
+        if (sample.empty() || subspaces == 0 || centroids == 0 || centroids > 256) {
+            throw std::runtime_error("pq_quantizer_t::train: wrong parameters");
+        }
+
+        std::vector<vector_view<float>> vectors(sample.begin(), sample.end());
+        auto dimension = vectors.front().size();
+
+        if (dimension % subspaces != 0) {
+            throw std::runtime_error("pq_quantizer_t::train: the dimension is not divisible by the number of subspaces");
+        }
+
+        if (vectors.size() < centroids) {
+            throw std::runtime_error("pq_quantizer_t::train: the sample is smaller than the number of centroids");
+        }
+
+        for (const auto &vector: vectors) {
+            if (vector.size() != dimension) {
+                throw std::runtime_error("pq_quantizer_t::train: vectors sizes do not match");
+            }
+        }
+
+        m_dimension = dimension;
+        m_subspaces = subspaces;
+        m_centroids = centroids;
+        m_codebooks.assign(dimension * centroids, 0);
+
+        detail::parallel_for(subspaces, threads == 0 ? detail::default_threads() : threads, [&](std::size_t subspace) {
+            train_subspace(vectors, subspace, iterations);
+        });
+    }
+
+    std::size_t dimension() const {
+        return m_dimension;
+    }
+
+    std::size_t subspaces() const {
+        return m_subspaces;
+    }
+
+    std::size_t centroids() const {
+        return m_centroids;
+    }
+
+    // Codes is pq_vector_t or pq_codes_t<subspaces()>.
+    template<class Codes = pq_vector_t>
+    Codes encode(vector_view<float> vector) const {
+        check_size(vector.size());
+
+        Codes result;
+        result.resize(m_subspaces);
+
+        for (std::size_t subspace = 0; subspace < m_subspaces; ++subspace) {
+            result[subspace] = std::uint8_t(nearest_centroid(vector.data() + subspace * subdimension(), subspace));
+        }
+
+        return result;
+    }
+
+    template<class Codes>
+    std::vector<float> decode(const Codes &vector) const {
+        if (vector.size() != m_subspaces) {
+            throw std::runtime_error("pq_quantizer_t: wrong size of the vector");
+        }
+
+        std::vector<float> result(m_dimension);
+
+        for (std::size_t subspace = 0; subspace < m_subspaces; ++subspace) {
+            const float *centroid = this->centroid(subspace, vector[subspace]);
+            std::copy(centroid, centroid + subdimension(), result.begin() + subspace * subdimension());
+        }
+
+        return result;
+    }
+
+    // Build the lookup table of the query. It takes as much work as computing distances to all centroids once.
+    pq_query_t query(vector_view<float> vector) const {
+        check_size(vector.size());
+
+        pq_query_t result;
+        result.centroids = m_centroids;
+        result.table.resize(m_subspaces * m_centroids);
+
+        for (std::size_t subspace = 0; subspace < m_subspaces; ++subspace) {
+            for (std::size_t centroid = 0; centroid < m_centroids; ++centroid) {
+                result.table[subspace * m_centroids + centroid] =
+                    l2(vector.data() + subspace * subdimension(), this->centroid(subspace, centroid), subdimension());
+            }
+        }
+
+        return result;
+    }
+
+    pq_l2_distance_t l2_distance() const {
+        auto distances = std::make_shared<std::vector<float>>(m_subspaces * m_centroids * m_centroids);
+
+        for (std::size_t subspace = 0; subspace < m_subspaces; ++subspace) {
+            for (std::size_t one = 0; one < m_centroids; ++one) {
+                for (std::size_t another = 0; another < m_centroids; ++another) {
+                    (*distances)[(subspace * m_centroids + one) * m_centroids + another] =
+                        l2(centroid(subspace, one), centroid(subspace, another), subdimension());
+                }
+            }
+        }
+
+        pq_l2_distance_t result;
+        result.centroids = m_centroids;
+        result.centroid_distances = std::move(distances);
+        return result;
+    }
+
+    void save(std::ostream &stream) const {
+        detail::stream_writer_t writer(stream);
+        detail::write_header(writer, "HNSWPQ8", 1);
+        detail::write_value(writer, std::uint64_t(m_dimension));
+        detail::write_value(writer, std::uint64_t(m_subspaces));
+        detail::write_value(writer, std::uint64_t(m_centroids));
+        detail::write_value(writer, m_codebooks);
+    }
+
+    void load(std::istream &stream) {
+        detail::stream_reader_t reader(stream);
+        detail::read_header(reader, "HNSWPQ8", 1);
+
+        auto dimension = detail::read_value<std::uint64_t>(reader);
+        auto subspaces = detail::read_value<std::uint64_t>(reader);
+        auto centroids = detail::read_value<std::uint64_t>(reader);
+
+        std::vector<float> codebooks;
+        detail::read_value(reader, codebooks);
+
+        if (subspaces == 0 ||
+            dimension % subspaces != 0 ||
+            centroids == 0 ||
+            centroids > 256 ||
+            codebooks.size() != dimension * centroids)
+        {
+            throw std::runtime_error("pq_quantizer_t::load: the stream is corrupted");
+        }
+
+        m_dimension = dimension;
+        m_subspaces = subspaces;
+        m_centroids = centroids;
+        m_codebooks = std::move(codebooks);
+    }
+
+private:
+    static float l2(const float *one, const float *another, std::size_t size) {
+        float sum = 0;
+
+        for (std::size_t i = 0; i < size; ++i) {
+            float diff = one[i] - another[i];
+            sum += diff * diff;
+        }
+
+        return sum;
+    }
+
+    std::size_t subdimension() const {
+        return m_dimension / m_subspaces;
+    }
+
+    // Codebooks are stored by subspace, then by centroid.
+    float *centroid(std::size_t subspace, std::size_t centroid) {
+        return m_codebooks.data() + (subspace * m_centroids + centroid) * subdimension();
+    }
+
+    const float *centroid(std::size_t subspace, std::size_t centroid) const {
+        return m_codebooks.data() + (subspace * m_centroids + centroid) * subdimension();
+    }
+
+    std::size_t nearest_centroid(const float *subvector, std::size_t subspace) const {
+        std::size_t nearest = 0;
+        float nearest_distance = std::numeric_limits<float>::max();
+
+        for (std::size_t centroid = 0; centroid < m_centroids; ++centroid) {
+            float distance = l2(subvector, this->centroid(subspace, centroid), subdimension());
+
+            if (distance < nearest_distance) {
+                nearest = centroid;
+                nearest_distance = distance;
+            }
+        }
+
+        return nearest;
+    }
+
+    // Lloyd's k-means, initialized by distinct random vectors of the sample.
+    void train_subspace(const std::vector<vector_view<float>> &vectors, std::size_t subspace, std::size_t iterations) {
+        auto size = subdimension();
+        auto offset = subspace * size;
+
+        std::minstd_rand random(std::minstd_rand::result_type(subspace + 1));
+
+        std::vector<std::size_t> order(vectors.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::shuffle(order.begin(), order.end(), random);
+
+        for (std::size_t centroid = 0; centroid < m_centroids; ++centroid) {
+            const float *subvector = vectors[order[centroid]].data() + offset;
+            std::copy(subvector, subvector + size, this->centroid(subspace, centroid));
+        }
+
+        std::vector<std::size_t> assignment(vectors.size());
+        std::vector<double> sums(m_centroids * size);
+        std::vector<std::size_t> counts(m_centroids);
+
+        for (std::size_t iteration = 0; iteration < iterations; ++iteration) {
+            bool changed = false;
+
+            for (std::size_t i = 0; i < vectors.size(); ++i) {
+                auto nearest = nearest_centroid(vectors[i].data() + offset, subspace);
+                changed = changed || iteration == 0 || nearest != assignment[i];
+                assignment[i] = nearest;
+            }
+
+            if (!changed) {
+                break;
+            }
+
+            std::fill(sums.begin(), sums.end(), 0.0);
+            std::fill(counts.begin(), counts.end(), 0);
+
+            for (std::size_t i = 0; i < vectors.size(); ++i) {
+                const float *subvector = vectors[i].data() + offset;
+                ++counts[assignment[i]];
+
+                for (std::size_t j = 0; j < size; ++j) {
+                    sums[assignment[i] * size + j] += subvector[j];
+                }
+            }
+
+            for (std::size_t centroid = 0; centroid < m_centroids; ++centroid) {
+                float *values = this->centroid(subspace, centroid);
+
+                if (counts[centroid] == 0) {
+                    // Move an empty cluster to a random vector.
+                    const float *subvector = vectors[random() % vectors.size()].data() + offset;
+                    std::copy(subvector, subvector + size, values);
+                    continue;
+                }
+
+                for (std::size_t j = 0; j < size; ++j) {
+                    values[j] = float(sums[centroid * size + j] / counts[centroid]);
+                }
+            }
+        }
+    }
+
+    void check_size(std::size_t size) const {
+        if (size != m_dimension || m_dimension == 0) {
+            throw std::runtime_error("pq_quantizer_t: wrong size of the vector");
+        }
+    }
+
+private:
+    std::size_t m_dimension = 0;
+    std::size_t m_subspaces = 0;
+    std::size_t m_centroids = 0;
+    std::vector<float> m_codebooks;
+};
+
+
+}
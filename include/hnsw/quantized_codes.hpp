@@ -0,0 +1,126 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "prefetch.hpp"
+#include "serialization.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+
+namespace hnsw {
+
+
+/** Codes of a quantized vector, one byte each.
+ *
+ *  quantized_codes<Size> keeps exactly Size bytes inline, so the codes are all a node of the index spends on its vector.
+ *  It's trivially copyable and is saved as raw bytes.
+ *
+ *  quantized_codes<> takes the number of codes at runtime and keeps them in a std::vector,
+ *  which adds a 24 bytes header and a heap block of at least 32 bytes to each vector.
+ *  Use it when the number of codes isn't known at compile time, or when it's large enough for that not to matter.
+ */
+template<std::size_t Size = 0>
+struct quantized_codes {
+    std::array<std::uint8_t, Size> codes;
+
+    std::uint8_t *data() {
+        return codes.data();
+    }
+
+    const std::uint8_t *data() const {
+        return codes.data();
+    }
+
+    std::size_t size() const {
+        return Size;
+    }
+
+    void resize(std::size_t size) {
+        if (size != Size) {
+            throw std::runtime_error("quantized_codes::resize: the number of codes is fixed");
+        }
+    }
+
+    std::uint8_t &operator[](std::size_t i) {
+        return codes[i];
+    }
+
+    const std::uint8_t &operator[](std::size_t i) const {
+        return codes[i];
+    }
+};
+
+
+template<>
+struct quantized_codes<0> {
+    std::vector<std::uint8_t> codes;
+
+    std::uint8_t *data() {
+        return codes.data();
+    }
+
+    const std::uint8_t *data() const {
+        return codes.data();
+    }
+
+    std::size_t size() const {
+        return codes.size();
+    }
+
+    void resize(std::size_t size) {
+        codes.resize(size);
+    }
+
+    std::uint8_t &operator[](std::size_t i) {
+        return codes[i];
+    }
+
+    const std::uint8_t &operator[](std::size_t i) const {
+        return codes[i];
+    }
+};
+
+
+template<>
+struct serializer<quantized_codes<0>, void> {
+    template<class Writer>
+    static void write(Writer &writer, const quantized_codes<0> &value) {
+        serializer<std::vector<std::uint8_t>>::write(writer, value.codes);
+    }
+
+    template<class Reader>
+    static void read(Reader &reader, quantized_codes<0> &value) {
+        serializer<std::vector<std::uint8_t>>::read(reader, value.codes);
+    }
+};
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+template<std::size_t Size>
+struct prefetch<quantized_codes<Size>, void> {
+    static void pref(const quantized_codes<Size> &v) {
+        _mm_prefetch(reinterpret_cast<const char *>(v.data()), _MM_HINT_T0);
+    }
+};
+#endif
+
+
+}
@@ -0,0 +1,118 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "containers/hopscotch-map-1.4.0/src/hopscotch_map.h"
+
+#include "detail/undef_hopscotch_macros.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+
+namespace hnsw {
+
+
+// Order of nodes in memory. Graph neighbors placed close to each other share cache lines and pages during searches.
+enum class reorder_method_t {
+    // Keep the order: by level, then by key.
+    none,
+    // Breadth-first search from the entry point on the bottom layer.
+    bfs,
+    // Reverse Cuthill-McKee: breadth-first search which visits neighbors with fewer links first, reversed.
+    reverse_cuthill_mckee
+};
+
+
+namespace detail {
+
+
+/** Locality-improving order of the keys.
+ *
+ *  keys are all nodes of the graph, the search starts from the first one. Nodes unreachable from it are appended
+ *  by further searches in the order of keys. links_of(key, out) fills `out` with neighbors of the key on the bottom layer.
+ */
+template<class Key, class LinksOf>
+std::vector<Key> locality_order(const std::vector<Key> &keys, LinksOf &&links_of, reorder_method_t method) {
+    if (method == reorder_method_t::none) {
+        return keys;
+    }
+
+    tsl::hopscotch_map<Key, std::size_t> degrees;
+
+    if (method == reorder_method_t::reverse_cuthill_mckee) {
+        std::vector<Key> links;
+        degrees.reserve(keys.size());
+
+        for (const auto &key: keys) {
+            links.clear();
+            links_of(key, links);
+            degrees.emplace(key, links.size());
+        }
+    }
+
+    std::vector<Key> order;
+    order.reserve(keys.size());
+
+    tsl::hopscotch_map<Key, bool> visited;
+    visited.reserve(keys.size());
+
+    std::deque<Key> queue;
+    std::vector<Key> links;
+
+    for (const auto &root: keys) {
+        if (!visited.emplace(root, true).second) {
+            continue;
+        }
+
+        queue.push_back(root);
+
+        while (!queue.empty()) {
+            auto key = queue.front();
+            queue.pop_front();
+            order.push_back(key);
+
+            links.clear();
+            links_of(key, links);
+
+            if (method == reorder_method_t::reverse_cuthill_mckee) {
+                std::stable_sort(links.begin(), links.end(), [&](const Key &one, const Key &another) {
+                    return degrees.at(one) < degrees.at(another);
+                });
+            }
+
+            for (const auto &link: links) {
+                if (visited.emplace(link, true).second) {
+                    queue.push_back(link);
+                }
+            }
+        }
+    }
+
+    if (method == reorder_method_t::reverse_cuthill_mckee) {
+        std::reverse(order.begin(), order.end());
+    }
+
+    return order;
+}
+
+
+}
+
+
+}
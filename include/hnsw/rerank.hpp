@@ -0,0 +1,105 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "prefetch.hpp"
+#include "search_stats.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+namespace hnsw {
+
+
+// Search result with the exact distance, which may have another type than the approximate one.
+template<class Key, class Scalar>
+struct reranked_result_t {
+    Key key;
+    Scalar distance;
+};
+
+
+template<class Key, class Target, class VectorOf, class Distance>
+using reranked_result_for_t = reranked_result_t<
+    Key,
+    std::decay_t<decltype(std::declval<const Distance &>()(std::declval<const Target &>(), std::declval<VectorOf &>()(std::declval<const Key &>())))>
+>;
+
+
+/** Recompute distances of search results with exact vectors and keep the nearest_neighbors nearest of them.
+ *
+ *  Use it after a search over compressed vectors, which was asked for a few times more results than needed.
+ *  vector_of(key) returns the exact vector of the key, which may be stored anywhere, e.g. in a mapped file.
+ *  distance(target, vector) is the exact distance. Each exact distance is reported to stats.on_distance().
+ */
+template<class SearchResult, class Target, class VectorOf, class Distance, class Stats>
+std::vector<reranked_result_for_t<decltype(SearchResult::key), Target, VectorOf, Distance>>
+rerank(const std::vector<SearchResult> &results,
+       std::size_t nearest_neighbors,
+       const Target &target,
+       VectorOf &&vector_of,
+       const Distance &distance,
+       Stats &stats)
+{
+    using result_t = reranked_result_for_t<decltype(SearchResult::key), Target, VectorOf, Distance>;
+    using vector_t = std::decay_t<decltype(vector_of(results.front().key))>;
+
+    std::vector<result_t> reranked;
+    reranked.reserve(results.size());
+
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        // Exact vectors are usually cold, so fetch the next one while computing the current distance.
+        if (i + 1 < results.size()) {
+            prefetch<vector_t>::pref(vector_of(results[i + 1].key));
+        }
+
+        reranked.push_back({results[i].key, distance(target, vector_of(results[i].key))});
+        stats.on_distance();
+    }
+
+    auto closer = [](const result_t &one, const result_t &another) {
+        return one.distance < another.distance;
+    };
+
+    if (reranked.size() > nearest_neighbors) {
+        std::partial_sort(reranked.begin(), reranked.begin() + nearest_neighbors, reranked.end(), closer);
+        reranked.resize(nearest_neighbors);
+    } else {
+        std::sort(reranked.begin(), reranked.end(), closer);
+    }
+
+    return reranked;
+}
+
+
+template<class SearchResult, class Target, class VectorOf, class Distance>
+std::vector<reranked_result_for_t<decltype(SearchResult::key), Target, VectorOf, Distance>>
+rerank(const std::vector<SearchResult> &results,
+       std::size_t nearest_neighbors,
+       const Target &target,
+       VectorOf &&vector_of,
+       const Distance &distance)
+{
+    no_search_stats_t stats;
+    return rerank(results, nearest_neighbors, target, std::forward<VectorOf>(vector_of), distance, stats);
+}
+
+
+}
@@ -0,0 +1,228 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "detail/sq8_dist.hpp"
+#include "quantized_codes.hpp"
+#include "serialization.hpp"
+#include "vector_view.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+
+namespace hnsw {
+
+
+// Vector quantized by sq8_quantizer_t: one byte per dimension. sq8_codes_t<Dimension> keeps them inline.
+template<std::size_t Dimension = 0>
+using sq8_codes_t = quantized_codes<Dimension>;
+
+// Codes with the dimension chosen at runtime, see quantized_codes<> for its overhead.
+using sq8_vector_t = sq8_codes_t<>;
+
+
+// Float query prepared by sq8_quantizer_t::query() for asymmetric distances to quantized vectors.
+struct sq8_query_t {
+    std::vector<float> values;
+
+    const float *data() const {
+        return values.data();
+    }
+
+    std::size_t size() const {
+        return values.size();
+    }
+};
+
+
+/** Squared L2 distance for vectors quantized by sq8_quantizer_t, get it from sq8_quantizer_t::l2_distance().
+ *
+ *  Distances are computed from the codes, without decoding, and are approximations of distances between the original vectors.
+ *  A float query is compared with the codes (asymmetric distance, used by searches),
+ *  and two quantized vectors are compared with each other when the index is built.
+ */
+struct sq8_l2_distance_t {
+    // Squared quantization steps of dimensions.
+    std::vector<float> weights;
+
+    template<class Codes>
+    float operator()(const sq8_query_t &query, const Codes &codes) const {
+        check_size(query.size(), codes.size());
+        return detail::sq8_l2_asymmetric(query.data(), weights.data(), codes.data(), codes.size());
+    }
+
+    template<class Codes>
+    float operator()(const Codes &one, const Codes &another) const {
+        check_size(one.size(), another.size());
+        return detail::sq8_l2_symmetric(weights.data(), one.data(), another.data(), one.size());
+    }
+
+private:
+    void check_size(std::size_t one, std::size_t another) const {
+        if (one != weights.size() || another != weights.size()) {
+            throw std::runtime_error("sq8_l2_distance_t: vectors sizes do not match");
+        }
+    }
+};
+
+
+/** Scalar quantizer, which maps each dimension of float vectors linearly from its [min, max] range onto 256 levels.
+ *
+ *  Use hnsw_index<Key, sq8_codes_t<D>, sq8_l2_distance_t> for D dimensions, set its `distance` to l2_distance(),
+ *  insert encode<sq8_codes_t<D>>()-d vectors and search with query()-es. The codes take 4 times less memory than floats.
+ *  sq8_vector_t works for any dimension, but like std::vector<float> it adds a header and a heap block to each vector,
+ *  so the saving is smaller for short vectors.
+ *  Use rerank() to refine results with the original vectors.
+ */
+class sq8_quantizer_t {
+public:
+    // Compute ranges of dimensions from a sample of vectors. Values out of the ranges are clamped by encode().
+    template<class Vectors>
+    void train(const Vectors &sample) {
+        if (sample.empty()) {
+            throw std::runtime_error("sq8_quantizer_t::train: empty sample");
+        }
+
+        auto dimension = vector_view<float>(*sample.begin()).size();
+        std::vector<float> min(dimension, std::numeric_limits<float>::max());
+        std::vector<float> max(dimension, std::numeric_limits<float>::lowest());
+
+        for (const auto &item: sample) {
+            vector_view<float> vector(item);
+
+            if (vector.size() != dimension) {
+                throw std::runtime_error("sq8_quantizer_t::train: vectors sizes do not match");
+            }
+
+            for (std::size_t i = 0; i < dimension; ++i) {
+                min[i] = std::min(min[i], vector[i]);
+                max[i] = std::max(max[i], vector[i]);
+            }
+        }
+
+        m_min = std::move(min);
+        m_step.resize(dimension);
+
+        for (std::size_t i = 0; i < dimension; ++i) {
+            // A constant dimension gets a unit step, so that distances to queries off the constant stay correct.
+            m_step[i] = (max[i] > m_min[i]) ? (max[i] - m_min[i]) / 255 : 1;
+        }
+    }
+
+    std::size_t dimension() const {
+        return m_min.size();
+    }
+
+    // Codes is sq8_vector_t or sq8_codes_t<dimension()>.
+    template<class Codes = sq8_vector_t>
+    Codes encode(vector_view<float> vector) const {
+        check_size(vector.size());
+
+        Codes result;
+        result.resize(vector.size());
+
+        for (std::size_t i = 0; i < vector.size(); ++i) {
+            float level = std::round((vector[i] - m_min[i]) / m_step[i]);
+            result[i] = std::uint8_t(std::min(255.0f, std::max(0.0f, level)));
+        }
+
+        return result;
+    }
+
+    template<class Codes>
+    std::vector<float> decode(const Codes &vector) const {
+        check_size(vector.size());
+
+        std::vector<float> result(vector.size());
+
+        for (std::size_t i = 0; i < vector.size(); ++i) {
+            result[i] = m_min[i] + m_step[i] * vector[i];
+        }
+
+        return result;
+    }
+
+    // The query isn't rounded, so only the searched vectors contribute quantization error.
+    sq8_query_t query(vector_view<float> vector) const {
+        check_size(vector.size());
+
+        sq8_query_t result;
+        result.values.resize(vector.size());
+
+        for (std::size_t i = 0; i < vector.size(); ++i) {
+            result.values[i] = (vector[i] - m_min[i]) / m_step[i];
+        }
+
+        return result;
+    }
+
+    sq8_l2_distance_t l2_distance() const {
+        sq8_l2_distance_t result;
+        result.weights.resize(m_step.size());
+
+        for (std::size_t i = 0; i < m_step.size(); ++i) {
+            result.weights[i] = m_step[i] * m_step[i];
+        }
+
+        return result;
+    }
+
+    void save(std::ostream &stream) const {
+        detail::stream_writer_t writer(stream);
+        detail::write_header(writer, "HNSWSQ8", 1);
+        detail::write_value(writer, m_min);
+        detail::write_value(writer, m_step);
+    }
+
+    void load(std::istream &stream) {
+        detail::stream_reader_t reader(stream);
+        detail::read_header(reader, "HNSWSQ8", 1);
+
+        std::vector<float> min;
+        std::vector<float> step;
+        detail::read_value(reader, min);
+        detail::read_value(reader, step);
+
+        if (min.size() != step.size()) {
+            throw std::runtime_error("sq8_quantizer_t::load: the stream is corrupted");
+        }
+
+        m_min = std::move(min);
+        m_step = std::move(step);
+    }
+
+private:
+    void check_size(std::size_t size) const {
+        if (size != dimension()) {
+            throw std::runtime_error("sq8_quantizer_t: wrong size of the vector");
+        }
+    }
+
+private:
+    std::vector<float> m_min;
+    std::vector<float> m_step;
+};
+
+
+}
@@ -0,0 +1,67 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+
+namespace hnsw {
+
+
+// Work done by a single search. Pass it to hnsw_index::search to get it filled.
+struct search_stats_t {
+    // Number of expanded nodes on each layer, index is the layer number.
+    std::vector<std::size_t> hops;
+    std::size_t distance_computations = 0;
+    // Total size of the visited sets of the beam searches.
+    std::size_t visited_nodes = 0;
+    // Maximum number of candidates waiting for expansion in a beam search.
+    std::size_t max_search_front_size = 0;
+
+    void on_hop(std::size_t layer) {
+        if (hops.size() <= layer) {
+            hops.resize(layer + 1, 0);
+        }
+
+        ++hops[layer];
+    }
+
+    void on_distance() {
+        ++distance_computations;
+    }
+
+    void on_visited(std::size_t visited) {
+        visited_nodes += visited;
+    }
+
+    void on_search_front(std::size_t size) {
+        max_search_front_size = std::max(max_search_front_size, size);
+    }
+};
+
+
+// Used when nobody asked for statistics. Calls to it are optimized away.
+struct no_search_stats_t {
+    void on_hop(std::size_t) { }
+    void on_distance() { }
+    void on_visited(std::size_t) { }
+    void on_search_front(std::size_t) { }
+};
+
+
+}
@@ -0,0 +1,327 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "string_view.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+
+namespace hnsw {
+
+
+/** Binary serialization of keys and vectors stored in the index.
+ *
+ *  Specializations must provide:
+ *    template<class Writer> static void write(Writer &writer, const T &value);
+ *    template<class Reader> static void read(Reader &reader, T &value);
+ *  where writer.write(const void *data, size_t size) and reader.read(void *data, size_t size) deal with raw bytes.
+ *
+ *  It's already specialized for trivially copyable types, std::string and std::vector of serializable types.
+ *  string_view is written like std::string, so that keys can be saved without copies, but it can't be read.
+ *  The data is written in the native byte order.
+ */
+template<class T, class = void>
+struct serializer;
+
+
+namespace detail {
+
+
+template<class T>
+struct is_string_view: std::false_type { };
+
+
+template<class Char, class Traits>
+struct is_string_view<basic_string_view<Char, Traits>>: std::true_type { };
+
+
+}
+
+
+// Views are trivially copyable too, but they are written like strings, see below.
+template<class T>
+struct serializer<T, std::enable_if_t<std::is_trivially_copyable<T>::value && !detail::is_string_view<T>::value>> {
+    template<class Writer>
+    static void write(Writer &writer, const T &value) {
+        writer.write(&value, sizeof(T));
+    }
+
+    template<class Reader>
+    static void read(Reader &reader, T &value) {
+        reader.read(&value, sizeof(T));
+    }
+};
+
+
+template<class T, class Allocator>
+struct serializer<std::vector<T, Allocator>> {
+    template<class Writer>
+    static void write(Writer &writer, const std::vector<T, Allocator> &value) {
+        serializer<std::uint64_t>::write(writer, value.size());
+        write_items(writer, value, std::is_trivially_copyable<T>());
+    }
+
+    template<class Reader>
+    static void read(Reader &reader, std::vector<T, Allocator> &value) {
+        std::uint64_t size = 0;
+        serializer<std::uint64_t>::read(reader, size);
+        value.resize(reader.checked_size(size, sizeof(T)));
+        read_items(reader, value, std::is_trivially_copyable<T>());
+    }
+
+private:
+    // Vectors of trivially copyable items are written in bulk.
+    template<class Writer>
+    static void write_items(Writer &writer, const std::vector<T, Allocator> &value, std::true_type) {
+        writer.write(value.data(), sizeof(T) * value.size());
+    }
+
+    template<class Writer>
+    static void write_items(Writer &writer, const std::vector<T, Allocator> &value, std::false_type) {
+        for (const auto &item: value) {
+            serializer<T>::write(writer, item);
+        }
+    }
+
+    template<class Reader>
+    static void read_items(Reader &reader, std::vector<T, Allocator> &value, std::true_type) {
+        reader.read(value.data(), sizeof(T) * value.size());
+    }
+
+    template<class Reader>
+    static void read_items(Reader &reader, std::vector<T, Allocator> &value, std::false_type) {
+        for (auto &item: value) {
+            serializer<T>::read(reader, item);
+        }
+    }
+};
+
+
+template<class Char, class Traits, class Allocator>
+struct serializer<std::basic_string<Char, Traits, Allocator>, std::enable_if_t<std::is_trivially_copyable<Char>::value>> {
+    template<class Writer>
+    static void write(Writer &writer, const std::basic_string<Char, Traits, Allocator> &value) {
+        serializer<std::uint64_t>::write(writer, value.size());
+        writer.write(value.data(), sizeof(Char) * value.size());
+    }
+
+    template<class Reader>
+    static void read(Reader &reader, std::basic_string<Char, Traits, Allocator> &value) {
+        std::uint64_t size = 0;
+        serializer<std::uint64_t>::read(reader, size);
+        value.resize(reader.checked_size(size, sizeof(Char)));
+        reader.read(&value[0], sizeof(Char) * value.size());
+    }
+};
+
+
+
+template<class Char, class Traits>
+struct serializer<basic_string_view<Char, Traits>, std::enable_if_t<std::is_trivially_copyable<Char>::value>> {
+    template<class Writer>
+    static void write(Writer &writer, const basic_string_view<Char, Traits> &value) {
+        serializer<std::uint64_t>::write(writer, value.size());
+        writer.write(value.data(), sizeof(Char) * value.size());
+    }
+};
+
+namespace detail {
+
+
+class stream_writer_t {
+public:
+    explicit stream_writer_t(std::ostream &stream):
+        m_stream(stream)
+    { }
+
+    void write(const void *data, std::size_t size) {
+        if (size > 0 && !m_stream.write(static_cast<const char *>(data), std::streamsize(size))) {
+            throw std::runtime_error("stream_writer_t::write: failed to write to the stream");
+        }
+    }
+
+private:
+    std::ostream &m_stream;
+};
+
+
+class stream_reader_t {
+public:
+    explicit stream_reader_t(std::istream &stream):
+        m_stream(stream)
+    { }
+
+    void read(void *data, std::size_t size) {
+        if (size > 0 && !m_stream.read(static_cast<char *>(data), std::streamsize(size))) {
+            throw std::runtime_error("stream_reader_t::read: unexpected end of the stream");
+        }
+    }
+
+    // Protects from huge allocations on corrupted input.
+    std::size_t checked_size(std::uint64_t size, std::size_t item_size) const {
+        if (size > (std::uint64_t(1) << 40) / std::max<std::size_t>(1, item_size)) {
+            throw std::runtime_error("stream_reader_t: the stream is corrupted, too large container size");
+        }
+
+        return std::size_t(size);
+    }
+
+private:
+    std::istream &m_stream;
+};
+
+
+// Appends to a buffer in memory.
+class buffer_writer_t {
+public:
+    explicit buffer_writer_t(std::vector<char> &buffer):
+        m_buffer(buffer)
+    { }
+
+    void write(const void *data, std::size_t size) {
+        const char *bytes = static_cast<const char *>(data);
+        m_buffer.insert(m_buffer.end(), bytes, bytes + size);
+    }
+
+private:
+    std::vector<char> &m_buffer;
+};
+
+
+// Reads from a buffer in memory.
+class memory_reader_t {
+public:
+    memory_reader_t(const char *data, std::size_t size):
+        m_data(data),
+        m_size(size)
+    { }
+
+    void read(void *data, std::size_t size) {
+        if (size > m_size) {
+            throw std::runtime_error("memory_reader_t::read: unexpected end of the buffer");
+        }
+
+        std::memcpy(data, m_data, size);
+        m_data += size;
+        m_size -= size;
+    }
+
+    // Every item takes at least one byte, so there can't be more of them than bytes left.
+    std::size_t checked_size(std::uint64_t size, std::size_t) const {
+        if (size > m_size) {
+            throw std::runtime_error("memory_reader_t: the buffer is corrupted, too large container size");
+        }
+
+        return std::size_t(size);
+    }
+
+    std::size_t remaining() const {
+        return m_size;
+    }
+
+private:
+    const char *m_data;
+    std::size_t m_size;
+};
+
+
+template<class Writer, class T>
+void write_value(Writer &writer, const T &value) {
+    serializer<T>::write(writer, value);
+}
+
+
+template<class Reader, class T>
+void read_value(Reader &reader, T &value) {
+    serializer<T>::read(reader, value);
+}
+
+
+template<class T, class Reader>
+T read_value(Reader &reader) {
+    T value;
+    serializer<T>::read(reader, value);
+    return value;
+}
+
+
+// Header of the serialized objects: magic, format version and byte order marker.
+template<class Writer>
+void write_header(Writer &writer, const char (&magic)[8], std::uint32_t version) {
+    writer.write(magic, sizeof(magic));
+    write_value(writer, version);
+    write_value(writer, std::uint32_t(0x01020304));
+}
+
+
+// Returns format version.
+template<class Reader>
+std::uint32_t read_header(Reader &reader, const char (&magic)[8], std::uint32_t max_version) {
+    char actual_magic[8];
+    reader.read(actual_magic, sizeof(actual_magic));
+
+    if (std::memcmp(actual_magic, magic, sizeof(magic)) != 0) {
+        throw std::runtime_error("read_header: unknown format");
+    }
+
+    auto version = read_value<std::uint32_t>(reader);
+
+    if (version == 0 || version > max_version) {
+        throw std::runtime_error("read_header: unsupported format version " + std::to_string(version));
+    }
+
+    if (read_value<std::uint32_t>(reader) != 0x01020304) {
+        throw std::runtime_error("read_header: the data was written with another byte order");
+    }
+
+    return version;
+}
+
+
+// Random engines of the standard library are only serializable as text.
+template<class Writer, class Random>
+void write_random(Writer &writer, const Random &random) {
+    std::ostringstream state;
+    state << random;
+    write_value(writer, state.str());
+}
+
+
+template<class Reader, class Random>
+void read_random(Reader &reader, Random &random) {
+    std::istringstream state(read_value<std::string>(reader));
+
+    if (!(state >> random)) {
+        throw std::runtime_error("read_random: corrupted state of the random engine");
+    }
+}
+
+
+}
+
+
+}
@@ -0,0 +1,325 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+namespace hnsw {
+
+
+/** Pool of small fixed-size blocks, one list of slabs per size class.
+ *
+ *  Each node of the index keeps the links of all its layers in one block of node_layers, whose size is set
+ *  by max_links and the number of layers, so nearly all blocks fall into a handful of sizes: most nodes have one layer,
+ *  few have more than three. With size classes of block_alignment bytes a block is taken in O(1) with less than
+ *  block_alignment bytes of waste, and a block freed by a removed node is reused by the next node with as many layers
+ *  instead of fragmenting the heap. Arrays of incoming links are small and are served by the same classes.
+ *
+ *  Slabs are aligned to their size, so a freed block finds its slab in O(1). A slab is given back to the heap
+ *  as soon as all its blocks are freed, except the last slab with free blocks of its class, which is kept to avoid
+ *  allocating a slab again on the next insert. Nodes inserted together share slabs, so removing them frees the slabs,
+ *  while removals scattered over the index leave partly used slabs, whose free blocks are reused by later inserts.
+ *
+ *  The index allocates only from the threads which call it, so the pool doesn't lock by default.
+ *  Pass thread_safe = true to share it between indexes used by different threads.
+ *  All blocks must be deallocated before the pool is destroyed.
+ */
+class slab_pool_t {
+public:
+    static constexpr std::size_t block_alignment = 16;
+
+    struct stats_t {
+        // Memory taken by slabs.
+        std::size_t reserved_bytes = 0;
+        // Memory taken by allocated blocks, rounded up to their size classes.
+        std::size_t used_bytes = 0;
+    };
+
+    /** Blocks up to max_block_size bytes come from slabs of slab_size bytes, larger ones from operator new.
+     *  slab_size must be a power of two.
+     */
+    explicit slab_pool_t(std::size_t max_block_size = 4096, std::size_t slab_size = 64 * 1024, bool thread_safe = false):
+        m_max_block_size(max_block_size),
+        m_slab_size(slab_size),
+        m_thread_safe(thread_safe),
+        m_classes(max_block_size / block_alignment + 1)
+    {
+        if (slab_size == 0 || (slab_size & (slab_size - 1)) != 0) {
+            throw std::runtime_error("slab_pool_t: the size of slabs must be a power of two");
+        }
+
+        if (max_block_size == 0 || slab_size < slab_header_size + round_up(max_block_size)) {
+            throw std::runtime_error("slab_pool_t: slabs must be larger than blocks");
+        }
+    }
+
+    ~slab_pool_t() {
+        for (auto &size_class: m_classes) {
+            while (size_class.slabs) {
+                auto slab = size_class.slabs;
+                size_class.slabs = slab->next;
+                std::free(slab);
+            }
+        }
+    }
+
+    slab_pool_t(const slab_pool_t &) = delete;
+    slab_pool_t &operator=(const slab_pool_t &) = delete;
+
+    void *allocate(std::size_t size) {
+        if (size == 0 || size > m_max_block_size) {
+            return ::operator new(size);
+        }
+
+        auto block_size = round_up(size);
+        auto &size_class = m_classes[block_size / block_alignment];
+
+        auto lock = this->lock();
+
+        if (!size_class.slabs) {
+            link(size_class, new_slab(block_size));
+        }
+
+        auto slab = size_class.slabs;
+        void *block = nullptr;
+
+        if (slab->free_blocks) {
+            block = slab->free_blocks;
+            slab->free_blocks = slab->free_blocks->next;
+        } else {
+            block = reinterpret_cast<char *>(slab) + slab_header_size + slab->carved * block_size;
+            ++slab->carved;
+        }
+
+        ++slab->live;
+        m_stats.used_bytes += block_size;
+
+        if (slab->live == slab->capacity) {
+            unlink(size_class, slab);
+        }
+
+        return block;
+    }
+
+    void deallocate(void *data, std::size_t size) noexcept {
+        if (size == 0 || size > m_max_block_size) {
+            ::operator delete(data);
+            return;
+        }
+
+        auto block_size = round_up(size);
+        auto &size_class = m_classes[block_size / block_alignment];
+        auto slab = reinterpret_cast<slab_t *>(reinterpret_cast<std::uintptr_t>(data) & ~std::uintptr_t(m_slab_size - 1));
+
+        auto lock = this->lock();
+
+        auto block = static_cast<free_block_t *>(data);
+        block->next = slab->free_blocks;
+        slab->free_blocks = block;
+        m_stats.used_bytes -= block_size;
+
+        // A full slab isn't in the list of its class.
+        if (slab->live == slab->capacity) {
+            link(size_class, slab);
+        }
+
+        --slab->live;
+
+        if (slab->live == 0 && (slab->previous || slab->next)) {
+            unlink(size_class, slab);
+            std::free(slab);
+            m_stats.reserved_bytes -= m_slab_size;
+        }
+    }
+
+    stats_t stats() const {
+        auto lock = this->lock();
+        return m_stats;
+    }
+
+private:
+    struct free_block_t {
+        free_block_t *next;
+    };
+
+    // Lies at the beginning of each slab, blocks follow it.
+    struct slab_t {
+        // Neighbors in the list of slabs with free blocks of the size class.
+        slab_t *previous;
+        slab_t *next;
+        free_block_t *free_blocks;
+        // Number of blocks handed out from the never used tail of the slab.
+        std::size_t carved;
+        std::size_t live;
+        std::size_t capacity;
+    };
+
+    struct size_class_t {
+        // Slabs which have free blocks.
+        slab_t *slabs = nullptr;
+    };
+
+    static constexpr std::size_t slab_header_size = (sizeof(slab_t) + block_alignment - 1) / block_alignment * block_alignment;
+
+    slab_t *new_slab(std::size_t block_size) {
+        void *memory = nullptr;
+
+        if (::posix_memalign(&memory, m_slab_size, m_slab_size) != 0) {
+            throw std::bad_alloc();
+        }
+
+        auto slab = static_cast<slab_t *>(memory);
+        slab->previous = nullptr;
+        slab->next = nullptr;
+        slab->free_blocks = nullptr;
+        slab->carved = 0;
+        slab->live = 0;
+        slab->capacity = (m_slab_size - slab_header_size) / block_size;
+        m_stats.reserved_bytes += m_slab_size;
+        return slab;
+    }
+
+    static void link(size_class_t &size_class, slab_t *slab) {
+        slab->previous = nullptr;
+        slab->next = size_class.slabs;
+
+        if (size_class.slabs) {
+            size_class.slabs->previous = slab;
+        }
+
+        size_class.slabs = slab;
+    }
+
+    static void unlink(size_class_t &size_class, slab_t *slab) {
+        if (slab->previous) {
+            slab->previous->next = slab->next;
+        } else {
+            size_class.slabs = slab->next;
+        }
+
+        if (slab->next) {
+            slab->next->previous = slab->previous;
+        }
+
+        slab->previous = nullptr;
+        slab->next = nullptr;
+    }
+
+    // Doesn't lock anything unless the pool is thread-safe.
+    std::unique_lock<std::mutex> lock() const {
+        return m_thread_safe ? std::unique_lock<std::mutex>(m_mutex) : std::unique_lock<std::mutex>();
+    }
+
+    static constexpr std::size_t round_up(std::size_t size) {
+        return (size + block_alignment - 1) / block_alignment * block_alignment;
+    }
+
+private:
+    std::size_t m_max_block_size;
+    std::size_t m_slab_size;
+    bool m_thread_safe;
+    std::vector<size_class_t> m_classes;
+    stats_t m_stats;
+    mutable std::mutex m_mutex;
+};
+
+
+/** Allocator over a shared slab_pool_t. Use it as the Allocator of hnsw_index to allocate link arrays from the pool:
+ *
+ *      using allocator_t = slab_allocator<char>;
+ *      hnsw_index<Key, Vector, Distance, std::minstd_rand, allocator_t> index {allocator_t(std::make_shared<slab_pool_t>())};
+ *
+ *  Copies and rebound copies share the pool. A default-constructed allocator creates a pool of its own,
+ *  so pass an allocator to the constructor of the index to choose the pool or to share one between indexes.
+ *
+ *  A copy of an index shares the pool with the original. Unless the pool is thread-safe, the original
+ *  and the copy must be used from one thread, otherwise they corrupt the free lists of the pool.
+ */
+template<class T>
+class slab_allocator {
+public:
+    using value_type = T;
+
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    slab_allocator():
+        m_pool(std::make_shared<slab_pool_t>())
+    { }
+
+    explicit slab_allocator(std::shared_ptr<slab_pool_t> pool):
+        m_pool(std::move(pool))
+    { }
+
+    template<class U>
+    slab_allocator(const slab_allocator<U> &other) noexcept:
+        m_pool(other.pool())
+    { }
+
+    T *allocate(std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+            throw std::bad_alloc();
+        }
+
+        if (alignof(T) > slab_pool_t::block_alignment) {
+            return std::allocator<T>().allocate(n);
+        }
+
+        return static_cast<T *>(m_pool->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *data, std::size_t n) noexcept {
+        if (alignof(T) > slab_pool_t::block_alignment) {
+            std::allocator<T>().deallocate(data, n);
+        } else {
+            m_pool->deallocate(data, n * sizeof(T));
+        }
+    }
+
+    const std::shared_ptr<slab_pool_t> &pool() const {
+        return m_pool;
+    }
+
+private:
+    std::shared_ptr<slab_pool_t> m_pool;
+};
+
+
+template<class T, class U>
+bool operator==(const slab_allocator<T> &l, const slab_allocator<U> &r) {
+    return l.pool() == r.pool();
+}
+
+
+template<class T, class U>
+bool operator!=(const slab_allocator<T> &l, const slab_allocator<U> &r) {
+    return l.pool() != r.pool();
+}
+
+
+}
@@ -0,0 +1,187 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+
+namespace hnsw {
+
+
+/** Non-owning view of a string, a subset of std::string_view from C++17.
+ *  key_mapper returns string keys as views of its key arena.
+ *
+ *  It compares with other views, std::basic_string and string literals, and converts to std::basic_string explicitly.
+ */
+template<class Char, class Traits = std::char_traits<Char>>
+class basic_string_view {
+public:
+    using value_type = Char;
+    using traits_type = Traits;
+    using size_type = std::size_t;
+    using const_iterator = const Char *;
+
+    basic_string_view() = default;
+
+    basic_string_view(const Char *data, size_type size):
+        m_data(data),
+        m_size(size)
+    { }
+
+    basic_string_view(const Char *string):
+        m_data(string),
+        m_size(Traits::length(string))
+    { }
+
+    template<class Allocator>
+    basic_string_view(const std::basic_string<Char, Traits, Allocator> &string):
+        m_data(string.data()),
+        m_size(string.size())
+    { }
+
+    template<class Allocator>
+    explicit operator std::basic_string<Char, Traits, Allocator>() const {
+        return std::basic_string<Char, Traits, Allocator>(m_data, m_size);
+    }
+
+    const Char *data() const {
+        return m_data;
+    }
+
+    size_type size() const {
+        return m_size;
+    }
+
+    size_type length() const {
+        return m_size;
+    }
+
+    bool empty() const {
+        return m_size == 0;
+    }
+
+    const Char &operator[](size_type i) const {
+        return m_data[i];
+    }
+
+    const_iterator begin() const {
+        return m_data;
+    }
+
+    const_iterator end() const {
+        return m_data + m_size;
+    }
+
+    int compare(basic_string_view other) const {
+        int result = Traits::compare(m_data, other.m_data, std::min(m_size, other.m_size));
+
+        if (result != 0) {
+            return result;
+        }
+
+        return (m_size < other.m_size) ? -1 : ((m_size > other.m_size) ? 1 : 0);
+    }
+
+private:
+    const Char *m_data = nullptr;
+    size_type m_size = 0;
+};
+
+
+using string_view = basic_string_view<char>;
+
+
+namespace detail {
+
+
+// Excludes the argument from template argument deduction, so that it's converted to a view implicitly.
+template<class T>
+struct identity {
+    using type = T;
+};
+
+
+template<class T>
+using identity_t = typename identity<T>::type;
+
+
+}
+
+
+template<class Char, class Traits>
+bool operator==(basic_string_view<Char, Traits> l, basic_string_view<Char, Traits> r) {
+    return l.size() == r.size() && l.compare(r) == 0;
+}
+
+
+template<class Char, class Traits>
+bool operator==(basic_string_view<Char, Traits> l, detail::identity_t<basic_string_view<Char, Traits>> r) {
+    return l.size() == r.size() && l.compare(r) == 0;
+}
+
+
+template<class Char, class Traits>
+bool operator==(detail::identity_t<basic_string_view<Char, Traits>> l, basic_string_view<Char, Traits> r) {
+    return l.size() == r.size() && l.compare(r) == 0;
+}
+
+
+template<class Char, class Traits>
+bool operator!=(basic_string_view<Char, Traits> l, basic_string_view<Char, Traits> r) {
+    return !(l == r);
+}
+
+
+template<class Char, class Traits>
+bool operator!=(basic_string_view<Char, Traits> l, detail::identity_t<basic_string_view<Char, Traits>> r) {
+    return !(l == r);
+}
+
+
+template<class Char, class Traits>
+bool operator!=(detail::identity_t<basic_string_view<Char, Traits>> l, basic_string_view<Char, Traits> r) {
+    return !(l == r);
+}
+
+
+template<class Char, class Traits>
+bool operator<(basic_string_view<Char, Traits> l, basic_string_view<Char, Traits> r) {
+    return l.compare(r) < 0;
+}
+
+
+template<class Char, class Traits>
+bool operator<(basic_string_view<Char, Traits> l, detail::identity_t<basic_string_view<Char, Traits>> r) {
+    return l.compare(r) < 0;
+}
+
+
+template<class Char, class Traits>
+bool operator<(detail::identity_t<basic_string_view<Char, Traits>> l, basic_string_view<Char, Traits> r) {
+    return l.compare(r) < 0;
+}
+
+
+template<class Char, class Traits>
+std::basic_ostream<Char, Traits> &operator<<(std::basic_ostream<Char, Traits> &stream, basic_string_view<Char, Traits> view) {
+    return stream.write(view.data(), std::streamsize(view.size()));
+}
+
+
+}
@@ -0,0 +1,77 @@
+/* Copyright 2017 Andrey Goryachev
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <utility>
+
+
+namespace hnsw {
+
+
+// Non-owning view of a contiguous vector. Distance functors accept it just like std::vector.
+template<class T>
+class vector_view {
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using const_iterator = const T *;
+
+    vector_view() = default;
+
+    vector_view(const T *data, size_type size):
+        m_data(data),
+        m_size(size)
+    { }
+
+    // Implicit, so that std::vector and alike can be passed where a view is expected.
+    template<class Vector, class = decltype(static_cast<const T *>(std::declval<const Vector &>().data()))>
+    vector_view(const Vector &vector):
+        m_data(vector.data()),
+        m_size(vector.size())
+    { }
+
+    const T *data() const {
+        return m_data;
+    }
+
+    size_type size() const {
+        return m_size;
+    }
+
+    bool empty() const {
+        return m_size == 0;
+    }
+
+    const T &operator[](size_type i) const {
+        return m_data[i];
+    }
+
+    const_iterator begin() const {
+        return m_data;
+    }
+
+    const_iterator end() const {
+        return m_data + m_size;
+    }
+
+private:
+    const T *m_data = nullptr;
+    size_type m_size = 0;
+};
+
+
+}
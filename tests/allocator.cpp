@@ -0,0 +1,346 @@
+#include <catch.hpp>
+
+#include <hnsw/distance.hpp>
+#include <hnsw/containers/key_table.hpp>
+#include <hnsw/index.hpp>
+#include <hnsw/key_mapper.hpp>
+#include <hnsw/slab_allocator.hpp>
+
+#include <atomic>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+template<class Random>
+std::vector<float> random_vector(size_t size, Random &engine) {
+    std::uniform_real_distribution<float> generator(0.0, 1.0);
+    std::vector<float> result(size);
+
+    for (auto &v: result) {
+        v = generator(engine);
+    }
+
+    return result;
+}
+
+
+// Allocators aren't required to be thread-safe, so the index must allocate from the thread which calls it.
+const std::thread::id main_thread = std::this_thread::get_id();
+std::atomic<long> foreign_allocations(0);
+
+
+// Counts live allocations. It has no default constructor, so every container must get it from the index.
+// The counter is atomic to keep the test well-defined even if the index allocates from other threads.
+template<class T>
+struct counting_allocator_t {
+    using value_type = T;
+
+    std::shared_ptr<std::atomic<long>> live;
+
+    explicit counting_allocator_t(std::shared_ptr<std::atomic<long>> live):
+        live(std::move(live))
+    { }
+
+    template<class U>
+    counting_allocator_t(const counting_allocator_t<U> &other):
+        live(other.live)
+    { }
+
+    T *allocate(size_t n) {
+        if (std::this_thread::get_id() != main_thread) {
+            ++foreign_allocations;
+        }
+
+        ++*live;
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T *data, size_t n) {
+        --*live;
+        std::allocator<T>().deallocate(data, n);
+    }
+};
+
+
+template<class T, class U>
+bool operator==(const counting_allocator_t<T> &l, const counting_allocator_t<U> &r) {
+    return l.live == r.live;
+}
+
+
+template<class T, class U>
+bool operator!=(const counting_allocator_t<T> &l, const counting_allocator_t<U> &r) {
+    return l.live != r.live;
+}
+
+
+template<class Index>
+bool uses_allocator(const Index &index, const std::shared_ptr<std::atomic<long>> &live) {
+    if (index.get_allocator().live != live || index.level_counts.get_allocator().live != live || index.top_keys.get_allocator().live != live) {
+        return false;
+    }
+
+    for (const auto &node: index.nodes) {
+        if (node.second.layers.get_allocator().live != live) {
+            return false;
+        }
+
+        for (const auto &layer: node.second.layers) {
+            if (layer.incoming.get_allocator().live != live) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+}
+
+
+TEST_CASE("index allocates its containers with the given allocator") {
+    using index_t = hnsw::hnsw_index<uint32_t,
+                                     std::vector<float>,
+                                     hnsw::l2_square_distance_t,
+                                     std::minstd_rand,
+                                     counting_allocator_t<char>>;
+
+    auto live = std::make_shared<std::atomic<long>>(0);
+
+    {
+        index_t index {counting_allocator_t<char>(live)};
+        index.options.max_links = 8;
+        index.options.ef_construction = 20;
+        std::minstd_rand random;
+
+        // More than two chunks of a snapshot are left, so that load() decodes them in parallel.
+        for (uint32_t i = 0; i < 9200; ++i) {
+            index.insert(i, random_vector(8, random));
+        }
+
+        for (uint32_t i = 0; i < 9200; i += 10) {
+            index.remove(i);
+        }
+
+        REQUIRE(index.nodes.size() > 2 * 4096);
+
+        REQUIRE(index.check());
+        REQUIRE(uses_allocator(index, live));
+        REQUIRE(*live > 0);
+
+        index.reorder();
+        REQUIRE(index.check());
+        REQUIRE(uses_allocator(index, live));
+
+        index.compact();
+        REQUIRE(index.check());
+        REQUIRE(uses_allocator(index, live));
+
+        std::stringstream stream;
+        index.save(stream);
+
+        for (size_t threads: {1, 4}) {
+            index_t loaded {counting_allocator_t<char>(live)};
+            stream.seekg(0);
+            loaded.load(stream, threads);
+
+            REQUIRE(loaded.check());
+            REQUIRE(loaded.nodes.size() == index.nodes.size());
+            REQUIRE(uses_allocator(loaded, live));
+            REQUIRE(foreign_allocations == 0);
+        }
+
+        auto target = random_vector(8, random);
+        REQUIRE(index.search(target, 10).size() == 10);
+    }
+
+    REQUIRE(*live == 0);
+
+    {
+        using mapper_t = hnsw::key_mapper<std::string, index_t>;
+
+        mapper_t mapper {counting_allocator_t<char>(live)};
+        std::minstd_rand random;
+
+        for (size_t i = 0; i < 100; ++i) {
+            mapper.insert(std::to_string(i), random_vector(8, random));
+        }
+
+        for (size_t i = 0; i < 100; i += 2) {
+            mapper.remove(std::to_string(i));
+        }
+
+        mapper.compact();
+        REQUIRE(mapper.check());
+
+        std::stringstream stream;
+        mapper.save(stream);
+
+        mapper_t loaded {counting_allocator_t<char>(live)};
+        loaded.load(stream);
+
+        REQUIRE(loaded.check());
+        REQUIRE(uses_allocator(loaded.index, live));
+        REQUIRE(loaded.keys.get_allocator().live == live);
+    }
+
+    REQUIRE(*live == 0);
+}
+
+
+TEST_CASE("slab allocator reuses link arrays after churn") {
+    using index_t = hnsw::hnsw_index<uint32_t,
+                                     std::vector<float>,
+                                     hnsw::l2_square_distance_t,
+                                     std::minstd_rand,
+                                     hnsw::slab_allocator<char>>;
+
+    auto pool = std::make_shared<hnsw::slab_pool_t>(4096, 16384);
+    index_t index {hnsw::slab_allocator<char>(pool)};
+    index.options.ef_construction = 50;
+    std::minstd_rand random;
+
+    // Hash tables of an empty index already have some buckets.
+    auto empty_used_bytes = pool->stats().used_bytes;
+
+    for (uint32_t i = 0; i < 1000; ++i) {
+        index.insert(i, random_vector(4, random));
+    }
+
+    auto filled = pool->stats();
+    REQUIRE(filled.used_bytes > empty_used_bytes);
+    REQUIRE(filled.used_bytes <= filled.reserved_bytes);
+
+    for (uint32_t round = 1; round <= 3; ++round) {
+        for (uint32_t i = 0; i < 1000; i += 2) {
+            index.remove(i + round % 2);
+        }
+
+        for (uint32_t i = 0; i < 1000; i += 2) {
+            index.insert(i + round % 2, random_vector(4, random));
+        }
+    }
+
+    REQUIRE(index.check());
+    REQUIRE(index.search(random_vector(4, random), 10).size() == 10);
+
+    // Without reuse of freed blocks three rounds of churn would take more than twice as much.
+    REQUIRE(pool->stats().reserved_bytes < filled.reserved_bytes * 3 / 2);
+
+    index = index_t(hnsw::slab_allocator<char>(pool));
+    REQUIRE(pool->stats().used_bytes == empty_used_bytes);
+
+    // A thread-safe pool is shared between threads.
+    auto shared_pool = std::make_shared<hnsw::slab_pool_t>(4096, 16384, true);
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < 4; ++i) {
+        threads.emplace_back([&shared_pool]() {
+            std::vector<void *> blocks;
+
+            for (size_t size = 1; size <= 4096; ++size) {
+                blocks.push_back(shared_pool->allocate(size));
+            }
+
+            for (size_t size = 1; size <= 4096; ++size) {
+                shared_pool->deallocate(blocks[size - 1], size);
+            }
+        });
+    }
+
+    for (auto &thread: threads) {
+        thread.join();
+    }
+
+    REQUIRE(shared_pool->stats().used_bytes == 0);
+    REQUIRE(shared_pool->stats().reserved_bytes > 0);
+}
+
+
+TEST_CASE("slab pool gives back slabs whose blocks are all freed") {
+    hnsw::slab_pool_t pool(4096, 16384);
+    std::vector<void *> blocks;
+
+    for (size_t i = 0; i < 1000; ++i) {
+        blocks.push_back(pool.allocate(64));
+    }
+
+    REQUIRE(pool.stats().reserved_bytes >= 4 * 16384);
+
+    // Freeing every other block frees no slab, and the free blocks are reused.
+    for (size_t i = 0; i < blocks.size(); i += 2) {
+        pool.deallocate(blocks[i], 64);
+    }
+
+    auto reserved_bytes = pool.stats().reserved_bytes;
+
+    for (size_t i = 0; i < blocks.size(); i += 2) {
+        blocks[i] = pool.allocate(64);
+    }
+
+    REQUIRE(pool.stats().reserved_bytes == reserved_bytes);
+
+    // One empty slab is kept for the next allocations.
+    for (auto block: blocks) {
+        pool.deallocate(block, 64);
+    }
+
+    REQUIRE(pool.stats().used_bytes == 0);
+    REQUIRE(pool.stats().reserved_bytes == 16384);
+
+    using index_t = hnsw::hnsw_index<uint32_t,
+                                     std::vector<float>,
+                                     hnsw::l2_square_distance_t,
+                                     std::minstd_rand,
+                                     hnsw::slab_allocator<char>>;
+
+    auto index_pool = std::make_shared<hnsw::slab_pool_t>(4096, 16384);
+    index_t index {hnsw::slab_allocator<char>(index_pool)};
+    index.options.max_links = 8;
+    index.options.ef_construction = 20;
+    std::minstd_rand random;
+
+    for (uint32_t i = 0; i < 3000; ++i) {
+        index.insert(i, random_vector(4, random));
+    }
+
+    auto filled = index_pool->stats();
+
+    // Nodes inserted together share slabs, so removing them gives slabs back. Not all of them though,
+    // since the remaining nodes get new incoming links while the removed ones are unlinked.
+    for (uint32_t i = 0; i < 2700; ++i) {
+        index.remove(i);
+    }
+
+    index.compact();
+    REQUIRE(index.check());
+    REQUIRE(index_pool->stats().reserved_bytes < filled.reserved_bytes * 3 / 4);
+}
+
+
+TEST_CASE("key table allocates its key array with the given allocator") {
+    using table_t = hnsw::key_table<std::string, uint32_t, counting_allocator_t<std::string>>;
+
+    auto live = std::make_shared<std::atomic<long>>(0);
+
+    {
+        table_t keys {counting_allocator_t<std::string>(live)};
+        // The array of keys and the buckets of the hash set.
+        REQUIRE(*live == 2);
+
+        keys.insert("some key");
+        auto moved = std::move(keys);
+        REQUIRE(moved.get_allocator().live == live);
+        REQUIRE(keys.get_allocator().live == live);
+        REQUIRE(moved.key(0) == "some key");
+        REQUIRE(keys.empty());
+    }
+
+    REQUIRE(*live == 0);
+}
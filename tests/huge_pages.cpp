@@ -0,0 +1,102 @@
+#include <catch.hpp>
+
+#include <hnsw/distance.hpp>
+#include <hnsw/huge_pages.hpp>
+#include <hnsw/index.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+TEST_CASE("huge page region is aligned, zeroed and keeps the contents when prefaulted") {
+    hnsw::huge_page_region_t region(3 * hnsw::huge_page_size / 2);
+
+    REQUIRE(region.size() == 2 * hnsw::huge_page_size);
+    REQUIRE(reinterpret_cast<std::uintptr_t>(region.data()) % hnsw::huge_page_size == 0);
+    REQUIRE(region.data()[0] == 0);
+    REQUIRE(region.data()[region.size() - 1] == 0);
+
+    std::memset(region.data(), 7, region.size());
+    region.prefault();
+    REQUIRE(region.data()[region.size() / 2] == 7);
+
+    hnsw::huge_page_options_t options;
+    options.hugetlb = false;
+    options.transparent = false;
+    options.prefault = true;
+
+    hnsw::huge_page_region_t regular(1, options);
+    REQUIRE(regular.size() == hnsw::huge_page_size);
+    REQUIRE(regular.mode() != hnsw::huge_page_mode_t::hugetlb);
+
+    region = std::move(regular);
+    REQUIRE(regular.data() == nullptr);
+    REQUIRE(region.size() == hnsw::huge_page_size);
+    REQUIRE(hnsw::huge_page_region_t().data() == nullptr);
+}
+
+
+TEST_CASE("huge page allocator puts only large arrays into huge pages") {
+    auto total = [](const hnsw::huge_page_usage_t &usage) {
+        return usage.none + usage.transparent + usage.hugetlb;
+    };
+
+    auto before = total(hnsw::huge_page_usage());
+
+    {
+        std::vector<uint64_t, hnsw::huge_page_allocator<uint64_t>> small(100, 1);
+        REQUIRE(total(hnsw::huge_page_usage()) == before);
+
+        std::vector<uint64_t, hnsw::huge_page_allocator<uint64_t>> large(hnsw::huge_page_size / 8 + 1, 2);
+        REQUIRE(total(hnsw::huge_page_usage()) == before + 2 * hnsw::huge_page_size);
+        REQUIRE(reinterpret_cast<std::uintptr_t>(large.data()) % hnsw::huge_page_size == 0);
+        REQUIRE(large.back() == 2);
+        REQUIRE(small.back() == 1);
+    }
+
+    REQUIRE(total(hnsw::huge_page_usage()) == before);
+}
+
+
+TEST_CASE("huge page allocator uses its options") {
+    auto page_size = hnsw::detail::default_hugetlb_page_size();
+    REQUIRE(page_size >= 4096);
+    REQUIRE((page_size & (page_size - 1)) == 0);
+
+    hnsw::huge_page_options_t wrong;
+    wrong.page_size = 3 * hnsw::huge_page_size;
+    REQUIRE_THROWS_WITH(hnsw::huge_page_region_t(1, wrong), Catch::Contains("power of two"));
+
+    hnsw::huge_page_options_t options;
+    options.hugetlb = false;
+    options.transparent = false;
+    options.prefault = true;
+
+    hnsw::huge_page_allocator<uint64_t> allocator(options);
+    hnsw::huge_page_allocator<char> rebound(allocator);
+    REQUIRE(rebound.options() == options);
+    REQUIRE(rebound == allocator);
+    REQUIRE(allocator != hnsw::huge_page_allocator<uint64_t>());
+
+    auto before = hnsw::huge_page_usage();
+
+    {
+        std::vector<uint64_t, hnsw::huge_page_allocator<uint64_t>> large(hnsw::huge_page_size / 8, 3, allocator);
+        REQUIRE(hnsw::huge_page_usage().hugetlb == before.hugetlb);
+        REQUIRE(hnsw::huge_page_usage().none + hnsw::huge_page_usage().transparent ==
+                before.none + before.transparent + hnsw::huge_page_size);
+        REQUIRE(large.back() == 3);
+    }
+
+    using index_t = hnsw::hnsw_index<uint32_t,
+                                     std::vector<float>,
+                                     hnsw::l2_square_distance_t,
+                                     std::minstd_rand,
+                                     hnsw::huge_page_allocator<char>>;
+
+    index_t index {hnsw::huge_page_allocator<char>(options)};
+    index.insert(1, std::vector<float>(4, 1.0f));
+    REQUIRE(index.get_allocator().options() == options);
+    REQUIRE(index.nodes.at(1).layers.get_allocator().options() == options);
+}
@@ -36,14 +36,14 @@ TEST_CASE("hnsw with cosine distance compiles") {
     index.insert("fgh", random_vector(100, random));
     REQUIRE(index.check());
     REQUIRE(index.nodes.size() == 4);
-    REQUIRE(!index.levels.empty());
+    REQUIRE(!index.top_keys.empty());
 
     static_cast<const index_t &>(index).search(random_vector(100, random), 10);
 
     index.remove("bbb");
     REQUIRE(index.check());
     REQUIRE(index.nodes.size() == 3);
-    REQUIRE(!index.levels.empty());
+    REQUIRE(!index.top_keys.empty());
 
     static_cast<const index_t &>(index).search(random_vector(100, random), 10);
 
@@ -51,7 +51,7 @@ TEST_CASE("hnsw with cosine distance compiles") {
     index.insert("456", random_vector(100, random));
     REQUIRE(index.check());
     REQUIRE(index.nodes.size() == 5);
-    REQUIRE(!index.levels.empty());
+    REQUIRE(!index.top_keys.empty());
 
     static_cast<const index_t &>(index).search(random_vector(100, random), 10);
 
@@ -61,14 +61,14 @@ TEST_CASE("hnsw with cosine distance compiles") {
     index.remove("aaa");
     REQUIRE(index.check());
     REQUIRE(index.nodes.size() == 1);
-    REQUIRE(!index.levels.empty());
+    REQUIRE(!index.top_keys.empty());
 
     static_cast<const index_t &>(index).search(random_vector(100, random), 10);
 
     index.remove("123");
     REQUIRE(index.check());
     REQUIRE(index.nodes.size() == 0);
-    REQUIRE(index.levels.empty());
+    REQUIRE(index.top_keys.empty());
 
     static_cast<const index_t &>(index).search(random_vector(100, random), 10);
 }
@@ -86,14 +86,14 @@ TEST_CASE("hnsw with dot product distance compiles") {
     index.insert("fgh", random_vector(100, random));
     REQUIRE(index.check());
     REQUIRE(index.nodes.size() == 4);
-    REQUIRE(!index.levels.empty());
+    REQUIRE(!index.top_keys.empty());
 
     static_cast<const index_t &>(index).search(random_vector(100, random), 10);
 
     index.remove("bbb");
     REQUIRE(index.check());
     REQUIRE(index.nodes.size() == 3);
-    REQUIRE(!index.levels.empty());
+    REQUIRE(!index.top_keys.empty());
 
     static_cast<const index_t &>(index).search(random_vector(100, random), 10);
 
@@ -101,7 +101,7 @@ TEST_CASE("hnsw with dot product distance compiles") {
     index.insert("456", random_vector(100, random));
     REQUIRE(index.check());
     REQUIRE(index.nodes.size() == 5);
-    REQUIRE(!index.levels.empty());
+    REQUIRE(!index.top_keys.empty());
 
     static_cast<const index_t &>(index).search(random_vector(100, random), 10);
 
@@ -111,14 +111,14 @@ TEST_CASE("hnsw with dot product distance compiles") {
     index.remove("aaa");
     REQUIRE(index.check());
     REQUIRE(index.nodes.size() == 1);
-    REQUIRE(!index.levels.empty());
+    REQUIRE(!index.top_keys.empty());
 
     static_cast<const index_t &>(index).search(random_vector(100, random), 10);
 
     index.remove("123");
     REQUIRE(index.check());
     REQUIRE(index.nodes.size() == 0);
-    REQUIRE(index.levels.empty());
+    REQUIRE(index.top_keys.empty());
 
     static_cast<const index_t &>(index).search(random_vector(100, random), 10);
 }
@@ -136,14 +136,14 @@ TEST_CASE("hnsw with l2 square distance compiles") {
     index.insert("fgh", random_vector(100, random));
     REQUIRE(index.check());
     REQUIRE(index.nodes.size() == 4);
-    REQUIRE(!index.levels.empty());
+    REQUIRE(!index.top_keys.empty());
 
     static_cast<const index_t &>(index).search(random_vector(100, random), 10);
 
     index.remove("bbb");
     REQUIRE(index.check());
     REQUIRE(index.nodes.size() == 3);
-    REQUIRE(!index.levels.empty());
+    REQUIRE(!index.top_keys.empty());
 
     static_cast<const index_t &>(index).search(random_vector(100, random), 10);
 
@@ -151,7 +151,7 @@ TEST_CASE("hnsw with l2 square distance compiles") {
     index.insert("456", random_vector(100, random));
     REQUIRE(index.check());
     REQUIRE(index.nodes.size() == 5);
-    REQUIRE(!index.levels.empty());
+    REQUIRE(!index.top_keys.empty());
 
     static_cast<const index_t &>(index).search(random_vector(100, random), 10);
 
@@ -161,14 +161,14 @@ TEST_CASE("hnsw with l2 square distance compiles") {
     index.remove("aaa");
     REQUIRE(index.check());
     REQUIRE(index.nodes.size() == 1);
-    REQUIRE(!index.levels.empty());
+    REQUIRE(!index.top_keys.empty());
 
     static_cast<const index_t &>(index).search(random_vector(100, random), 10);
 
     index.remove("123");
     REQUIRE(index.check());
     REQUIRE(index.nodes.size() == 0);
-    REQUIRE(index.levels.empty());
+    REQUIRE(index.top_keys.empty());
 
     static_cast<const index_t &>(index).search(random_vector(100, random), 10);
 }
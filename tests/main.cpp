@@ -1,3 +1,6 @@
 #define CATCH_CONFIG_MAIN
 
+// Catch 1.x uses SIGSTKSZ as a constant expression, which is not the case with glibc >= 2.34.
+#define CATCH_CONFIG_NO_POSIX_SIGNALS
+
 #include <catch.hpp>
@@ -0,0 +1,353 @@
+#include <catch.hpp>
+
+#include <hnsw/distance.hpp>
+#include <hnsw/index.hpp>
+#include <hnsw/mapped_index.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+namespace {
+
+template<class Random>
+std::vector<float> random_vector(size_t size, Random &engine) {
+    std::uniform_real_distribution<float> generator(0.0, 1.0);
+    std::vector<float> result(size);
+
+    for (auto &v: result) {
+        v = generator(engine);
+    }
+
+    return result;
+}
+
+
+std::string temporary_file() {
+    char path[] = "/tmp/hnsw-unittests-XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    close(fd);
+    return path;
+}
+
+}
+
+
+TEST_CASE("mapped index searches like the original one") {
+    using index_t = hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::l2_square_distance_t>;
+    using mapped_index_t = hnsw::mapped_hnsw_index<uint32_t, float, hnsw::l2_square_distance_t>;
+
+    index_t index;
+    index.options.max_links = 8;
+    std::minstd_rand random;
+
+    for (uint32_t i = 0; i < 500; ++i) {
+        index.insert(i, random_vector(16, random));
+    }
+
+    for (uint32_t i = 0; i < 500; i += 5) {
+        index.remove(i);
+    }
+
+    auto path = temporary_file();
+
+    {
+        std::ofstream output(path, std::ios::binary);
+        hnsw::freeze(index, output);
+    }
+
+    mapped_index_t mapped(path);
+    std::remove(path.c_str());
+
+    REQUIRE(mapped.size() == index.nodes.size());
+    REQUIRE(mapped.dimension() == 16);
+    REQUIRE(mapped.check());
+    REQUIRE(mapped.key(0) == index.top_keys.front());
+
+    for (size_t i = 0; i < 20; ++i) {
+        auto target = random_vector(16, random);
+        auto expected = index.search(target, 10);
+        auto actual = mapped.search(target, 10);
+
+        REQUIRE(actual.size() == expected.size());
+
+        for (size_t j = 0; j < expected.size(); ++j) {
+            REQUIRE(actual[j].key == expected[j].key);
+            REQUIRE(actual[j].distance == expected[j].distance);
+        }
+    }
+
+    REQUIRE_THROWS(mapped.search(random_vector(8, random), 10));
+}
+
+
+TEST_CASE("mapped index loads the image into huge pages") {
+    using index_t = hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::l2_square_distance_t>;
+    using mapped_index_t = hnsw::mapped_hnsw_index<uint32_t, float, hnsw::l2_square_distance_t>;
+
+    index_t index;
+    std::minstd_rand random;
+
+    for (uint32_t i = 0; i < 300; ++i) {
+        index.insert(i, random_vector(8, random));
+    }
+
+    auto path = temporary_file();
+
+    {
+        std::ofstream output(path, std::ios::binary);
+        hnsw::freeze(index, output);
+    }
+
+    hnsw::huge_page_options_t options;
+    options.prefault = true;
+    auto loaded = mapped_index_t::load(path, options);
+    mapped_index_t mapped(path);
+    std::remove(path.c_str());
+
+    REQUIRE(mapped.huge_page_mode() == hnsw::huge_page_mode_t::none);
+    REQUIRE(loaded.size() == 300);
+    REQUIRE(loaded.check());
+
+    for (size_t i = 0; i < 20; ++i) {
+        auto target = random_vector(8, random);
+        auto expected = mapped.search(target, 10);
+        auto actual = loaded.search(target, 10);
+
+        REQUIRE(actual.size() == expected.size());
+
+        for (size_t j = 0; j < expected.size(); ++j) {
+            REQUIRE(actual[j].key == expected[j].key);
+        }
+    }
+
+    REQUIRE_THROWS(mapped_index_t::load(path));
+}
+
+
+TEST_CASE("mapped index works over memory and validates the image") {
+    using index_t = hnsw::hnsw_index<uint64_t, std::vector<float>, hnsw::dot_product_distance_t>;
+    using mapped_index_t = hnsw::mapped_hnsw_index<uint64_t, float, hnsw::dot_product_distance_t>;
+
+    std::minstd_rand random;
+    std::stringstream stream;
+
+    {
+        index_t empty;
+        hnsw::freeze(empty, stream);
+    }
+
+    std::string data = stream.str();
+    std::vector<uint64_t> image((data.size() + 7) / 8);
+    std::memcpy(image.data(), data.data(), data.size());
+
+    mapped_index_t empty_mapped(image.data(), data.size());
+    REQUIRE(empty_mapped.size() == 0);
+    REQUIRE(empty_mapped.search(random_vector(4, random), 10).empty());
+
+    index_t index;
+
+    for (uint64_t i = 0; i < 100; ++i) {
+        index.insert(i, random_vector(8, random));
+    }
+
+    stream.str("");
+    hnsw::freeze(index, stream);
+    data = stream.str();
+    image.assign((data.size() + 7) / 8, 0);
+    std::memcpy(image.data(), data.data(), data.size());
+
+    mapped_index_t mapped(image.data(), data.size());
+    REQUIRE(mapped.size() == 100);
+    REQUIRE(mapped.search(random_vector(8, random), 5).size() == 5);
+
+    REQUIRE_THROWS(mapped_index_t(image.data(), data.size() / 2));
+    REQUIRE_THROWS((hnsw::mapped_hnsw_index<uint32_t, float, hnsw::dot_product_distance_t>(image.data(), data.size())));
+
+    // 100 * 2^62 wraps around to zero, so the vectors would seem to take no space.
+    {
+        auto corrupted = image;
+        corrupted[offsetof(hnsw::detail::frozen_header_t, dimension) / 8] = uint64_t(1) << 62;
+        corrupted[offsetof(hnsw::detail::frozen_header_t, vector_stride) / 8] = 0;
+        REQUIRE_THROWS_WITH(mapped_index_t(corrupted.data(), data.size()), Catch::Contains("sizes are too large"));
+    }
+
+    {
+        auto corrupted = image;
+        corrupted[offsetof(hnsw::detail::frozen_header_t, tuned_ef_number) / 8] = uint64_t(1) << 63;
+        REQUIRE_THROWS_WITH(mapped_index_t(corrupted.data(), data.size()), Catch::Contains("sizes are too large"));
+    }
+
+    image[0] = 0;
+    REQUIRE_THROWS(mapped_index_t(image.data(), data.size()));
+}
+
+
+TEST_CASE("mapped index is shared between processes") {
+    using index_t = hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::l2_square_distance_t>;
+    using mapped_index_t = hnsw::mapped_hnsw_index<uint32_t, float, hnsw::l2_square_distance_t>;
+
+    index_t index;
+    std::minstd_rand random;
+
+    for (uint32_t i = 0; i < 300; ++i) {
+        index.insert(i, random_vector(8, random));
+    }
+
+    auto name = "/hnsw-unittests-" + std::to_string(getpid());
+    hnsw::publish_shared(index, name);
+
+    auto target = random_vector(8, random);
+    auto expected = index.search(target, 10);
+
+    // A worker process searches the same physical copy of the image.
+    pid_t pid = fork();
+    REQUIRE(pid >= 0);
+
+    if (pid == 0) {
+        int code = 1;
+
+        try {
+            auto worker = mapped_index_t::shared(name);
+            auto actual = worker.search(target, 10);
+            code = (actual.size() == expected.size() && actual.front().key == expected.front().key) ? 0 : 1;
+        } catch (...) {
+        }
+
+        _exit(code);
+    }
+
+    int status = 0;
+    REQUIRE(waitpid(pid, &status, 0) == pid);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+
+    auto mapped = mapped_index_t::shared(name);
+    hnsw::unlink_shared(name);
+
+    // The mapping outlives the name.
+    REQUIRE(mapped.check());
+    REQUIRE(mapped.search(target, 10).front().key == expected.front().key);
+    REQUIRE_THROWS(mapped_index_t::shared(name));
+}
+
+
+TEST_CASE("reordering places graph neighbors close to each other") {
+    using index_t = hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::l2_square_distance_t>;
+    using mapped_index_t = hnsw::mapped_hnsw_index<uint32_t, float, hnsw::l2_square_distance_t>;
+
+    index_t index;
+    index.options.max_links = 8;
+    index.options.ef_construction = 50;
+    std::minstd_rand random;
+
+    for (uint32_t i = 0; i < 2000; ++i) {
+        index.insert(i, random_vector(4, random));
+    }
+
+    // Share of links to nodes placed within 64 ids, i.e. a few pages of vectors.
+    auto near_links = [&](hnsw::reorder_method_t method) {
+        auto order = hnsw::detail::frozen_order(index, method);
+        std::map<uint32_t, size_t> ids;
+
+        for (size_t i = 0; i < order.size(); ++i) {
+            ids[order[i]] = i;
+        }
+
+        size_t near = 0;
+        size_t links = 0;
+
+        for (const auto &node: index.nodes) {
+            for (const auto &link: node.second.layers.front().outgoing) {
+                near += (std::abs(double(ids.at(node.first)) - double(ids.at(link.first))) < 64) ? 1 : 0;
+                ++links;
+            }
+        }
+
+        return double(near) / links;
+    };
+
+    auto unordered = near_links(hnsw::reorder_method_t::none);
+    REQUIRE(near_links(hnsw::reorder_method_t::bfs) > 1.5 * unordered);
+    REQUIRE(near_links(hnsw::reorder_method_t::reverse_cuthill_mckee) > 1.5 * unordered);
+
+    std::vector<std::vector<float>> targets;
+    std::vector<std::vector<index_t::search_result_t>> expected;
+
+    for (size_t i = 0; i < 20; ++i) {
+        targets.push_back(random_vector(4, random));
+        expected.push_back(index.search(targets.back(), 10));
+    }
+
+    // Share of links to nodes with vectors within 64 vectors in memory, i.e. the layout which reorder() actually produced.
+    auto near_in_memory = [&]() {
+        std::vector<std::pair<std::uintptr_t, uint32_t>> addresses;
+
+        for (const auto &node: index.nodes) {
+            addresses.emplace_back(reinterpret_cast<std::uintptr_t>(node.second.vector.data()), node.first);
+        }
+
+        std::sort(addresses.begin(), addresses.end());
+        std::map<uint32_t, size_t> ranks;
+
+        for (size_t i = 0; i < addresses.size(); ++i) {
+            ranks[addresses[i].second] = i;
+        }
+
+        size_t near = 0;
+        size_t links = 0;
+
+        for (const auto &node: index.nodes) {
+            for (const auto &link: node.second.layers.front().outgoing) {
+                near += (std::abs(double(ranks.at(node.first)) - double(ranks.at(link.first))) < 64) ? 1 : 0;
+                ++links;
+            }
+        }
+
+        return double(near) / links;
+    };
+
+    auto near_before = near_in_memory();
+
+    index.reorder(hnsw::reorder_method_t::reverse_cuthill_mckee);
+    REQUIRE(index.check());
+    REQUIRE(index.nodes.size() == 2000);
+
+    // The vectors are copied in the new order, and malloc places consecutive copies next to each other.
+    REQUIRE(near_in_memory() > 1.5 * near_before);
+
+    std::stringstream stream;
+    hnsw::freeze(index, stream, hnsw::reorder_method_t::bfs);
+    auto data = stream.str();
+    std::vector<uint64_t> image((data.size() + 7) / 8);
+    std::memcpy(image.data(), data.data(), data.size());
+    mapped_index_t mapped(image.data(), data.size());
+    REQUIRE(mapped.check());
+
+    for (size_t i = 0; i < targets.size(); ++i) {
+        auto actual = index.search(targets[i], 10);
+        auto mapped_actual = mapped.search(targets[i], 10);
+
+        REQUIRE(actual.size() == expected[i].size());
+        REQUIRE(mapped_actual.size() == expected[i].size());
+
+        for (size_t j = 0; j < actual.size(); ++j) {
+            REQUIRE(actual[j].key == expected[i][j].key);
+            REQUIRE(mapped_actual[j].distance == expected[i][j].distance);
+        }
+    }
+}
@@ -0,0 +1,199 @@
+#include <catch.hpp>
+
+#include <hnsw/distance.hpp>
+#include <hnsw/index.hpp>
+#include <hnsw/key_mapper.hpp>
+#include <hnsw/operation_log.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace {
+
+template<class Random>
+std::vector<float> random_vector(size_t size, Random &engine) {
+    std::uniform_real_distribution<float> generator(0.0, 1.0);
+    std::vector<float> result(size);
+
+    for (auto &v: result) {
+        v = generator(engine);
+    }
+
+    return result;
+}
+
+
+std::string temporary_file() {
+    char path[] = "/tmp/hnsw-unittests-XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    close(fd);
+    return path;
+}
+
+}
+
+
+TEST_CASE("operation log restores the index on top of a snapshot") {
+    using index_t = hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::l2_square_distance_t>;
+
+    auto path = temporary_file();
+    std::minstd_rand random;
+
+    index_t index;
+    std::stringstream snapshot;
+
+    {
+        hnsw::operation_log_options_t options;
+        options.group_records = 16;
+        options.sync = false;
+
+        hnsw::operation_log<index_t> log(path, options);
+
+        for (uint32_t i = 0; i < 100; ++i) {
+            auto vector = random_vector(8, random);
+            index.insert(i, vector);
+            log.insert(i, vector);
+        }
+
+        index.save(snapshot);
+        log.reset();
+
+        for (uint32_t i = 100; i < 150; ++i) {
+            auto vector = random_vector(8, random);
+            index.insert(i, vector);
+            log.insert(i, vector);
+        }
+
+        for (uint32_t i = 0; i < 150; i += 7) {
+            index.remove(i);
+            log.remove(i);
+        }
+
+        REQUIRE(log.pending_records() > 0);
+        log.commit();
+        REQUIRE(log.pending_records() == 0);
+    }
+
+    index_t restored;
+    restored.load(snapshot);
+    REQUIRE(hnsw::replay(path, restored) == 50 + 22);
+
+    REQUIRE(restored.check());
+    REQUIRE(restored.nodes.size() == index.nodes.size());
+
+    for (const auto &node: index.nodes) {
+        REQUIRE(restored.nodes.at(node.first).vector == node.second.vector);
+    }
+
+    // Replaying the same log again doesn't change anything.
+    REQUIRE(hnsw::replay(path, restored) == 72);
+    REQUIRE(restored.nodes.size() == index.nodes.size());
+
+    std::remove(path.c_str());
+}
+
+
+TEST_CASE("operation log survives a torn tail") {
+    using index_t = hnsw::key_mapper<std::string, hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::l2_square_distance_t>>;
+
+    auto path = temporary_file();
+    std::minstd_rand random;
+
+    {
+        hnsw::operation_log<index_t> log(path);
+
+        for (size_t i = 0; i < 10; ++i) {
+            log.insert("key" + std::to_string(i), random_vector(8, random));
+        }
+    }
+
+    // Emulate a crash in the middle of writing a record.
+    {
+        std::ofstream output(path, std::ios::binary | std::ios::app);
+        output.write("\x30\x00\x00\x00garbage", 11);
+    }
+
+    index_t index;
+    REQUIRE(hnsw::replay(path, index) == 10);
+    REQUIRE(index.keys.size() == 10);
+
+    // Reopening cuts off the torn tail, so new records are readable.
+    {
+        hnsw::operation_log<index_t> log(path);
+        log.remove("key3");
+    }
+
+    index_t restored;
+    REQUIRE(hnsw::replay(path, restored) == 11);
+    REQUIRE(restored.keys.size() == 9);
+    REQUIRE(restored.check());
+
+    std::remove(path.c_str());
+}
+
+
+TEST_CASE("operation log continues a partially written group after a write error") {
+    using index_t = hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::l2_square_distance_t>;
+
+    auto path = temporary_file();
+    std::minstd_rand random;
+
+    hnsw::operation_log_options_t options;
+    options.group_records = 1000;
+    options.sync = false;
+
+    {
+        hnsw::operation_log<index_t> log(path, options);
+
+        for (uint32_t i = 0; i < 10; ++i) {
+            log.insert(i, random_vector(8, random));
+        }
+
+        log.commit();
+
+        struct stat file_stat;
+        REQUIRE(stat(path.c_str(), &file_stat) == 0);
+
+        for (uint32_t i = 10; i < 20; ++i) {
+            log.insert(i, random_vector(8, random));
+        }
+
+        // Let the group be written only partially: the file can't grow by more than one and a half records.
+        auto old_handler = signal(SIGXFSZ, SIG_IGN);
+        rlimit old_limit;
+        REQUIRE(getrlimit(RLIMIT_FSIZE, &old_limit) == 0);
+
+        rlimit limit = old_limit;
+        limit.rlim_cur = rlim_t(file_stat.st_size) + 70;
+        REQUIRE(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+
+        REQUIRE_THROWS(log.commit());
+
+        REQUIRE(setrlimit(RLIMIT_FSIZE, &old_limit) == 0);
+        signal(SIGXFSZ, old_handler);
+
+        REQUIRE(log.pending_records() == 10);
+        log.commit();
+
+        log.remove(3);
+    }
+
+    index_t index;
+    REQUIRE(hnsw::replay(path, index) == 21);
+    REQUIRE(index.nodes.size() == 19);
+    REQUIRE(index.check());
+
+    std::remove(path.c_str());
+}
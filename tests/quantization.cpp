@@ -0,0 +1,369 @@
+#include <catch.hpp>
+
+#include <hnsw/binary_quantization.hpp>
+#include <hnsw/distance.hpp>
+#include <hnsw/half_float.hpp>
+#include <hnsw/index.hpp>
+#include <hnsw/key_mapper.hpp>
+#include <hnsw/product_quantization.hpp>
+#include <hnsw/rerank.hpp>
+#include <hnsw/scalar_quantization.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+
+namespace {
+
+template<class Random>
+std::vector<float> random_vector(size_t size, Random &engine) {
+    std::uniform_real_distribution<float> generator(0.0, 1.0);
+    std::vector<float> result(size);
+
+    for (auto &v: result) {
+        v = generator(engine);
+    }
+
+    return result;
+}
+
+
+// Share of the exact nearest neighbors found.
+template<class Results>
+double recall(const std::vector<std::vector<float>> &vectors, const std::vector<float> &target, const Results &results) {
+    hnsw::l2_square_distance_t distance;
+    std::vector<std::pair<float, uint32_t>> exact;
+
+    for (uint32_t i = 0; i < vectors.size(); ++i) {
+        exact.emplace_back(distance(target, vectors[i]), i);
+    }
+
+    std::partial_sort(exact.begin(), exact.begin() + results.size(), exact.end());
+
+    size_t found = 0;
+
+    for (const auto &result: results) {
+        for (size_t i = 0; i < results.size(); ++i) {
+            found += (exact[i].second == result.key) ? 1 : 0;
+        }
+    }
+
+    return double(found) / results.size();
+}
+
+}
+
+
+TEST_CASE("sq8 kernels match the scalar implementation") {
+    std::minstd_rand random;
+    std::uniform_int_distribution<int> code(0, 255);
+
+    for (size_t size = 0; size < 70; ++size) {
+        auto query = random_vector(size, random);
+        auto weights = random_vector(size, random);
+        std::vector<uint8_t> one(size);
+        std::vector<uint8_t> another(size);
+
+        for (size_t i = 0; i < size; ++i) {
+            query[i] *= 255;
+            one[i] = uint8_t(code(random));
+            another[i] = uint8_t(code(random));
+        }
+
+        auto asymmetric = hnsw::detail::sq8_l2_asymmetric_scalar(query.data(), weights.data(), one.data(), size);
+        auto symmetric = hnsw::detail::sq8_l2_symmetric_scalar(weights.data(), one.data(), another.data(), size);
+
+        REQUIRE(hnsw::detail::sq8_l2_asymmetric(query.data(), weights.data(), one.data(), size) == Approx(asymmetric).epsilon(1e-4));
+        REQUIRE(hnsw::detail::sq8_l2_symmetric(weights.data(), one.data(), another.data(), size) == Approx(symmetric).epsilon(1e-4));
+    }
+}
+
+
+TEST_CASE("sq8 index finds nearest neighbors") {
+    using index_t = hnsw::hnsw_index<uint32_t, hnsw::sq8_codes_t<32>, hnsw::sq8_l2_distance_t>;
+
+    std::minstd_rand random;
+    std::vector<std::vector<float>> vectors;
+
+    for (size_t i = 0; i < 1000; ++i) {
+        vectors.push_back(random_vector(32, random));
+    }
+
+    hnsw::sq8_quantizer_t quantizer;
+    quantizer.train(vectors);
+
+    auto decoded = quantizer.decode(quantizer.encode(vectors.front()));
+
+    for (size_t i = 0; i < decoded.size(); ++i) {
+        REQUIRE(std::abs(decoded[i] - vectors.front()[i]) <= 0.5f / 255 + 1e-6f);
+    }
+
+    // Inline codes are the same as the ones of a runtime dimension and take just one byte per dimension.
+    REQUIRE(quantizer.decode(quantizer.encode<hnsw::sq8_codes_t<32>>(vectors.front())) == decoded);
+    REQUIRE_THROWS(quantizer.encode<hnsw::sq8_codes_t<16>>(vectors.front()));
+    REQUIRE(sizeof(hnsw::sq8_codes_t<32>) == 32);
+
+    index_t index;
+    index.options.ef_construction = 50;
+    index.distance = quantizer.l2_distance();
+
+    for (uint32_t i = 0; i < vectors.size(); ++i) {
+        index.insert(i, quantizer.encode<hnsw::sq8_codes_t<32>>(vectors[i]));
+    }
+
+    REQUIRE(index.check());
+    REQUIRE(index.nodes.at(0).vector.size() == 32);
+
+    double total_recall = 0;
+
+    for (size_t i = 0; i < 50; ++i) {
+        auto target = random_vector(32, random);
+        auto candidates = index.search(quantizer.query(target), 40);
+
+        auto results = hnsw::rerank(candidates, 10, target, [&](uint32_t key) -> const std::vector<float> & {
+            return vectors[key];
+        }, hnsw::l2_square_distance_t());
+
+        REQUIRE(results.size() == 10);
+        REQUIRE(std::is_sorted(results.begin(), results.end(), [](const auto &one, const auto &another) {
+            return one.distance < another.distance;
+        }));
+
+        total_recall += recall(vectors, target, results);
+    }
+
+    REQUIRE(total_recall / 50 > 0.95);
+
+    std::stringstream stream;
+    quantizer.save(stream);
+    index.save(stream);
+
+    hnsw::sq8_quantizer_t loaded_quantizer;
+    loaded_quantizer.load(stream);
+
+    index_t loaded;
+    loaded.distance = loaded_quantizer.l2_distance();
+    loaded.load(stream);
+
+    auto target = random_vector(32, random);
+    REQUIRE(loaded.search(loaded_quantizer.query(target), 10).front().key == index.search(quantizer.query(target), 10).front().key);
+}
+
+
+TEST_CASE("pq index finds nearest neighbors after reranking") {
+    using index_t = hnsw::hnsw_index<uint32_t, hnsw::pq_codes_t<8>, hnsw::pq_l2_distance_t>;
+
+    std::minstd_rand random;
+    std::vector<std::vector<float>> vectors;
+
+    for (size_t i = 0; i < 1000; ++i) {
+        vectors.push_back(random_vector(16, random));
+    }
+
+    hnsw::pq_quantizer_t quantizer;
+    REQUIRE_THROWS(quantizer.train(vectors, 5));
+
+    quantizer.train(vectors, 8, 32);
+    REQUIRE(quantizer.encode(vectors.front()).size() == 8);
+
+    auto query = quantizer.query(vectors.front());
+    auto codes = quantizer.encode(vectors.back());
+    auto distance = quantizer.l2_distance();
+    auto decoded = quantizer.decode(codes);
+
+    // Asymmetric distance is the exact distance to the decoded vector.
+    REQUIRE(distance(query, codes) == Approx(hnsw::l2_square_distance_t()(vectors.front(), decoded)).epsilon(1e-4));
+    REQUIRE(distance(codes, codes) == 0);
+
+    // Inline codes take one byte per subspace.
+    auto inline_codes = quantizer.encode<hnsw::pq_codes_t<8>>(vectors.back());
+    REQUIRE(sizeof(inline_codes) == 8);
+    REQUIRE(std::equal(codes.codes.begin(), codes.codes.end(), inline_codes.codes.begin(), inline_codes.codes.end()));
+    REQUIRE(distance(query, inline_codes) == distance(query, codes));
+
+    index_t index;
+    index.options.ef_construction = 50;
+    index.distance = distance;
+
+    for (uint32_t i = 0; i < vectors.size(); ++i) {
+        index.insert(i, quantizer.encode<hnsw::pq_codes_t<8>>(vectors[i]));
+    }
+
+    REQUIRE(index.check());
+
+    double total_recall = 0;
+
+    for (size_t i = 0; i < 50; ++i) {
+        auto target = random_vector(16, random);
+        hnsw::search_stats_t stats;
+
+        auto results = index.search_reranked(quantizer.query(target), target, 10, 50, 100, [&](uint32_t key) -> const std::vector<float> & {
+            return vectors[key];
+        }, hnsw::l2_square_distance_t(), stats);
+
+        REQUIRE(results.size() == 10);
+        REQUIRE(stats.distance_computations > 50);
+
+        total_recall += recall(vectors, target, results);
+    }
+
+    REQUIRE(total_recall / 50 > 0.9);
+
+    std::stringstream stream;
+    quantizer.save(stream);
+
+    hnsw::pq_quantizer_t loaded;
+    loaded.load(stream);
+    REQUIRE(loaded.decode(codes) == decoded);
+}
+
+
+TEST_CASE("half precision floats convert with rounding") {
+    REQUIRE(float(hnsw::float16_t(1.0f)) == 1.0f);
+    REQUIRE(float(hnsw::float16_t(-2.5f)) == -2.5f);
+    REQUIRE(float(hnsw::float16_t(65504.0f)) == 65504.0f);
+    REQUIRE(std::isinf(float(hnsw::float16_t(65520.0f))));
+    REQUIRE(std::isnan(float(hnsw::float16_t(std::numeric_limits<float>::quiet_NaN()))));
+    REQUIRE(float(hnsw::float16_t(std::ldexp(1.0f, -24))) == std::ldexp(1.0f, -24));
+    REQUIRE(float(hnsw::float16_t(std::ldexp(1.0f, -26))) == 0.0f);
+
+    // Ties round to even.
+    REQUIRE(float(hnsw::float16_t(1.0f + std::ldexp(1.0f, -11))) == 1.0f);
+    REQUIRE(float(hnsw::float16_t(1.0f + 3 * std::ldexp(1.0f, -11))) == 1.0f + std::ldexp(1.0f, -9));
+
+    REQUIRE(float(hnsw::bfloat16_t(1.0f)) == 1.0f);
+    REQUIRE(float(hnsw::bfloat16_t(1e30f)) == Approx(1e30f).epsilon(1e-2));
+    REQUIRE(float(hnsw::bfloat16_t(1.0f + std::ldexp(1.0f, -8))) == 1.0f);
+    REQUIRE(std::isnan(float(hnsw::bfloat16_t(std::numeric_limits<float>::quiet_NaN()))));
+
+    std::minstd_rand random;
+
+    for (size_t size = 0; size < 40; ++size) {
+        auto one = random_vector(size, random);
+        auto another = random_vector(size, random);
+        auto half = hnsw::to_half_vector<hnsw::float16_t>(another);
+        auto bfloat = hnsw::to_half_vector<hnsw::bfloat16_t>(another);
+
+        REQUIRE(hnsw::l2_square_distance_t()(one, half) == Approx(hnsw::l2_square_distance_t()(one, another)).epsilon(1e-2));
+        REQUIRE(hnsw::l2_square_distance_t()(half, half) == 0);
+        REQUIRE(hnsw::detail::dot_product(bfloat.data(), bfloat.data(), size) ==
+                Approx(hnsw::detail::dot_product_half_scalar(bfloat.data(), bfloat.data(), size)).epsilon(1e-4));
+        REQUIRE(hnsw::detail::dot_product(one.data(), half.data(), size) ==
+                Approx(hnsw::detail::dot_product_half_scalar(one.data(), half.data(), size)).epsilon(1e-4));
+    }
+}
+
+
+TEST_CASE("float16 index is searched with float queries") {
+    using index_t = hnsw::hnsw_index<uint32_t, std::vector<hnsw::float16_t>, hnsw::l2_square_distance_t>;
+
+    std::minstd_rand random;
+    std::vector<std::vector<float>> vectors;
+    index_t index;
+    index.options.ef_construction = 50;
+
+    for (uint32_t i = 0; i < 1000; ++i) {
+        vectors.push_back(random_vector(16, random));
+        index.insert(i, hnsw::to_half_vector<hnsw::float16_t>(vectors.back()));
+    }
+
+    REQUIRE(index.check());
+
+    double total_recall = 0;
+
+    for (size_t i = 0; i < 50; ++i) {
+        auto target = random_vector(16, random);
+        total_recall += recall(vectors, target, index.search(target, 10));
+    }
+
+    REQUIRE(total_recall / 50 > 0.95);
+}
+
+
+TEST_CASE("binary index finds nearest neighbors after reranking") {
+    using index_t = hnsw::hnsw_index<uint32_t, std::vector<uint64_t>, hnsw::hamming_distance_t>;
+
+    std::minstd_rand random;
+
+    for (size_t size = 0; size < 20; ++size) {
+        std::vector<uint64_t> one(size);
+        std::vector<uint64_t> another(size);
+
+        for (size_t i = 0; i < size; ++i) {
+            one[i] = (uint64_t(random()) << 32) ^ random();
+            another[i] = (uint64_t(random()) << 32) ^ random();
+        }
+
+        REQUIRE(hnsw::hamming_distance_t()(one, another) == hnsw::detail::hamming_distance_scalar(one.data(), another.data(), size));
+        REQUIRE(hnsw::hamming_distance_t()(one, one) == 0);
+    }
+
+    std::vector<std::vector<float>> vectors;
+
+    for (size_t i = 0; i < 1000; ++i) {
+        vectors.push_back(random_vector(256, random));
+    }
+
+    hnsw::binary_quantizer_t quantizer;
+    REQUIRE(quantizer.encode(std::vector<float> {1, -1, 2}) == std::vector<uint64_t> {5});
+
+    quantizer.train(vectors);
+
+    index_t index;
+    index.options.ef_construction = 50;
+
+    for (uint32_t i = 0; i < vectors.size(); ++i) {
+        index.insert(i, quantizer.encode(vectors[i]));
+    }
+
+    REQUIRE(index.check());
+    REQUIRE(index.nodes.at(0).vector.size() == 4);
+
+    double total_recall = 0;
+
+    for (size_t i = 0; i < 20; ++i) {
+        auto target = random_vector(256, random);
+
+        auto results = index.search_reranked(quantizer.encode(target), target, 10, 200, [&](uint32_t key) -> const std::vector<float> & {
+            return vectors[key];
+        }, hnsw::l2_square_distance_t());
+
+        static_assert(std::is_same<decltype(results.front().distance), float>::value, "exact distances are float");
+
+        total_recall += recall(vectors, target, results);
+    }
+
+    REQUIRE(total_recall / 20 > 0.8);
+}
+
+
+TEST_CASE("key mapper reranks with vectors stored by its keys") {
+    using index_t = hnsw::key_mapper<std::string, hnsw::hnsw_index<uint32_t, std::vector<hnsw::float16_t>, hnsw::l2_square_distance_t>>;
+
+    std::minstd_rand random;
+    std::map<std::string, std::vector<float>, std::less<>> vectors;
+    index_t index;
+
+    for (size_t i = 0; i < 200; ++i) {
+        auto key = "key" + std::to_string(i);
+        vectors[key] = random_vector(8, random);
+        index.insert(key, hnsw::to_half_vector<hnsw::float16_t>(vectors[key]));
+    }
+
+    auto target = vectors.at("key42");
+
+    auto results = index.search_reranked(target, target, 5, 20, [&](hnsw::string_view key) -> const std::vector<float> & {
+        return vectors.find(key)->second;
+    }, hnsw::l2_square_distance_t());
+
+    REQUIRE(results.size() == 5);
+    REQUIRE(results.front().key == "key42");
+    REQUIRE(results.front().distance == 0);
+}
@@ -0,0 +1,493 @@
+#include <catch.hpp>
+
+#include <hnsw/distance.hpp>
+#include <hnsw/index.hpp>
+#include <hnsw/key_mapper.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+template<class Random>
+std::vector<float> random_vector(size_t size, Random &engine) {
+    std::uniform_real_distribution<float> generator(0.0, 1.0);
+    std::vector<float> result(size);
+
+    for (auto &v: result) {
+        v = generator(engine);
+    }
+
+    return result;
+}
+
+}
+
+
+TEST_CASE("adaptive termination returns sorted nearest neighbors") {
+    using index_t = hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::l2_square_distance_t>;
+
+    index_t index;
+    index.options.search_termination = hnsw::index_options_t::search_termination_t::adaptive;
+    index.options.max_unproductive_hops = 4;
+
+    std::minstd_rand random;
+
+    for (uint32_t i = 0; i < 500; ++i) {
+        index.insert(i, random_vector(16, random));
+    }
+
+    REQUIRE(index.check());
+
+    for (size_t i = 0; i < 10; ++i) {
+        auto target = random_vector(16, random);
+        auto results = index.search(target, 10);
+
+        REQUIRE(results.size() == 10);
+        REQUIRE(std::is_sorted(results.begin(), results.end(), [](const auto &l, const auto &r) {
+            return l.distance < r.distance;
+        }));
+    }
+
+    // The node itself must be found even with aggressive early termination.
+    auto exact = index.search(index.nodes.at(42).vector, 1);
+    REQUIRE(exact.size() == 1);
+    REQUIRE(exact.front().key == 42);
+}
+
+
+TEST_CASE("adaptive termination computes fewer distances at about the same recall") {
+    using index_t = hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::l2_square_distance_t>;
+
+    index_t index;
+    std::minstd_rand random;
+    std::vector<std::vector<float>> vectors;
+
+    for (uint32_t i = 0; i < 3000; ++i) {
+        vectors.push_back(random_vector(16, random));
+        index.insert(i, vectors.back());
+    }
+
+    std::vector<std::vector<float>> queries;
+
+    for (size_t i = 0; i < 100; ++i) {
+        queries.push_back(random_vector(16, random));
+    }
+
+    // Average recall of 10 nearest neighbors and the total number of distance computations over the queries.
+    auto measure = [&](double &recall, size_t &distance_computations) {
+        hnsw::l2_square_distance_t distance;
+        size_t found = 0;
+        distance_computations = 0;
+
+        for (const auto &query: queries) {
+            std::vector<std::pair<float, uint32_t>> exact;
+
+            for (uint32_t i = 0; i < vectors.size(); ++i) {
+                exact.emplace_back(distance(query, vectors[i]), i);
+            }
+
+            std::partial_sort(exact.begin(), exact.begin() + 10, exact.end());
+
+            hnsw::search_stats_t stats;
+
+            for (const auto &result: index.search(query, 10, 200, stats)) {
+                for (size_t i = 0; i < 10; ++i) {
+                    found += (exact[i].second == result.key) ? 1 : 0;
+                }
+            }
+
+            distance_computations += stats.distance_computations;
+        }
+
+        recall = double(found) / double(10 * queries.size());
+    };
+
+    double exhaustive_recall = 0;
+    size_t exhaustive_computations = 0;
+    measure(exhaustive_recall, exhaustive_computations);
+
+    index.options.search_termination = hnsw::index_options_t::search_termination_t::adaptive;
+    index.options.max_unproductive_hops = 64;
+
+    double adaptive_recall = 0;
+    size_t adaptive_computations = 0;
+    measure(adaptive_recall, adaptive_computations);
+
+    // With ef = 200 adaptive termination saves about 30% of distance computations here and loses 0.1% of recall.
+    // Require at least 10% and allow up to 1%.
+    REQUIRE(adaptive_computations < exhaustive_computations * 9 / 10);
+    REQUIRE(adaptive_recall >= exhaustive_recall - 0.01);
+}
+
+
+TEST_CASE("autotune finds ef reaching the target recall") {
+    using index_t = hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::l2_square_distance_t>;
+
+    index_t index;
+    std::minstd_rand random;
+
+    for (uint32_t i = 0; i < 500; ++i) {
+        index.insert(i, random_vector(16, random));
+    }
+
+    std::vector<std::vector<float>> sample;
+
+    for (size_t i = 0; i < 20; ++i) {
+        sample.push_back(random_vector(16, random));
+    }
+
+    auto ef = index.autotune(sample, 10, 0.95);
+
+    REQUIRE(ef >= 10);
+    REQUIRE(ef <= index.nodes.size());
+    REQUIRE(index.tuned_ef.at(10) == ef);
+
+    // Smaller numbers of neighbors use ef tuned for 10.
+    REQUIRE(index.search(sample.front(), 5).size() == 5);
+    REQUIRE(index.search(sample.front(), 10).size() == 10);
+
+    // A recall which can't be exceeded is reached by the smallest ef.
+    REQUIRE(index.autotune(sample, 1, 0.0) == 1);
+}
+
+
+TEST_CASE("search fills search statistics") {
+    using index_t = hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::l2_square_distance_t>;
+
+    index_t index;
+    std::minstd_rand random;
+
+    hnsw::search_stats_t empty_stats;
+    REQUIRE(index.search(random_vector(16, random), 10, 50, empty_stats).empty());
+    REQUIRE(empty_stats.distance_computations == 0);
+
+    for (uint32_t i = 0; i < 500; ++i) {
+        index.insert(i, random_vector(16, random));
+    }
+
+    hnsw::search_stats_t stats;
+    auto results = index.search(random_vector(16, random), 10, 50, stats);
+
+    REQUIRE(results.size() == 10);
+    REQUIRE(stats.hops.size() == index.level_counts.size());
+    REQUIRE(stats.hops.front() > 0);
+    REQUIRE(stats.distance_computations >= stats.visited_nodes);
+    REQUIRE(stats.visited_nodes >= 50);
+    REQUIRE(stats.max_search_front_size > 0);
+}
+
+
+TEST_CASE("index counts operations") {
+    using index_t = hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::l2_square_distance_t>;
+
+    index_t index;
+    std::minstd_rand random;
+
+    for (uint32_t i = 0; i < 200; ++i) {
+        index.insert(i, random_vector(16, random));
+    }
+
+    REQUIRE_THROWS(index.insert(0, random_vector(16, random)));
+
+    hnsw::search_stats_t search_stats;
+    index.search(random_vector(16, random), 10, 50, search_stats);
+    index.search(random_vector(16, random), 10);
+
+    for (uint32_t i = 0; i < 150; ++i) {
+        index.remove(i);
+    }
+
+    index.remove(1000);
+
+    auto stats = index.stats_snapshot();
+
+    REQUIRE(stats.inserts == 200);
+    REQUIRE(stats.removes == 150);
+    REQUIRE(stats.searches == 2);
+    REQUIRE(stats.distance_computations > search_stats.distance_computations);
+    REQUIRE(stats.repair_links > 0);
+    REQUIRE(stats.rehashes > 0);
+    REQUIRE(stats.insert_time.count() > 0);
+    REQUIRE(stats.remove_time.count() > 0);
+    REQUIRE(stats.search_time.count() > 0);
+
+    // Copies of the index carry the counters.
+    index_t copy = index;
+    REQUIRE(copy.stats_snapshot().inserts == 200);
+}
+
+
+TEST_CASE("node links outgrow their capacity when max_links is increased") {
+    using index_t = hnsw::hnsw_index<std::string, std::vector<float>, hnsw::l2_square_distance_t>;
+
+    index_t index;
+    index.options.max_links = 4;
+    index.options.ef_construction = 50;
+
+    std::minstd_rand random;
+
+    for (size_t i = 0; i < 300; ++i) {
+        index.insert(std::to_string(i), random_vector(4, random));
+    }
+
+    index.options.max_links = 8;
+
+    for (size_t i = 300; i < 600; ++i) {
+        index.insert(std::to_string(i), random_vector(4, random));
+    }
+
+    for (size_t i = 0; i < 600; i += 7) {
+        index.remove(std::to_string(i));
+    }
+
+    REQUIRE(index.check());
+
+    size_t grown = 0;
+
+    for (const auto &node: index.nodes) {
+        grown += (std::stoul(node.first) < 300 && node.second.layers[0].outgoing.size() > 8) ? 1 : 0;
+    }
+
+    REQUIRE(grown > 0);
+
+    auto copy = index;
+    REQUIRE(copy.check());
+
+    for (size_t i = 0; i < 10; ++i) {
+        auto target = random_vector(4, random);
+        auto expected = index.search(target, 10);
+        auto actual = copy.search(target, 10);
+
+        REQUIRE(actual.size() == expected.size());
+
+        for (size_t j = 0; j < actual.size(); ++j) {
+            REQUIRE(actual[j].key == expected[j].key);
+        }
+    }
+}
+
+
+TEST_CASE("compact shrinks links and hash tables without changing the graph") {
+    using index_t = hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::l2_square_distance_t>;
+
+    index_t index;
+    index.options.max_links = 8;
+    index.options.ef_construction = 50;
+
+    std::minstd_rand random;
+
+    for (uint32_t i = 0; i < 1000; ++i) {
+        index.insert(i, random_vector(4, random));
+    }
+
+    for (uint32_t i = 0; i < 1000; ++i) {
+        if (i % 3 != 0) {
+            index.remove(i);
+        }
+    }
+
+    auto allocated_bytes = [&index]() {
+        size_t result = 0;
+
+        for (const auto &node: index.nodes) {
+            result += node.second.layers.allocated_bytes();
+        }
+
+        return result;
+    };
+
+    std::vector<std::vector<float>> queries;
+    std::vector<std::vector<index_t::search_result_t>> expected;
+
+    for (size_t i = 0; i < 10; ++i) {
+        queries.push_back(random_vector(4, random));
+        expected.push_back(index.search(queries.back(), 10));
+    }
+
+    auto bytes_before = allocated_bytes();
+    auto buckets_before = index.nodes.bucket_count();
+
+    // Links fit into the capacity for the smaller max_links now, so they are shrunk to it.
+    index.options.max_links = 4;
+
+    auto compaction = index.start_compaction();
+    size_t slices = 1;
+
+    while (!index.compact(compaction, std::chrono::nanoseconds(0))) {
+        ++slices;
+    }
+
+    REQUIRE(slices > 1);
+    REQUIRE(index.check());
+    REQUIRE(allocated_bytes() < bytes_before);
+    REQUIRE(index.nodes.bucket_count() <= buckets_before);
+
+    for (size_t i = 0; i < queries.size(); ++i) {
+        auto actual = index.search(queries[i], 10);
+
+        REQUIRE(actual.size() == expected[i].size());
+
+        for (size_t j = 0; j < actual.size(); ++j) {
+            REQUIRE(actual[j].key == expected[i][j].key);
+        }
+    }
+
+    for (uint32_t i = 1000; i < 1100; ++i) {
+        index.insert(i, random_vector(4, random));
+    }
+
+    index.compact();
+    REQUIRE(index.check());
+}
+
+
+TEST_CASE("reserved tables don't rehash on inserts and removes") {
+    using index_t = hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::l2_square_distance_t>;
+
+    index_t index;
+    index.options.max_links = 8;
+    index.options.ef_construction = 50;
+    index.reserve(2000);
+
+    auto nodes_buckets = index.nodes.bucket_count();
+    std::minstd_rand random;
+
+    for (uint32_t i = 0; i < 2000; ++i) {
+        index.insert(i, random_vector(4, random));
+    }
+
+    for (uint32_t i = 0; i < 1900; ++i) {
+        index.remove(i);
+    }
+
+    REQUIRE(index.check());
+    REQUIRE(index.nodes.bucket_count() == nodes_buckets);
+
+    index.compact();
+    REQUIRE(index.check());
+    REQUIRE(index.nodes.bucket_count() < nodes_buckets);
+}
+
+
+TEST_CASE("a new entry point is found when the top level is removed") {
+    using index_t = hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::l2_square_distance_t>;
+
+    index_t index;
+    index.options.max_links = 4;
+    index.options.ef_construction = 20;
+
+    std::minstd_rand random;
+
+    for (uint32_t i = 0; i < 1000; ++i) {
+        index.insert(i, random_vector(4, random));
+    }
+
+    // Remove entry points until the top level is the bottom one.
+    while (index.level_counts.size() > 1) {
+        auto top_level = index.level_counts.size();
+        auto entry_point = index.top_keys.front();
+
+        index.remove(entry_point);
+
+        REQUIRE(index.check());
+        REQUIRE(index.nodes.at(index.top_keys.front()).layers.size() == index.level_counts.size());
+        REQUIRE(index.level_counts.size() <= top_level);
+        REQUIRE(index.search(random_vector(4, random), 5).size() == 5);
+    }
+
+    // All nodes are on the top level now, and removing any of them keeps the rest there.
+    REQUIRE(index.top_keys.size() == index.nodes.size());
+
+    for (size_t i = 0; !index.nodes.empty(); ++i) {
+        index.remove(index.top_keys[i % index.top_keys.size()]);
+        REQUIRE(index.top_keys.size() == index.nodes.size());
+    }
+
+    REQUIRE(index.check());
+    REQUIRE(index.level_counts.empty());
+}
+
+
+TEST_CASE("key mapper stores string keys once and drops removed ones on compact") {
+    using index_t = hnsw::key_mapper<std::string, hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::l2_square_distance_t>>;
+
+    index_t index;
+    std::minstd_rand random;
+
+    for (size_t i = 0; i < 1000; ++i) {
+        index.insert("a rather long key number " + std::to_string(i), random_vector(4, random));
+    }
+
+    for (size_t i = 0; i < 1000; i += 2) {
+        index.remove("a rather long key number " + std::to_string(i));
+    }
+
+    auto used_bytes = index.keys.used_bytes();
+    auto allocated_bytes = index.keys.allocated_bytes();
+
+    // Characters of the removed keys are given back.
+    index.compact();
+    REQUIRE(index.check());
+    REQUIRE(index.keys.used_bytes() == used_bytes);
+    REQUIRE(index.keys.allocated_bytes() + 500 * std::string("a rather long key number ").size() < allocated_bytes);
+
+    for (size_t i = 1; i < 1000; i += 2) {
+        auto key = "a rather long key number " + std::to_string(i);
+        auto internal_key = index.keys.find(key);
+
+        REQUIRE(internal_key);
+        REQUIRE(index.keys.key(*internal_key) == key);
+    }
+
+    index.insert("a rather long key number 0", random_vector(4, random));
+    REQUIRE(index.keys.internal_size() == 1000);
+
+    auto result = index.search(random_vector(4, random), 10);
+    REQUIRE(result.size() == 10);
+    REQUIRE(index.keys.find(std::string(result.front().key)));
+}
+
+
+TEST_CASE("key table inserts string keys in amortized constant time") {
+    hnsw::key_table<std::string, uint32_t> keys;
+
+    // Arrays grow geometrically, so the allocated size changes only a few times.
+    size_t resizes = 0;
+    auto allocated_bytes = keys.allocated_bytes();
+
+    for (uint32_t i = 0; i < 100000; ++i) {
+        REQUIRE(keys.insert("key " + std::to_string(i)).first == i);
+
+        if (keys.allocated_bytes() != allocated_bytes) {
+            allocated_bytes = keys.allocated_bytes();
+            ++resizes;
+        }
+    }
+
+    REQUIRE(resizes < 200);
+    REQUIRE(keys.size() == 100000);
+    REQUIRE(keys.key(12345) == "key 12345");
+
+    keys.erase(12345);
+    REQUIRE(keys.find("key 12345") == nullptr);
+    REQUIRE(keys.insert("another key").first == 12345);
+
+    auto moved = std::move(keys);
+    REQUIRE(moved.size() == 100000);
+    REQUIRE(moved.key(12345) == "another key");
+
+    // The moved-from table is empty and can be used.
+    REQUIRE(keys.empty());
+    REQUIRE(keys.insert("key 0").first == 0);
+    REQUIRE(*keys.find("key 0") == 0);
+
+    keys = std::move(moved);
+    REQUIRE(keys.size() == 100000);
+    REQUIRE(moved.empty());
+    REQUIRE(moved.insert("key 1").first == 0);
+}
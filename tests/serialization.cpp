@@ -0,0 +1,407 @@
+#include <catch.hpp>
+
+#include <hnsw/checkpoint.hpp>
+#include <hnsw/distance.hpp>
+#include <hnsw/index.hpp>
+#include <hnsw/key_mapper.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+
+namespace {
+
+template<class Random>
+std::vector<float> random_vector(size_t size, Random &engine) {
+    std::uniform_real_distribution<float> generator(0.0, 1.0);
+    std::vector<float> result(size);
+
+    for (auto &v: result) {
+        v = generator(engine);
+    }
+
+    return result;
+}
+
+
+// Write the index in the layout of the first version of HNSWIDX: the nodes follow each other without chunks.
+template<class Index>
+void write_first_version(std::ostream &stream, const Index &index) {
+    using key_t = typename Index::key_t;
+    using scalar_t = typename Index::scalar_t;
+
+    hnsw::detail::stream_writer_t writer(stream);
+
+    hnsw::detail::write_header(writer, "HNSWIDX", 1);
+    hnsw::detail::write_value(writer, std::uint8_t(sizeof(scalar_t)));
+    hnsw::detail::write_value(writer, std::uint64_t(index.options.max_links));
+    hnsw::detail::write_value(writer, std::uint64_t(index.options.ef_construction));
+    hnsw::detail::write_value(writer, std::uint8_t(index.options.insert_method));
+    hnsw::detail::write_value(writer, std::uint8_t(index.options.remove_method));
+    hnsw::detail::write_value(writer, std::uint8_t(index.options.search_termination));
+    hnsw::detail::write_value(writer, std::uint64_t(index.options.max_unproductive_hops));
+    hnsw::detail::write_random(writer, index.random);
+    hnsw::detail::write_value(writer, std::uint64_t(index.tuned_ef.size()));
+
+    for (const auto &ef: index.tuned_ef) {
+        hnsw::detail::write_value(writer, std::uint64_t(ef.first));
+        hnsw::detail::write_value(writer, std::uint64_t(ef.second));
+    }
+
+    hnsw::detail::write_value(writer, std::uint64_t(index.nodes.size()));
+
+    for (const auto &node: index.nodes) {
+        hnsw::detail::write_value(writer, node.first);
+        hnsw::detail::write_value(writer, node.second.vector);
+        hnsw::detail::write_value(writer, std::uint32_t(node.second.layers.size()));
+
+        for (const auto layer: node.second.layers) {
+            std::vector<key_t> keys;
+            std::vector<scalar_t> distances;
+
+            for (const auto &link: layer.outgoing) {
+                keys.push_back(link.first);
+                distances.push_back(link.second);
+            }
+
+            hnsw::detail::write_value(writer, keys);
+            hnsw::detail::write_value(writer, distances);
+
+            keys.assign(layer.incoming.begin(), layer.incoming.end());
+            hnsw::detail::write_value(writer, keys);
+        }
+    }
+}
+
+}
+
+
+TEST_CASE("hnsw index survives save and load") {
+    using index_t = hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::l2_square_distance_t>;
+
+    index_t index;
+    index.options.max_links = 8;
+    std::minstd_rand random;
+
+    for (uint32_t i = 0; i < 300; ++i) {
+        index.insert(i, random_vector(16, random));
+    }
+
+    for (uint32_t i = 0; i < 300; i += 3) {
+        index.remove(i);
+    }
+
+    index.tuned_ef[10] = 42;
+
+    std::stringstream stream;
+    index.save(stream);
+
+    index_t loaded;
+    loaded.load(stream);
+
+    REQUIRE(loaded.check());
+    REQUIRE(loaded.options.max_links == 8);
+    REQUIRE(loaded.tuned_ef == index.tuned_ef);
+    REQUIRE(loaded.nodes.size() == index.nodes.size());
+    REQUIRE(loaded.level_counts == index.level_counts);
+
+    for (const auto &node: index.nodes) {
+        const auto &loaded_node = loaded.nodes.at(node.first);
+
+        REQUIRE(loaded_node.vector == node.second.vector);
+        REQUIRE(loaded_node.layers.size() == node.second.layers.size());
+
+        for (size_t layer = 0; layer < node.second.layers.size(); ++layer) {
+            REQUIRE(loaded_node.layers[layer].outgoing.size() == node.second.layers[layer].outgoing.size());
+            REQUIRE(loaded_node.layers[layer].incoming.size() == node.second.layers[layer].incoming.size());
+        }
+    }
+
+    auto target = random_vector(16, random);
+    auto expected = index.search(target, 10);
+    auto actual = loaded.search(target, 10);
+
+    REQUIRE(actual.size() == expected.size());
+
+    for (size_t i = 0; i < expected.size(); ++i) {
+        REQUIRE(actual[i].key == expected[i].key);
+    }
+
+    // The state of the random engine is restored too, so further inserts are identical.
+    auto vector = random_vector(16, random);
+    index.insert(1000, vector);
+    loaded.insert(1000, vector);
+    REQUIRE(loaded.nodes.at(1000).layers.size() == index.nodes.at(1000).layers.size());
+}
+
+
+TEST_CASE("parallel loading gives the same index as sequential") {
+    using index_t = hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::l2_square_distance_t>;
+
+    index_t index;
+    index.options.max_links = 4;
+    index.options.ef_construction = 16;
+    std::minstd_rand random;
+
+    // Several chunks, the last one is incomplete.
+    for (uint32_t i = 0; i < 10000; ++i) {
+        index.insert(i, random_vector(4, random));
+    }
+
+    std::stringstream stream;
+    index.save(stream);
+
+    index_t sequential;
+    stream.seekg(0);
+    sequential.load(stream, 1);
+
+    index_t parallel;
+    stream.seekg(0);
+    parallel.load(stream, 4);
+
+    REQUIRE(parallel.check());
+    REQUIRE(parallel.nodes.size() == index.nodes.size());
+
+    std::stringstream sequential_stream;
+    sequential.save(sequential_stream);
+
+    std::stringstream parallel_stream;
+    parallel.save(parallel_stream);
+
+    REQUIRE(parallel_stream.str() == sequential_stream.str());
+}
+
+
+TEST_CASE("hnsw index loads snapshots of the first version") {
+    using index_t = hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::l2_square_distance_t>;
+
+    index_t index;
+    index.options.max_links = 8;
+    std::minstd_rand random;
+
+    for (uint32_t i = 0; i < 300; ++i) {
+        index.insert(i, random_vector(16, random));
+    }
+
+    for (uint32_t i = 0; i < 300; i += 3) {
+        index.remove(i);
+    }
+
+    std::stringstream stream;
+    write_first_version(stream, index);
+
+    index_t loaded;
+    loaded.load(stream, 4);
+
+    REQUIRE(loaded.check());
+    REQUIRE(loaded.options.max_links == 8);
+    REQUIRE(loaded.nodes.size() == index.nodes.size());
+    REQUIRE(loaded.level_counts == index.level_counts);
+
+    for (const auto &node: index.nodes) {
+        const auto &loaded_node = loaded.nodes.at(node.first);
+
+        REQUIRE(loaded_node.vector == node.second.vector);
+        REQUIRE(loaded_node.layers.size() == node.second.layers.size());
+
+        for (size_t layer = 0; layer < node.second.layers.size(); ++layer) {
+            const auto &outgoing = node.second.layers[layer].outgoing;
+            const auto &loaded_outgoing = loaded_node.layers[layer].outgoing;
+
+            REQUIRE(std::equal(outgoing.begin(), outgoing.end(), loaded_outgoing.begin(), loaded_outgoing.end()));
+            REQUIRE(loaded_node.layers[layer].incoming.size() == node.second.layers[layer].incoming.size());
+        }
+    }
+
+    // The loaded index is saved in the current version.
+    std::stringstream resaved;
+    loaded.save(resaved);
+
+    index_t reloaded;
+    reloaded.load(resaved);
+    REQUIRE(reloaded.check());
+    REQUIRE(reloaded.nodes.size() == index.nodes.size());
+}
+
+
+TEST_CASE("key mapper survives save and load") {
+    using index_t = hnsw::key_mapper<std::string, hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::cosine_distance_t>>;
+
+    index_t index;
+    std::minstd_rand random;
+
+    for (size_t i = 0; i < 100; ++i) {
+        index.insert("key" + std::to_string(i), random_vector(16, random));
+    }
+
+    for (size_t i = 0; i < 100; i += 5) {
+        index.remove("key" + std::to_string(i));
+    }
+
+    for (size_t i = 100; i < 110; ++i) {
+        index.insert("key" + std::to_string(i), random_vector(16, random));
+    }
+
+    // Internal keys of removed keys are reused.
+    REQUIRE(index.keys.internal_size() == 100);
+    REQUIRE(index.keys.free_keys().size() == 10);
+    REQUIRE(index.check());
+
+    std::stringstream stream;
+    index.save(stream);
+
+    index_t loaded;
+    loaded.load(stream);
+
+    REQUIRE(loaded.check());
+    REQUIRE(loaded.keys == index.keys);
+    REQUIRE(loaded.keys.free_keys() == index.keys.free_keys());
+
+    auto target = random_vector(16, random);
+    auto expected = index.search(target, 5);
+    auto actual = loaded.search(target, 5);
+
+    REQUIRE(actual.size() == expected.size());
+
+    for (size_t i = 0; i < expected.size(); ++i) {
+        REQUIRE(actual[i].key == expected[i].key);
+    }
+}
+
+
+TEST_CASE("key mapper converts random internal keys of the first version to dense ones") {
+    using internal_index_t = hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::l2_square_distance_t>;
+    using index_t = hnsw::key_mapper<std::string, internal_index_t>;
+
+    internal_index_t internal_index;
+    std::minstd_rand random;
+
+    for (uint32_t i = 0; i < 100; ++i) {
+        internal_index.insert(i * 40000000u + 7, random_vector(8, random));
+    }
+
+    // The layout of the first version: the random engine, the index of the first version and the key pairs.
+    std::stringstream stream;
+    hnsw::detail::stream_writer_t writer(stream);
+    hnsw::detail::write_header(writer, "HNSWMAP", 1);
+    hnsw::detail::write_random(writer, std::minstd_rand());
+    write_first_version(stream, internal_index);
+    hnsw::detail::write_value(writer, std::uint64_t(internal_index.nodes.size()));
+
+    for (uint32_t i = 0; i < 100; ++i) {
+        hnsw::detail::write_value(writer, "key" + std::to_string(i));
+        hnsw::detail::write_value(writer, i * 40000000u + 7);
+    }
+
+    index_t loaded;
+    loaded.load(stream);
+
+    REQUIRE(loaded.check());
+    REQUIRE(loaded.keys.internal_size() == 100);
+    REQUIRE(loaded.keys.free_keys().empty());
+
+    for (uint32_t i = 0; i < 100; ++i) {
+        REQUIRE(*loaded.keys.find("key" + std::to_string(i)) == i);
+    }
+
+    for (size_t i = 0; i < 10; ++i) {
+        auto target = random_vector(8, random);
+        auto expected = internal_index.search(target, 5);
+        auto actual = loaded.search(target, 5);
+
+        REQUIRE(actual.size() == expected.size());
+
+        for (size_t j = 0; j < expected.size(); ++j) {
+            REQUIRE(actual[j].key == "key" + std::to_string((expected[j].key - 7) / 40000000u));
+        }
+    }
+}
+
+
+TEST_CASE("loading a broken stream leaves the index intact") {
+    using index_t = hnsw::hnsw_index<std::string, std::vector<float>, hnsw::l2_square_distance_t>;
+
+    index_t index;
+    std::minstd_rand random;
+
+    for (size_t i = 0; i < 50; ++i) {
+        index.insert("key" + std::to_string(i), random_vector(16, random));
+    }
+
+    std::stringstream stream;
+    index.save(stream);
+
+    std::string data = stream.str();
+    std::istringstream truncated(data.substr(0, data.size() / 2));
+
+    index_t loaded;
+    loaded.insert("other", random_vector(16, random));
+
+    REQUIRE_THROWS(loaded.load(truncated));
+    REQUIRE(loaded.nodes.size() == 1);
+
+    std::istringstream garbage("definitely not an index");
+    REQUIRE_THROWS(loaded.load(garbage));
+    REQUIRE(loaded.check());
+
+    // The insert method follows the header (magic, version, byte order), the size of distances, max_links and ef_construction.
+    std::string bad_option = data;
+    bad_option[8 + 2 * sizeof(std::uint32_t) + 1 + 2 * sizeof(std::uint64_t)] = 7;
+    std::istringstream bad_option_stream(bad_option);
+
+    REQUIRE_THROWS_WITH(loaded.load(bad_option_stream), Catch::Contains("unknown option value"));
+    REQUIRE(loaded.nodes.size() == 1);
+}
+
+
+TEST_CASE("checkpoint saves the index as it was when started") {
+    using index_t = hnsw::hnsw_index<uint32_t, std::vector<float>, hnsw::l2_square_distance_t>;
+
+    char path[] = "/tmp/hnsw-unittests-XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    close(fd);
+
+    index_t index;
+    std::minstd_rand random;
+
+    for (uint32_t i = 0; i < 500; ++i) {
+        index.insert(i, random_vector(16, random));
+    }
+
+    std::stringstream expected;
+    index.save(expected);
+
+    auto checkpoint = hnsw::start_checkpoint(index, path);
+
+    // Writers aren't blocked while the snapshot is being written.
+    for (uint32_t i = 0; i < 500; i += 2) {
+        index.remove(i);
+    }
+
+    for (uint32_t i = 500; i < 700; ++i) {
+        index.insert(i, random_vector(16, random));
+    }
+
+    checkpoint.wait();
+    REQUIRE(!checkpoint.running());
+    REQUIRE(checkpoint.poll());
+
+    std::ifstream input(path, std::ios::binary);
+    std::string saved((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    REQUIRE(saved == expected.str());
+
+    auto failed = hnsw::start_checkpoint(index, "/nonexistent/directory/snapshot");
+    REQUIRE_THROWS(failed.wait());
+
+    std::remove(path);
+}